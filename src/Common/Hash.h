@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Non-cryptographic hashes, only meant to tell runs, images and pictures apart cheaply. All
+// input is read in host byte order, so hashes are comparable between little-endian hosts.
+namespace Hash {
+
+// 64-bit FNV-1a. A hash can be continued by passing the previous result as the start value.
+static constexpr uint64_t fnvOffsetBasis = 0xcbf29ce484222325;
+static constexpr uint64_t fnvPrime = 0x100000001b3;
+
+inline uint64_t fnv1a(const void* data, size_t size, uint64_t hash = fnvOffsetBasis)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ bytes[i]) * fnvPrime;
+    }
+    return hash;
+}
+
+// XXH64, which takes 32 bytes per step rather than one, for hashing whole frames
+namespace Xxh64 {
+
+static constexpr uint64_t prime1 = 0x9e3779b185ebca87;
+static constexpr uint64_t prime2 = 0xc2b2ae3d27d4eb4f;
+static constexpr uint64_t prime3 = 0x165667b19e3779f9;
+static constexpr uint64_t prime4 = 0x85ebca77c2b2ae63;
+static constexpr uint64_t prime5 = 0x27d4eb2f165667c5;
+
+inline uint64_t rotateLeft(uint64_t value, int count)
+{
+    return (value << count) | (value >> (64 - count));
+}
+
+inline uint64_t read64(const uint8_t* bytes)
+{
+    uint64_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+inline uint32_t read32(const uint8_t* bytes)
+{
+    uint32_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+inline uint64_t round(uint64_t accumulator, uint64_t input)
+{
+    return rotateLeft(accumulator + input * prime2, 31) * prime1;
+}
+
+inline uint64_t mergeRound(uint64_t hash, uint64_t accumulator)
+{
+    return (hash ^ round(0, accumulator)) * prime1 + prime4;
+}
+
+}
+
+inline uint64_t xxh64(const void* data, size_t size, uint64_t seed = 0)
+{
+    using namespace Xxh64;
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    const uint8_t* const end = bytes + size;
+    uint64_t hash;
+    if (size >= 32)
+    {
+        uint64_t accumulators[4] = { seed + prime1 + prime2, seed + prime2, seed, seed - prime1 };
+        for (; end - bytes >= 32; bytes += 32)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                accumulators[i] = round(accumulators[i], read64(bytes + i * 8));
+            }
+        }
+        hash = rotateLeft(accumulators[0], 1) + rotateLeft(accumulators[1], 7) + rotateLeft(accumulators[2], 12) + rotateLeft(accumulators[3], 18);
+        for (uint64_t accumulator : accumulators)
+        {
+            hash = mergeRound(hash, accumulator);
+        }
+    }
+    else
+    {
+        hash = seed + prime5;
+    }
+    hash += size;
+    for (; end - bytes >= 8; bytes += 8)
+    {
+        hash = rotateLeft(hash ^ round(0, read64(bytes)), 27) * prime1 + prime4;
+    }
+    if (end - bytes >= 4)
+    {
+        hash = rotateLeft(hash ^ read32(bytes) * prime1, 23) * prime2 + prime3;
+        bytes += 4;
+    }
+    for (; bytes < end; ++bytes)
+    {
+        hash = rotateLeft(hash ^ *bytes * prime5, 11) * prime1;
+    }
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Folds one value into a running hash, a step of XXH64 without the final mixing, for streams
+// that come a value at a time, like audio samples, or for chaining other hashes
+inline uint64_t combine(uint64_t hash, uint64_t value)
+{
+    using namespace Xxh64;
+    return rotateLeft(hash ^ round(0, value), 27) * prime1 + prime4;
+}
+
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <streambuf>
+
+// A log line, formatted by the thread that logged it and waiting to be written. Lines longer
+// than the capacity are cut off.
+struct LogRecord
+{
+    static constexpr size_t capacity = 232;
+
+    uint64_t sequence = 0;
+    int color = 0;
+    bool bright = false;
+    uint16_t length = 0;
+    std::array<char, capacity> text;
+};
+
+// The records of one logging thread on their way to the writer thread, in a ring allocated up
+// front. Only the owning thread pushes and only the writer pops, so neither ever waits for the
+// other. When the ring is full, new records are counted as dropped instead.
+class LogQueue
+{
+public:
+    static constexpr size_t size = 256;
+
+    LogQueue() = default;
+
+    LogQueue(const LogQueue&) = delete;
+    LogQueue& operator=(const LogQueue&) = delete;
+
+    // Owner: the record to fill in, or null if the ring is full
+    LogRecord* beginPush()
+    {
+        const size_t currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail - head.load(std::memory_order_acquire) == size)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &records[currentTail % size];
+    }
+
+    // Owner: hands the record from beginPush to the writer
+    void endPush()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Writer: the oldest record, or null if there is none
+    const LogRecord* front() const
+    {
+        const size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        return &records[currentHead % size];
+    }
+
+    // Writer: releases the record from front to the owner
+    void pop()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Writer: the number of records dropped since the last call
+    uint64_t takeDropped()
+    {
+        return dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    // Taken by a thread for as long as it lives, then left for the next new thread to take
+    std::atomic<bool> owned = true;
+
+    // The queues of a log system form a list that only ever grows
+    LogQueue* next = nullptr;
+
+private:
+    std::array<LogRecord, size> records;
+    std::atomic<size_t> head = 0;
+    std::atomic<size_t> tail = 0;
+    std::atomic<uint64_t> dropped = 0;
+};
+
+// Lets an ostream format straight into a record, without allocating
+class LogRecordBuffer : public std::streambuf
+{
+public:
+    void reset(LogRecord& record)
+    {
+        setp(record.text.data(), record.text.data() + record.text.size());
+    }
+
+    size_t getLength() const
+    {
+        return size_t(pptr() - pbase());
+    }
+
+protected:
+    int_type overflow(int_type) override
+    {
+        return traits_type::eof();
+    }
+};
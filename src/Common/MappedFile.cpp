@@ -0,0 +1,117 @@
+#include "MappedFile.h"
+
+#include "Exception.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+void MappedFile::open(const std::filesystem::path& path)
+{
+    close();
+    file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        file = nullptr;
+        throw RuntimeError("Could not open ", path.string());
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize))
+    {
+        close();
+        throw RuntimeError("Could not get the size of ", path.string());
+    }
+    mappedSize = size_t(fileSize.QuadPart);
+    if (mappedSize == 0)
+    {
+        return;
+    }
+    mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        close();
+        throw RuntimeError("Could not map ", path.string());
+    }
+    address = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (address == nullptr)
+    {
+        close();
+        throw RuntimeError("Could not map ", path.string());
+    }
+}
+
+void MappedFile::close()
+{
+    if (address)
+    {
+        UnmapViewOfFile(address);
+    }
+    if (mapping)
+    {
+        CloseHandle(mapping);
+    }
+    if (file)
+    {
+        CloseHandle(file);
+    }
+    address = nullptr;
+    mapping = nullptr;
+    file = nullptr;
+    mappedSize = 0;
+}
+
+#else
+
+void MappedFile::open(const std::filesystem::path& path)
+{
+    close();
+    const int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0)
+    {
+        throw RuntimeError("Could not open ", path.string());
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0)
+    {
+        ::close(file);
+        throw RuntimeError("Could not get the size of ", path.string());
+    }
+    if (status.st_size > 0)
+    {
+        void* mapped = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_SHARED, file, 0);
+        if (mapped == MAP_FAILED)
+        {
+            ::close(file);
+            throw RuntimeError("Could not map ", path.string());
+        }
+        address = mapped;
+        mappedSize = size_t(status.st_size);
+    }
+    // The mapping stays valid without the descriptor
+    ::close(file);
+}
+
+void MappedFile::close()
+{
+    if (address)
+    {
+        munmap(const_cast<void*>(address), mappedSize);
+    }
+    address = nullptr;
+    mappedSize = 0;
+}
+
+#endif
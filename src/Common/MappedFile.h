@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+// A file mapped read-only into memory. Pages are loaded on first access and shared with
+// every other process mapping the same file.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Throws RuntimeError if the file cannot be opened or mapped
+    void open(const std::filesystem::path& path);
+    void close();
+
+    const void* data() const
+    {
+        return address;
+    }
+
+    size_t size() const
+    {
+        return mappedSize;
+    }
+
+private:
+    const void* address = nullptr;
+    size_t mappedSize = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
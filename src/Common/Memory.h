@@ -1,9 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <memory>
 #include <functional>
 #include <vector>
 #include <sstream>
+#include <unordered_map>
 
 #include "Exception.h"
 #include "Types.h"
@@ -19,7 +22,7 @@ public:
     virtual void visit(const class ReadRegister&) = 0;
     virtual void visit(const class WriteRegister&) = 0;
     virtual void visit(const class ReadWriteRegister&) = 0;
-    virtual void visit(const class BootRomLocation&) = 0;
+    virtual void visit(const class ArrayLocation&) = 0;
 };
 
 class Location
@@ -381,71 +384,103 @@ private:
     Byte lastValue;
 };
 
-class BootRomLocation : public Location
+// A byte of a flat memory array that has no Location object of its own, as handed to a LocationVisitor
+class ArrayLocation
 {
 public:
-    BootRomLocation(Byte ramValue, Byte bootRomValue, bool& bootRomDataEnabled)
-        : ramValue(ramValue)
-        , bootRomValue(bootRomValue)
-        , bootRomDataEnabled(bootRomDataEnabled)
+    ArrayLocation(uint64_t applicationCount, bool readOnly)
+        : applicationCount(applicationCount)
+        , readOnly(readOnly)
+    {
+    }
+
+    uint64_t getApplicationCount() const
+    {
+        return applicationCount;
+    }
+
+    bool isReadOnly() const
+    {
+        return readOnly;
+    }
+
+private:
+    const uint64_t applicationCount;
+    const bool readOnly;
+};
+
+// A byte of RAM whose storage is owned by a flat array elsewhere, so that the RAM as a whole
+// can be accessed without going through the locations
+class ArrayMemory : public Location
+{
+public:
+    ArrayMemory(Byte& value)
+        : value(value)
     {
     }
 
 private:
     Byte readImpl(Byte& bus) override
     {
-        Byte value;
-        if (bootRomDataEnabled)
-        {
-            value = bootRomValue;
-        }
-        else
-        {
-            value = ramValue;
-        }
         bus = value;
         return value;
     }
 
     void writeImpl(Byte newValue) override
     {
-        ramValue = newValue;
+        value = newValue;
     }
 
     Byte inspect() const override
     {
-        if (bootRomDataEnabled)
-        {
-            return bootRomValue;
-        }
-        else
-        {
-            return ramValue;
-        }
+        return value;
     }
 
     void accept(LocationVisitor& visitor) const override
     {
-        visitor.visit(*this);
+        visitor.visit(ArrayLocation(getApplicationCount(), false));
     }
 
     void print(std::ostream& out) const override
     {
-        if (bootRomDataEnabled)
-        {
-            out << bootRomValue;
-        }
-        else
-        {
-            out << ramValue;
-        }
+        out << value;
     }
 
+    Byte& value;
+};
+
+// Bytes that are mapped into an address space a page at a time rather than through a Location
+// per byte, e.g. a ROM image in a memory-mapped file or the work RAM. Mirrors share the region,
+// and with it the application counts and breakpoints.
+class MemoryRegion
+{
 public:
-    bool& bootRomDataEnabled;
-private:
-    Byte bootRomValue;
-    Byte ramValue;
+    // Read-only, writing is an access error
+    MemoryRegion(const Byte* data, uint32_t size)
+        : data(data)
+        , writableData(nullptr)
+        , size(size)
+        , applicationCounts(size)
+    {
+    }
+
+    // Read and written through the address space
+    MemoryRegion(std::vector<Byte>& ram)
+        : data(ram.data())
+        , writableData(ram.data())
+        , size(uint32_t(ram.size()))
+        , applicationCounts(ram.size())
+    {
+    }
+
+    MemoryRegion(const MemoryRegion&) = delete;
+    MemoryRegion& operator=(const MemoryRegion&) = delete;
+
+    const Byte* const data;
+    Byte* const writableData;
+    const uint32_t size;
+    std::vector<uint64_t> applicationCounts;
+    std::unordered_map<uint32_t, Location::BreakpointCallback> breakpoints;
 };
 
 class Access
@@ -488,6 +523,42 @@ inline std::ostream& operator<<(std::ostream& out, const ConstLocationAccess& ac
     return out;
 }
 
+// Records the reads made while it is attached to a Memory, to tell what a piece of code depends on
+template<typename AddressType>
+class ReadLog
+{
+public:
+    struct Entry
+    {
+        AddressType address;
+        Byte value;
+    };
+
+    static constexpr int capacity = 16;
+
+    void clear()
+    {
+        count = 0;
+        overflow = false;
+    }
+
+    void add(AddressType address, Byte value)
+    {
+        if (count == capacity)
+        {
+            overflow = true;
+        }
+        else
+        {
+            entries[count++] = { address, value };
+        }
+    }
+
+    std::array<Entry, capacity> entries;
+    int count = 0;
+    bool overflow = false;
+};
+
 template<typename Type>
 class Memory
 {
@@ -506,8 +577,24 @@ public:
     {
     }
 
+    static constexpr uint32_t pageBits = 12;
+    static constexpr uint32_t pageSize = 1 << pageBits;
+    static constexpr uint32_t pageMask = pageSize - 1;
+
+    // Access speeds are set per block, finer than pages as the slow joypad registers take only $4000-$41FF
+    static constexpr uint32_t speedBlockBits = 9;
+    static constexpr uint32_t speedBlockSize = 1 << speedBlockBits;
+
+    // The bus time of the accesses made since the last takeAccessTime()
+    struct AccessTime
+    {
+        uint32_t count = 0;
+        uint64_t cycles = 0;
+    };
+
     Memory(uint32_t size, Output& output)
-        : memory(size)
+        : pages((size + pageMask) >> pageBits)
+        , accessCycles((size + speedBlockSize - 1) >> speedBlockBits, { defaultAccessCycles, defaultAccessCycles })
         , memorySize(size)
         , output(output, "memory")
     {
@@ -525,40 +612,155 @@ public:
     void createLocation(AddressType address, Args&&... args)
     {
         checkIsInitialized(address, false, __FUNCTION__);
-        memory[address] = std::make_shared<LocationType>(std::forward<Args>(args)...);
+        getLocationSlot(address) = std::make_shared<LocationType>(std::forward<Args>(args)...);
     }
 
     void createMirror(AddressType mirror, AddressType origin)
     {
+        if (getPage(origin).region)
+        {
+            mirrorPage(mirror, origin);
+            return;
+        }
         checkIsInitialized(mirror, false, __FUNCTION__);
-        if (std::shared_ptr<Location> location = memory[origin])
+        if (std::shared_ptr<Location> location = findLocation(origin))
+        {
+            getLocationSlot(mirror) = location;
+        }
+    }
+
+    // Mirrors size bytes from origin on. Whole pages with nothing at the mirror yet share the
+    // locations of the origin page, so that mirroring the system area into every bank does not
+    // take a table entry per address.
+    void createMirrors(AddressType mirror, AddressType origin, uint32_t size)
+    {
+        if (size == 0)
+        {
+            return;
+        }
+        checkBounds(uint32_t(mirror) + size - 1, __FUNCTION__);
+        for (uint32_t offset = 0; offset < size; )
+        {
+            const uint32_t mirrorAddress = uint32_t(mirror) + offset;
+            const uint32_t originAddress = uint32_t(origin) + offset;
+            if (((mirrorAddress | originAddress) & pageMask) == 0 && size - offset >= pageSize && isPageEmpty(mirrorAddress))
+            {
+                const Page& originPage = getPage(originAddress);
+                if (originPage.region)
+                {
+                    mirrorPage(mirrorAddress, originAddress);
+                }
+                else
+                {
+                    pages[mirrorAddress >> pageBits].locations = originPage.locations;
+                }
+                offset += pageSize;
+                continue;
+            }
+            createMirror(mirrorAddress, originAddress);
+            ++offset;
+        }
+    }
+
+    // Maps size bytes of the region, from offset on, to the pages starting at address. The
+    // address, offset and size must all be multiples of the page size.
+    void mapRegion(AddressType address, const std::shared_ptr<MemoryRegion>& region, uint32_t offset, uint32_t size)
+    {
+        if ((uint32_t(address) | offset | size) & pageMask)
         {
-            memory[mirror] = location;
+            throw AccessException(__FUNCTION__, ": mapping of ", size, " bytes at ", address, " is not page aligned");
         }
+        if (offset + size > region->size)
+        {
+            throw AccessException(__FUNCTION__, ": ", size, " bytes from ", offset, " exceed the region size ", region->size);
+        }
+        for (uint32_t pageOffset = 0; pageOffset < size; pageOffset += pageSize)
+        {
+            const AddressType pageAddress = uint32_t(address) + pageOffset;
+            checkPageIsFree(pageAddress, __FUNCTION__);
+            pages[uint32_t(pageAddress) >> pageBits] = Page{ region.get(), offset + pageOffset, nullptr };
+        }
+        if (std::find(regions.begin(), regions.end(), region) == regions.end())
+        {
+            regions.push_back(region);
+        }
+    }
+
+    // Sets the cycles an access takes in the blocks from address on, both normally and with fast access
+    // selected. The address and size must be multiples of the block size.
+    void setAccessCycles(AddressType address, uint32_t size, uint8_t cycles, uint8_t fastCycles)
+    {
+        if ((uint32_t(address) | size) & (speedBlockSize - 1))
+        {
+            throw AccessException(__FUNCTION__, ": ", size, " bytes at ", address, " are not block aligned");
+        }
+        checkBounds(uint32_t(address) + size - 1, __FUNCTION__);
+        for (uint32_t block = 0; block < size; block += speedBlockSize)
+        {
+            accessCycles[(uint32_t(address) + block) >> speedBlockBits] = { cycles, fastCycles };
+        }
+    }
+
+    void setFastAccess(bool enabled)
+    {
+        fastAccess = enabled;
+    }
+
+    bool isFastAccess() const
+    {
+        return fastAccess;
     }
 
+    AccessTime takeAccessTime()
+    {
+        const AccessTime time = accessTime;
+        accessTime = AccessTime();
+        return time;
+    }
+
+    // Unmapped addresses share one invalid location until a breakpoint is set on one of them.
+    // Pages without any locations are left without a table, and read as the invalid location.
     void finalize()
     {
-        for (std::shared_ptr<Location>& location : memory)
+        for (uint32_t pageIndex = 0; pageIndex < pages.size(); ++pageIndex)
         {
-            if (location.get() == nullptr)
+            if (const Page& page = pages[pageIndex]; page.locations)
             {
-                location = std::make_shared<InvalidLocation>();
+                std::replace(page.locations.get(), page.locations.get() + getPageLocationCount(pageIndex), std::shared_ptr<Location>(), invalidLocation);
             }
         }
+        finalized = true;
     }
 
     Byte readByte(AddressType address)
     {
         Byte result;
         checkIsInitialized(address, true, __FUNCTION__);
-        try
+        addAccessTime(address);
+        if (const Page& page = getPage(address); page.region)
         {
-            result = memory[address]->read(bus);
+            const uint32_t index = getIndex(page, address);
+            result = page.region->data[index];
+            bus = result;
+            if (!page.region->breakpoints.empty())
+            {
+                callBreakpoint(*page.region, index, Location::Operation::Read, result, 0);
+            }
         }
-        catch (const AccessException& e)
+        else
         {
-            handleAccessException(e, address);
+            try
+            {
+                result = getLocation(address).read(bus);
+            }
+            catch (const AccessException& e)
+            {
+                handleAccessException(e, address);
+            }
+        }
+        if (readLog)
+        {
+            readLog->add(address, result);
         }
         return result;
     }
@@ -595,10 +797,27 @@ public:
 
     void writeByte(Byte value, AddressType address)
     {
+        ++writeCount;
         checkIsInitialized(address, true, __FUNCTION__);
+        addAccessTime(address);
+        if (const Page& page = getPage(address); page.region)
+        {
+            if (!page.region->writableData)
+            {
+                handleAccessException(AccessException("MemoryRegion: Bad memory access: writing not allowed"), address);
+                return;
+            }
+            const uint32_t index = getIndex(page, address);
+            page.region->writableData[index] = value;
+            if (!page.region->breakpoints.empty())
+            {
+                callBreakpoint(*page.region, index, Location::Operation::Write, value, 0);
+            }
+            return;
+        }
         try
         {
-            return memory[address]->write(value);
+            return getLocation(address).write(value);
         }
         catch (const AccessException& e)
         {
@@ -623,9 +842,18 @@ public:
     {
         Byte result;
         checkIsInitialized(address, true, __FUNCTION__);
+        addAccessTime(address);
+        if (const Page& page = getPage(address); page.region)
+        {
+            const uint32_t index = getIndex(page, address);
+            ++page.region->applicationCounts[index];
+            result = page.region->data[index];
+            bus = result;
+            return result;
+        }
         try
         {
-            result = memory[address]->apply(bus);
+            result = getLocation(address).apply(bus);
         }
         catch (const AccessException& e)
         {
@@ -637,9 +865,14 @@ public:
     void reset(AddressType address)
     {
         checkIsInitialized(address, true, __FUNCTION__);
+        if (const Page& page = getPage(address); page.region)
+        {
+            page.region->applicationCounts[getIndex(page, address)] = 0;
+            return;
+        }
         try
         {
-            return memory[address]->reset();
+            return getLocation(address).reset();
         }
         catch (const AccessException& e)
         {
@@ -647,31 +880,76 @@ public:
         }
     }
 
+    // Of every address at once, without going through them one by one
+    void resetApplicationCounts()
+    {
+        for (const std::shared_ptr<MemoryRegion>& region : regions)
+        {
+            std::fill(region->applicationCounts.begin(), region->applicationCounts.end(), 0);
+        }
+        // Mirrored pages share their tables, each is only gone through once
+        std::vector<const std::shared_ptr<Location>*> resetTables;
+        for (uint32_t pageIndex = 0; pageIndex < pages.size(); ++pageIndex)
+        {
+            const LocationTable& locations = pages[pageIndex].locations;
+            if (!locations || std::find(resetTables.begin(), resetTables.end(), locations.get()) != resetTables.end())
+            {
+                continue;
+            }
+            resetTables.push_back(locations.get());
+            for (uint32_t index = 0; index < getPageLocationCount(pageIndex); ++index)
+            {
+                if (locations[index])
+                {
+                    locations[index]->reset();
+                }
+            }
+        }
+        invalidLocation->reset();
+    }
+
     uint64_t getApplicationCount(AddressType address) const
     {
         checkIsInitialized(address, true, __FUNCTION__);
-        return memory[address]->getApplicationCount();
+        if (const Page& page = getPage(address); page.region)
+        {
+            return page.region->applicationCounts[getIndex(page, address)];
+        }
+        return getLocation(address).getApplicationCount();
     }
 
     bool hasBreakpoint(AddressType address) const
     {
         checkIsInitialized(address, true, __FUNCTION__);
-        return memory[address]->hasBreakpoint();
+        if (const Page& page = getPage(address); page.region)
+        {
+            return page.region->breakpoints.count(getIndex(page, address)) > 0;
+        }
+        return getLocation(address).hasBreakpoint();
     }
 
     void applyBreakpoint(AddressType address) const
     {
         checkIsInitialized(address, true, __FUNCTION__);
-        return memory[address]->applyBreakpoint();
+        if (const Page& page = getPage(address); page.region)
+        {
+            const uint32_t index = getIndex(page, address);
+            return callBreakpoint(*page.region, index, Location::Operation::Apply, 0, page.region->applicationCounts[index] + 1);
+        }
+        return getLocation(address).applyBreakpoint();
     }
 
     Byte inspect(AddressType address) const
     {
         Byte result;
         checkIsInitialized(address, true, __FUNCTION__);
+        if (const Page& page = getPage(address); page.region)
+        {
+            return page.region->data[getIndex(page, address)];
+        }
         try
         {
-            result = memory[address]->inspect();
+            result = getLocation(address).inspect();
         }
         catch (const AccessException& e)
         {
@@ -683,27 +961,199 @@ public:
     bool setBreakpoint(AddressType address, Location::BreakpointCallback callback)
     {
         checkIsInitialized(address, true, __FUNCTION__);
-        return memory[address]->setBreakpoint(callback);
+        if (const Page& page = getPage(address); page.region)
+        {
+            if (callback)
+            {
+                page.region->breakpoints[getIndex(page, address)] = callback;
+            }
+            else
+            {
+                page.region->breakpoints.erase(getIndex(page, address));
+            }
+            return true;
+        }
+        std::shared_ptr<Location>& location = getLocationSlot(address);
+        if (location == invalidLocation)
+        {
+            location = std::make_shared<InvalidLocation>();
+        }
+        return location->setBreakpoint(callback);
     }
 
     void accept(AddressType address, LocationVisitor& visitor) const
     {
         checkIsInitialized(address, true, __FUNCTION__);
-        memory[address]->accept(visitor);
+        if (const Page& page = getPage(address); page.region)
+        {
+            visitor.visit(ArrayLocation(page.region->applicationCounts[getIndex(page, address)], !page.region->writableData));
+            return;
+        }
+        getLocation(address).accept(visitor);
     }
 
     void print(AddressType address, std::ostream& out) const
     {
         checkIsInitialized(address, true, __FUNCTION__);
-        memory[address]->print(out);
+        if (const Page& page = getPage(address); page.region)
+        {
+            out << page.region->data[getIndex(page, address)];
+            return;
+        }
+        getLocation(address).print(out);
+    }
+
+    uint64_t getWriteCount() const
+    {
+        return writeCount;
+    }
+
+    // The value the last access left on the data bus, which open bus reads return
+    Byte getBus() const
+    {
+        return bus;
+    }
+
+    void setBus(Byte value)
+    {
+        bus = value;
+    }
+
+    // Attaches a log that every successful read is added to, or detaches it with nullptr
+    void setReadLog(ReadLog<AddressType>* log)
+    {
+        readLog = log;
+    }
+
+    // The locations hold no state worth saving beyond the bus and the access speed, RAM is saved by its owner
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        archive(bus);
+        archive(fastAccess);
     }
 
 private:
+    typedef std::shared_ptr<std::shared_ptr<Location>[]> LocationTable;
+
+    // Either mapped to a region, or holding the locations of its addresses in a table of its
+    // own, which is only allocated once a location is created in the page and is shared by
+    // the pages mirroring it
+    struct Page
+    {
+        MemoryRegion* region = nullptr;
+        uint32_t offset = 0;
+        LocationTable locations;
+    };
+
     static AddressType getNextAddress(AddressType address, uint32_t wrappingMask)
     {
         return (address & ~wrappingMask) + ((address + 1) & wrappingMask);
     }
 
+    void addAccessTime(AddressType address)
+    {
+        ++accessTime.count;
+        accessTime.cycles += accessCycles[uint32_t(address) >> speedBlockBits][fastAccess];
+    }
+
+    const Page& getPage(AddressType address) const
+    {
+        return pages[uint32_t(address) >> pageBits];
+    }
+
+    static uint32_t getIndex(const Page& page, AddressType address)
+    {
+        return page.offset + (uint32_t(address) & pageMask);
+    }
+
+    // Smaller than a page only for memories smaller than one, like those of immediate operands
+    uint32_t getPageLocationCount(uint32_t pageIndex) const
+    {
+        return std::min(pageSize, memorySize - (pageIndex << pageBits));
+    }
+
+    Location& getLocation(AddressType address) const
+    {
+        const Page& page = getPage(address);
+        return page.locations ? *page.locations[uint32_t(address) & pageMask] : *invalidLocation;
+    }
+
+    // The location at the address, or nullptr if there is none yet
+    std::shared_ptr<Location> findLocation(AddressType address) const
+    {
+        const Page& page = getPage(address);
+        return page.locations ? page.locations[uint32_t(address) & pageMask] : nullptr;
+    }
+
+    // The table entry of the address, for replacing its location. Allocates the table of the
+    // page if it has none, and copies it if it is shared, so that the change does not reach
+    // the mirrors.
+    std::shared_ptr<Location>& getLocationSlot(AddressType address)
+    {
+        const uint32_t pageIndex = uint32_t(address) >> pageBits;
+        LocationTable& locations = pages[pageIndex].locations;
+        const uint32_t count = getPageLocationCount(pageIndex);
+        if (!locations || locations.use_count() > 1)
+        {
+            LocationTable table = std::make_shared<std::shared_ptr<Location>[]>(count);
+            if (locations)
+            {
+                std::copy_n(locations.get(), count, table.get());
+            }
+            else if (finalized)
+            {
+                std::fill_n(table.get(), count, invalidLocation);
+            }
+            locations = std::move(table);
+        }
+        return locations[uint32_t(address) & pageMask];
+    }
+
+    bool isPageEmpty(AddressType address) const
+    {
+        const Page& page = getPage(address);
+        return !page.region && !page.locations;
+    }
+
+    static void callBreakpoint(const MemoryRegion& region, uint32_t index, Location::Operation operation, Byte value, uint64_t applicationCount)
+    {
+        const auto breakpoint = region.breakpoints.find(index);
+        if (breakpoint != region.breakpoints.end())
+        {
+            breakpoint->second(operation, value, applicationCount);
+        }
+    }
+
+    void mirrorPage(AddressType mirror, AddressType origin)
+    {
+        if ((uint32_t(mirror) ^ uint32_t(origin)) & pageMask)
+        {
+            throw AccessException(__FUNCTION__, ": mirror ", mirror, " of ", origin, " is not page aligned");
+        }
+        const Page& originPage = getPage(origin);
+        Page& target = pages[uint32_t(mirror) >> pageBits];
+        if (target.region == originPage.region && target.offset == originPage.offset)
+        {
+            return;
+        }
+        checkPageIsFree(mirror, __FUNCTION__);
+        target = originPage;
+    }
+
+    void checkPageIsFree(AddressType address, const char* operation) const
+    {
+        const uint32_t pageIndex = uint32_t(address) >> pageBits;
+        checkBounds((pageIndex << pageBits) + pageMask, operation);
+        const Page& page = pages[pageIndex];
+        const bool isFree = !page.region
+            && (!page.locations || std::all_of(page.locations.get(), page.locations.get() + getPageLocationCount(pageIndex), [](const std::shared_ptr<Location>& location) { return !location; }));
+        if (!isFree)
+        {
+            throw AccessException(operation, ": page @", AddressType(pageIndex << pageBits), " is already initialized");
+        }
+    }
+
     void checkBounds(AddressType address, const char* operation) const
     {
         if (address >= memorySize)
@@ -722,7 +1172,7 @@ private:
             return;
         }
         checkBounds(address, operation);
-        bool isInitialized = memory[address].get() != nullptr;
+        bool isInitialized = findLocation(address) != nullptr || getPage(address).region != nullptr;
         if (isInitialized != shouldBeInitialized)
         {
             std::ostringstream ss;
@@ -742,13 +1192,12 @@ private:
 
     void handleAccessException(const AccessException& e, AddressType address) const
     {
+#if DEBUG_MEMORY
         std::ostringstream ss;
         ss << " @" << address;
-        std::string message = e.what() + ss.str();
-#if DEBUG_MEMORY
-        throw AccessException(message);
+        throw AccessException(e.what() + ss.str());
 #else
-        output.error(message);
+        LOG_ERROR(output, e.what(), " @", address);
 #endif
     }
 
@@ -756,8 +1205,17 @@ public:
     Byte bus;
 
 private:
-    std::vector<std::shared_ptr<Location>> memory;
+    std::vector<Page> pages;
+    std::vector<std::shared_ptr<MemoryRegion>> regions;
+    static constexpr uint8_t defaultAccessCycles = 6;
+    std::vector<std::array<uint8_t, 2>> accessCycles;
+    bool fastAccess = false;
+    AccessTime accessTime;
+    const std::shared_ptr<Location> invalidLocation = std::make_shared<InvalidLocation>();
     const uint32_t memorySize;
+    bool finalized = false;
+    uint64_t writeCount = 0;
+    ReadLog<AddressType>* readLog = nullptr;
     Output output;
 };
 
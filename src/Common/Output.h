@@ -1,19 +1,48 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
 
 #ifdef _WIN32
 #define NOMINMAX
 #include <windows.h>
 #endif
 
+#include "LogQueue.h"
+
 #define LOG_NAME(NAME) static constexpr const char* NAME = #NAME
 
+// The most verbose log level compiled in, as the number of a Log::Level. Logging through the
+// LOG_ macros above it compiles away, arguments and all.
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL 3
+#endif
+
+// Like output.error(...), info and debug, but the arguments are only evaluated when the line
+// is actually logged
+#define LOG_ERROR(OUTPUT, ...) LOG_AT_LEVEL(OUTPUT, Error, error, __VA_ARGS__)
+#define LOG_INFO(OUTPUT, ...) LOG_AT_LEVEL(OUTPUT, Info, info, __VA_ARGS__)
+#define LOG_DEBUG(OUTPUT, ...) LOG_AT_LEVEL(OUTPUT, Debug, debug, __VA_ARGS__)
+
+#define LOG_AT_LEVEL(OUTPUT, LEVEL, FUNCTION, ...) \
+    do { \
+        if constexpr (Log::isCompiledIn(Log::Level::LEVEL)) { \
+            if ((OUTPUT).isEnabled(Log::Level::LEVEL)) { \
+                (OUTPUT).FUNCTION(__VA_ARGS__); \
+            } \
+        } \
+    } while (false)
+
 class Log
 {
 public:
@@ -40,6 +69,13 @@ public:
         return levelNames[size_t(level)];
     }
 
+    static constexpr Level maxLevel = Level(LOG_MAX_LEVEL);
+
+    static constexpr bool isCompiledIn(Level level)
+    {
+        return level <= maxLevel;
+    }
+
 private:
     static constexpr const char* levelNames[] =
     {
@@ -94,6 +130,37 @@ public:
             deserializeLogConfig();
             ensureExists("default");
             serializeLogConfig();
+            writer = std::thread(&System::runWriter, this);
+        }
+
+        // Every other thread that logs has to be done by now
+        ~System()
+        {
+            {
+                std::scoped_lock<std::mutex> lock(writerMutex);
+                stopping = true;
+            }
+            writerCondition.notify_one();
+            writer.join();
+            drain();
+            if (threadQueue.system == this) {
+                threadQueue.release();
+            }
+            while (LogQueue* queue = queues.load()) {
+                queues = queue->next;
+                delete queue;
+            }
+        }
+
+        // Writes the log to a file rather than to the console, without colors
+        void setLogFile(const std::filesystem::path& path)
+        {
+            Lock lock(*this);
+            logFile.open(path);
+            if (!logFile) {
+                throw std::runtime_error("Failed to open log file " + path.string());
+            }
+            outputStream = &logFile;
         }
 
         void deserializeLogConfig()
@@ -134,29 +201,54 @@ public:
         }
 
 #ifdef _WIN32
-        void setOutputColor(Lock&, const Output&, Color color, bool bright)
+        void setOutputColor(Lock&, Color color, bool bright)
         {
+            if (outputStream != &std::cout) {
+                return;
+            }
             int effectiveColor = int(color);
             if (bright) {
                 effectiveColor |= FOREGROUND_INTENSITY;
             }
+            // The console changes color right away, so what is buffered has to go out first
+            outputStream->flush();
             SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), WORD(effectiveColor));
         }
 #else
-        void setOutputColor(Lock& lock, const Output& output, Color color, bool bright)
+        void setOutputColor(Lock&, Color color, bool bright)
         {
-            output.print(lock, "\33[", (int)color);
+            if (outputStream != &std::cout) {
+                return;
+            }
+            *outputStream << "\33[" << (int)color;
             if (bright) {
-                output.print(lock, ";", 1);
+                *outputStream << ";" << 1;
             }
-            output.print(lock, "m");
+            *outputStream << "m";
         }
 #endif
 
-        Log::Level getLogLevel(const std::string& logName)
+        // Outputs are created from the threads of every emulator instance. The level of a log
+        // name is only looked up once, every output by that name then shares it.
+        const std::atomic<Log::Level>& getLogLevel(const std::string& logName)
         {
-            ensureExists(logName);
-            return Log::toLevel(logLevels[logName]);
+            std::scoped_lock<std::mutex> lock(configMutex);
+            std::unique_ptr<std::atomic<Log::Level>>& level = cachedLogLevels[logName];
+            if (!level) {
+                ensureExists(logName);
+                level = std::make_unique<std::atomic<Log::Level>>(Log::toLevel(logLevels[logName]));
+            }
+            return *level;
+        }
+
+        // Applies the log config file as edited while running
+        void reloadLogConfig()
+        {
+            std::scoped_lock<std::mutex> lock(configMutex);
+            deserializeLogConfig();
+            for (auto& [logName, level] : cachedLogLevels) {
+                level->store(Log::toLevel(logLevels[logName]), std::memory_order_relaxed);
+            }
         }
 
         std::mutex& getMutex()
@@ -164,17 +256,160 @@ public:
             return mutex;
         }
 
+        // Formats a line into the queue of the calling thread, to be written by the writer
+        // thread. It never waits, so it is safe from the audio callback.
+        template<typename... Ts>
+        void post(Color color, bool bright, Ts&&... values)
+        {
+            LogQueue& queue = getThreadQueue();
+            LogRecord* record = queue.beginPush();
+            if (!record) {
+                return;
+            }
+            thread_local LogRecordBuffer buffer;
+            thread_local std::ostream stream(&buffer);
+            buffer.reset(*record);
+            stream.clear();
+            (void)(stream << ... << std::forward<Ts>(values));
+            record->sequence = nextSequence.fetch_add(1, std::memory_order_relaxed);
+            record->color = int(color);
+            record->bright = bright;
+            record->length = uint16_t(buffer.getLength());
+            queue.endPush();
+        }
+
     private:
-        std::ostream& outputStream = std::cout;
+        static constexpr std::chrono::milliseconds flushInterval = std::chrono::milliseconds(10);
+
+        // The queue a thread logs to, handed back when the thread exits
+        struct ThreadQueue
+        {
+            ThreadQueue()
+                : system(nullptr)
+                , queue(nullptr)
+            {
+            }
+
+            ~ThreadQueue()
+            {
+                release();
+            }
+
+            void release()
+            {
+                if (queue) {
+                    queue->owned.store(false, std::memory_order_release);
+                }
+                system = nullptr;
+                queue = nullptr;
+            }
+
+            System* system;
+            LogQueue* queue;
+        };
+
+        static inline thread_local ThreadQueue threadQueue;
+
+        LogQueue& getThreadQueue()
+        {
+            if (threadQueue.system != this) {
+                threadQueue.release();
+                threadQueue.queue = acquireQueue();
+                threadQueue.system = this;
+            }
+            return *threadQueue.queue;
+        }
+
+        // Takes over the queue of an exited thread if there is one, else adds a new one to the
+        // list. Neither takes a lock, only the first line of a thread may allocate.
+        LogQueue* acquireQueue()
+        {
+            for (LogQueue* queue = queues.load(std::memory_order_acquire); queue; queue = queue->next) {
+                bool owned = false;
+                if (queue->owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) {
+                    return queue;
+                }
+            }
+            LogQueue* queue = new LogQueue();
+            queue->next = queues.load(std::memory_order_relaxed);
+            while (!queues.compare_exchange_weak(queue->next, queue, std::memory_order_release, std::memory_order_relaxed)) {
+            }
+            return queue;
+        }
+
+        void runWriter()
+        {
+            std::unique_lock<std::mutex> lock(writerMutex);
+            while (!stopping) {
+                writerCondition.wait_for(lock, flushInterval);
+                lock.unlock();
+                drain();
+                lock.lock();
+            }
+        }
+
+        void drain()
+        {
+            Lock lock(*this);
+        }
+
+        // Writes every queued line in the order they were logged, then flushes once
+        void drain(Lock& lock)
+        {
+            bool written = false;
+            while (true) {
+                LogQueue* oldestQueue = nullptr;
+                for (LogQueue* queue = queues.load(std::memory_order_acquire); queue; queue = queue->next) {
+                    const LogRecord* record = queue->front();
+                    if (record && (!oldestQueue || record->sequence < oldestQueue->front()->sequence)) {
+                        oldestQueue = queue;
+                    }
+                }
+                if (!oldestQueue) {
+                    break;
+                }
+                const LogRecord& record = *oldestQueue->front();
+                setOutputColor(lock, Color(record.color), record.bright);
+                outputStream->write(record.text.data(), record.length);
+                setOutputColor(lock, Color::Default, false);
+                *outputStream << '\n';
+                oldestQueue->pop();
+                written = true;
+            }
+            for (LogQueue* queue = queues.load(std::memory_order_acquire); queue; queue = queue->next) {
+                if (uint64_t dropped = queue->takeDropped()) {
+                    *outputStream << "(" << dropped << " log lines dropped)\n";
+                    written = true;
+                }
+            }
+            if (written) {
+                outputStream->flush();
+            }
+        }
+
+        std::ostream* outputStream = &std::cout;
+        std::ofstream logFile;
         std::mutex mutex;
+        std::mutex configMutex;
         std::string logConfigFilename;
         std::map<std::string, std::string> logLevels;
+        std::map<std::string, std::unique_ptr<std::atomic<Log::Level>>> cachedLogLevels;
+
+        std::atomic<LogQueue*> queues = nullptr;
+        std::atomic<uint64_t> nextSequence = 0;
+
+        std::thread writer;
+        std::mutex writerMutex;
+        std::condition_variable writerCondition;
+        bool stopping = false;
 
         friend class Output;
+        friend class Lock;
     };
 
     class ColorScope;
 
+    // Output written under a lock goes out right away, after whatever was logged before it
     class Lock
     {
     public:
@@ -182,6 +417,12 @@ public:
             : system(system)
             , lock(system.getMutex())
         {
+            system.drain(*this);
+        }
+
+        ~Lock()
+        {
+            system.outputStream->flush();
         }
 
         Lock(Output& output)
@@ -204,17 +445,16 @@ public:
     class ColorScope
     {
     public:
-        ColorScope(Lock& lock, const Output& output, Color color, bool bright)
+        ColorScope(Lock& lock, const Output&, Color color, bool bright)
             : system(lock.system)
             , lock(lock)
-            , output(output)
         {
-            system.setOutputColor(lock, output, color, bright);
+            system.setOutputColor(lock, color, bright);
         }
 
         ~ColorScope()
         {
-            system.setOutputColor(lock, output, Color::Default, false);
+            system.setOutputColor(lock, Color::Default, false);
         }
 
         ColorScope() = delete;
@@ -225,7 +465,6 @@ public:
     private:
         System& system;
         Lock& lock;
-        const Output& output;
     };
 
     Output(System& system, const std::string& name)
@@ -247,8 +486,8 @@ public:
     template<typename... Ts>
     void print(const Lock&, Ts&&... values) const
     {
-        if (logLevel > Log::Level::None) {
-            std::ostream& outputStream = system.outputStream;
+        if (logLevel.load(std::memory_order_relaxed) > Log::Level::None) {
+            std::ostream& outputStream = *system.outputStream;
             (void)(outputStream << ... << std::forward<Ts>(values));
         }
     }
@@ -256,8 +495,8 @@ public:
     template<typename... Ts>
     void print(Lock&&, Ts&&... values) const
     {
-        if (logLevel > Log::Level::None) {
-            std::ostream& outputStream = system.outputStream;
+        if (logLevel.load(std::memory_order_relaxed) > Log::Level::None) {
+            std::ostream& outputStream = *system.outputStream;
             (void)(outputStream << ... << std::forward<Ts>(values));
         }
     }
@@ -265,50 +504,67 @@ public:
     template<typename... Ts>
     void printLine(const Lock&, Ts&&... values) const
     {
-        if (logLevel > Log::Level::None) {
-            std::ostream& outputStream = system.outputStream;
+        if (logLevel.load(std::memory_order_relaxed) > Log::Level::None) {
+            std::ostream& outputStream = *system.outputStream;
             (void)(outputStream << ... << std::forward<Ts>(values));
-            outputStream << std::endl;
+            outputStream << '\n';
         }
     }
 
     template<typename... Ts>
     void printLine(Color color, bool bright, Ts&&... values) const
     {
-        if (logLevel > Log::Level::None) {
+        if (logLevel.load(std::memory_order_relaxed) > Log::Level::None) {
             Lock lock(system);
             ColorScope colorScope(lock, *this, color, bright);
             printLine(lock, std::forward<Ts>(values)...);
         }
     }
 
+    // Queued for the writer thread of the system, see System::post
+    System& getSystem() const
+    {
+        return system;
+    }
+
+    bool isEnabled(Log::Level level) const
+    {
+        return Log::isCompiledIn(level) && logLevel.load(std::memory_order_relaxed) >= level;
+    }
+
     template<typename... Ts>
     void log(Log::Level level, Color color, bool bright, Ts&&... values) const
     {
-        if (logLevel >= level) {
-            printLine(color, bright, std::forward<Ts>(values)...);
+        if (isEnabled(level)) {
+            system.post(color, bright, std::forward<Ts>(values)...);
         }
     }
 
     template<typename... Ts>
     void error(Ts&&... values) const
     {
-        log(Log::Level::Error, Color::Red, true, std::forward<Ts>(values)...);
+        if constexpr (Log::isCompiledIn(Log::Level::Error)) {
+            log(Log::Level::Error, Color::Red, true, std::forward<Ts>(values)...);
+        }
     }
 
     template<typename... Ts>
     void info(Ts&&... values) const
     {
-        log(Log::Level::Info, Color::Default, true, std::forward<Ts>(values)...);
+        if constexpr (Log::isCompiledIn(Log::Level::Info)) {
+            log(Log::Level::Info, Color::Default, true, std::forward<Ts>(values)...);
+        }
     }
 
     template<typename... Ts>
     void debug(Ts&&... values) const
     {
-        log(Log::Level::Debug, Color::Green, true, std::forward<Ts>(values)...);
+        if constexpr (Log::isCompiledIn(Log::Level::Debug)) {
+            log(Log::Level::Debug, Color::Green, true, std::forward<Ts>(values)...);
+        }
     }
 
 private:
     System& system;
-    Log::Level logLevel;
+    const std::atomic<Log::Level>& logLevel;
 };
\ No newline at end of file
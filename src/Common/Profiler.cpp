@@ -3,19 +3,133 @@
 #include <algorithm>
 #include <iomanip>
 
-GlobalProfiler* GlobalProfiler::instance = nullptr;
+GlobalProfiler::~GlobalProfiler()
+{
+    {
+        std::lock_guard<std::mutex> lock(samplerMutex);
+        samplerStopping = true;
+    }
+    samplerCondition.notify_one();
+    if (sampler.joinable())
+    {
+        sampler.join();
+    }
+}
+
+SampleSlot* GlobalProfiler::addSampledThread()
+{
+    std::lock_guard<std::mutex> lock(samplerMutex);
+    sampleSlots.push_back(std::make_unique<SampleSlot>());
+    if (!sampler.joinable())
+    {
+        samplerStartTicks = readTimestampCounter();
+        samplerStartTime = std::chrono::steady_clock::now();
+        sampler = std::thread(&GlobalProfiler::runSampler, this);
+    }
+    return sampleSlots.back().get();
+}
+
+void GlobalProfiler::runSampler()
+{
+    std::unique_lock<std::mutex> lock(samplerMutex);
+    uint64_t previousTicks = readTimestampCounter();
+    while (!samplerStopping)
+    {
+        samplerCondition.wait_for(lock, sampleInterval);
+        // Weighted by the time since the previous sample, as the sampler does not always wake
+        // up in time
+        const uint64_t ticks = readTimestampCounter();
+        takeSample(ticks - previousTicks);
+        previousTicks = ticks;
+    }
+}
+
+void GlobalProfiler::takeSample(uint64_t ticks)
+{
+    for (const std::unique_ptr<SampleSlot>& slot : sampleSlots)
+    {
+        if (!slot->bound)
+        {
+            continue;
+        }
+        ++sampleCount;
+        const int depth = std::min(slot->depth.load(std::memory_order_acquire), SampleSlot::maxDepth);
+        std::array<const ProfileSite*, SampleSlot::maxDepth> sites;
+        for (int i = 0; i < depth; ++i)
+        {
+            sites[i] = slot->sites[i].load(std::memory_order_relaxed);
+        }
+        // Outside of every sampled scope counts as a site of its own
+        const ProfileSite* innermostSite = depth > 0 ? sites[depth - 1] : nullptr;
+        SampleEntry& innermostEntry = samples[innermostSite];
+        innermostEntry.site = innermostSite;
+        ++innermostEntry.selfCount;
+        innermostEntry.selfTicks += ticks;
+        if (!innermostSite)
+        {
+            ++innermostEntry.totalCount;
+        }
+        for (int i = 0; i < depth; ++i)
+        {
+            // A recursive scope is only counted once
+            if (std::find(sites.begin(), sites.begin() + i, sites[i]) == sites.begin() + i)
+            {
+                SampleEntry& entry = samples[sites[i]];
+                entry.site = sites[i];
+                ++entry.totalCount;
+            }
+        }
+    }
+}
+
+void GlobalProfiler::printSamples(Output& output, Output::Lock& lock) const
+{
+    std::unique_lock<std::mutex> samplerLock(samplerMutex);
+    if (sampleCount == 0)
+    {
+        return;
+    }
+    std::vector<SampleEntry> entries;
+    for (const auto& [site, entry] : samples)
+    {
+        entries.push_back(entry);
+    }
+    const uint64_t totalSamples = sampleCount;
+    const double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - samplerStartTime).count();
+    const double ticksPerSecond = elapsedSeconds > 0.0 ? double(readTimestampCounter() - samplerStartTicks) / elapsedSeconds : 0.0;
+    samplerLock.unlock();
+
+    std::sort(entries.begin(), entries.end(), [](const SampleEntry& first, const SampleEntry& second)
+        {
+            return first.selfCount > second.selfCount;
+        });
+    output.printLine(lock, totalSamples, " samples, every ", sampleInterval.count(), " ms");
+    for (const SampleEntry& entry : entries)
+    {
+        std::ostringstream oss;
+        const std::string scopeName = entry.site ? std::string(entry.site->unit.unitName) + ": " + entry.site->name : "(not in a sampled scope)";
+        const double selfTime = ticksPerSecond > 0.0 ? double(entry.selfTicks) / ticksPerSecond : 0.0;
+        oss << std::left << std::setw(60) << scopeName
+            << std::right << std::fixed << std::setprecision(2)
+            << std::setw(8) << double(entry.selfCount) * 100.0 / double(totalSamples) << "% self, "
+            << std::setw(8) << double(entry.totalCount) * 100.0 / double(totalSamples) << "% total, "
+            << std::setw(10) << std::setprecision(3) << selfTime << " s self";
+        output.printLine(lock, oss.str());
+    }
+}
 
 void GlobalProfiler::printEntries(Output& output) const
 {
     const std::chrono::nanoseconds totalTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start);
     Output::Lock lock(output);
-    for (const auto& profiler : profilers)
+    const std::vector<const CompilationUnitProfiler*>& unitProfilers = CompilationUnitProfiler::getUnits();
+    for (size_t unitIndex = 0; unitIndex < units.size(); ++unitIndex)
     {
-        if (profiler.second->entries.empty())
+        if (units[unitIndex].empty())
         {
             continue;
         }
-        std::vector<Entry> entries = profiler.second->entries;
+        std::vector<Entry> entries = units[unitIndex];
         for (Entry& entry : entries)
         {
             if (entry.count > 0)
@@ -27,7 +141,7 @@ void GlobalProfiler::printEntries(Output& output) const
             {
                 return first.count > second.count;
             });
-        output.printLine(lock, profiler.first);
+        output.printLine(lock, unitProfilers[unitIndex]->unitName);
         for (int i = 0; i < entries.size(); ++i)
         {
             const char* scopeName = entries[i].name;
@@ -44,4 +158,5 @@ void GlobalProfiler::printEntries(Output& output) const
             }
         }
     }
+    printSamples(output, lock);
 }
\ No newline at end of file
@@ -1,28 +1,114 @@
-#pragma once
+// The classes are defined once, the macros are defined again on every inclusion so that they
+// follow the PROFILING_ENABLED and PROFILING_SAMPLED of the including file even if the header
+// was included before
+//
+// There are two ways to profile the scopes of a file with PROFILING_ENABLED. By default every
+// scope is timed with the clock at both ends, which is exact but slows down small scopes a lot.
+// With PROFILING_SAMPLED as well, a scope only marks on entry and exit that its thread is in it,
+// and a sampler thread looks at where each thread is every millisecond. That shows where the
+// time goes with the emulator running at full speed.
+#ifndef COMMON_PROFILER_H
+#define COMMON_PROFILER_H
 
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
-#include "Output.h"
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define PROFILER_HAS_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILER_HAS_RDTSC 1
+#else
+#define PROFILER_HAS_RDTSC 0
+#endif
 
-struct CompilationUnitProfilerCount
-{
-    static inline int value = 0;
-};
+#include "Output.h"
 
 template<bool>
 class ScopeProfiler;
 class CompilationUnitProfiler;
 
+// A profiled scope in the source, for the sampler to tell where a thread is
+struct ProfileSite
+{
+    constexpr ProfileSite(const CompilationUnitProfiler& unit, const char* name)
+        : unit(unit)
+        , name(name)
+    {
+    }
+
+    const CompilationUnitProfiler& unit;
+    const char* name;
+};
+
+// The sampled scopes a thread is in, innermost last. Only the thread itself writes it. The
+// sampler may read it half-way through a change, which only misplaces that sample.
+struct SampleSlot
+{
+    static constexpr int maxDepth = 8;
+
+    std::array<std::atomic<const ProfileSite*>, maxDepth> sites = {};
+    std::atomic<int> depth = 0;
+    std::atomic<bool> bound = true;
+};
+
+// Collects the scope timings of all compilation units. There is one per emulator instance,
+// bound to the threads that run it, so several emulators can be profiled side by side.
+// Scopes run on a thread without a bound profiler are not recorded.
 class GlobalProfiler
 {
 public:
     struct Entry
     {
         const char* name = nullptr;
-        std::chrono::nanoseconds time;
+        std::chrono::nanoseconds time = std::chrono::nanoseconds(0);
         int count = 0;
-        std::chrono::nanoseconds averageTime;
+        std::chrono::nanoseconds averageTime = std::chrono::nanoseconds(0);
+    };
+
+    struct SampleEntry
+    {
+        const ProfileSite* site = nullptr;
+        // Samples with the site innermost, and with the site anywhere
+        uint64_t selfCount = 0;
+        uint64_t totalCount = 0;
+        // Timestamp counter ticks since the previous sample of the same thread, summed
+        uint64_t selfTicks = 0;
+    };
+
+    static constexpr std::chrono::milliseconds sampleInterval = std::chrono::milliseconds(1);
+
+    // Makes a profiler the one of the current thread for as long as it lives
+    class Binding
+    {
+    public:
+        Binding(GlobalProfiler& profiler);
+
+        ~Binding()
+        {
+            if (slot)
+            {
+                slot->bound = false;
+            }
+            current = previous;
+            currentSlot = previousSlot;
+        }
+
+        Binding(const Binding&) = delete;
+        Binding& operator=(const Binding&) = delete;
+
+    private:
+        GlobalProfiler* previous;
+        SampleSlot* previousSlot;
+        SampleSlot* slot;
     };
 
     GlobalProfiler()
@@ -30,66 +116,140 @@ public:
     {
     }
 
-    static GlobalProfiler& get()
+    ~GlobalProfiler();
+
+    GlobalProfiler(const GlobalProfiler&) = delete;
+    GlobalProfiler& operator=(const GlobalProfiler&) = delete;
+
+    static GlobalProfiler* getCurrent()
     {
-        if (!instance)
-        {
-            instance = new GlobalProfiler();
-        }
-        return *instance;
+        return current;
     }
 
-    void registerProfiler(const char* name, CompilationUnitProfiler* profiler)
+    static SampleSlot* getCurrentSlot()
     {
-        profilers.push_back({ name, profiler });
+        return currentSlot;
+    }
+
+    // Cheap enough to read at every sample. Not comparable between cores on every machine, so
+    // only differences taken on one thread mean anything.
+    static uint64_t readTimestampCounter()
+    {
+#if PROFILER_HAS_RDTSC
+        return __rdtsc();
+#else
+        return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    void profileScope(size_t unitIndex, int id, const char* name, const std::chrono::nanoseconds& time)
+    {
+        if (unitIndex >= units.size())
+        {
+            units.resize(unitIndex + 1);
+        }
+        std::vector<Entry>& entries = units[unitIndex];
+        if (size_t(id) >= entries.size())
+        {
+            entries.resize(size_t(id) + 1);
+        }
+        Entry& entry = entries[id];
+        entry.name = name;
+        entry.time += time;
+        ++entry.count;
     }
 
     void printEntries(Output& output) const;
 
 private:
-    static GlobalProfiler* instance;
-    std::vector<std::pair<const char*, CompilationUnitProfiler*>> profilers;
+    // Starts the sampler with the first sampled thread
+    SampleSlot* addSampledThread();
+    void runSampler();
+    void takeSample(uint64_t ticks);
+    void printSamples(Output& output, Output::Lock& lock) const;
+
+    static inline thread_local GlobalProfiler* current = nullptr;
+    static inline thread_local SampleSlot* currentSlot = nullptr;
+
+    // The entries of every compilation unit, by the index of its CompilationUnitProfiler
+    std::vector<std::vector<Entry>> units;
     std::chrono::high_resolution_clock::time_point start;
+
+    // Everything the sampler touches is guarded by the mutex
+    mutable std::mutex samplerMutex;
+    std::condition_variable samplerCondition;
+    std::thread sampler;
+    bool samplerStopping = false;
+    std::vector<std::unique_ptr<SampleSlot>> sampleSlots;
+    std::unordered_map<const ProfileSite*, SampleEntry> samples;
+    uint64_t sampleCount = 0;
+    uint64_t samplerStartTicks = 0;
+    std::chrono::steady_clock::time_point samplerStartTime;
 };
 
+// Names a compilation unit in the reports. These are created during static initialization
+// and never change afterwards, the timings themselves go to the bound GlobalProfiler.
 class CompilationUnitProfiler
 {
 public:
-    CompilationUnitProfiler(const char* name)
+    CompilationUnitProfiler(const char* name, bool sampled)
         : unitName(name)
+        , index(getUnits().size())
     {
-        GlobalProfiler::get().registerProfiler(unitName, this);
+        getUnits().push_back(this);
+        if (sampled)
+        {
+            getAnySampled() = true;
+        }
     }
 
-    void profileScope(int id, const char* name, const std::chrono::nanoseconds& time)
+    CompilationUnitProfiler(const CompilationUnitProfiler&) = delete;
+    CompilationUnitProfiler& operator=(const CompilationUnitProfiler&) = delete;
+
+    void profileScope(int id, const char* name, const std::chrono::nanoseconds& time) const
     {
-        if (entries.empty())
+        if (GlobalProfiler* profiler = GlobalProfiler::getCurrent())
         {
-            std::cout << unitName << " " << CompilationUnitProfilerCount::value << std::endl;
-            entries.resize(CompilationUnitProfilerCount::value);
+            profiler->profileScope(index, id, name, time);
         }
-        entries[id].name = name;
-        entries[id].time += time;
-        ++entries[id].count;
+    }
+
+    static std::vector<const CompilationUnitProfiler*>& getUnits()
+    {
+        static std::vector<const CompilationUnitProfiler*> units;
+        return units;
+    }
+
+    static bool isAnySampled()
+    {
+        return getAnySampled();
+    }
+
+private:
+    static bool& getAnySampled()
+    {
+        static bool anySampled = false;
+        return anySampled;
     }
 
 public:
-    std::vector<GlobalProfiler::Entry> entries;
-    const char* unitName;
+
+    const char* const unitName;
+    const size_t index;
 };
 
 template<bool Enabled>
 class ScopeProfiler
 {
 public:
-    ScopeProfiler(int, const char*, CompilationUnitProfiler&) {}
+    ScopeProfiler(int, const char*, const CompilationUnitProfiler&) {}
 };
 
 template<>
 class ScopeProfiler<true>
 {
 public:
-    ScopeProfiler(int id, const char* name, CompilationUnitProfiler& profiler)
+    ScopeProfiler(int id, const char* name, const CompilationUnitProfiler& profiler)
         : id(id)
         , name(name)
         , profiler(profiler)
@@ -106,22 +266,86 @@ public:
 private:
     const int id;
     const char* name;
-    CompilationUnitProfiler& profiler;
+    const CompilationUnitProfiler& profiler;
     std::chrono::high_resolution_clock::time_point start;
 };
 
-template<int N>
-struct ScopeIdTracker
+inline GlobalProfiler::Binding::Binding(GlobalProfiler& profiler)
+    : previous(current)
+    , previousSlot(currentSlot)
+    , slot(CompilationUnitProfiler::isAnySampled() ? profiler.addSampledThread() : nullptr)
+{
+    current = &profiler;
+    currentSlot = slot;
+}
+
+// Marks the scope in the sample slot of the thread, no clock involved
+template<bool Enabled>
+class SampledScope
 {
-    static constexpr int value = N;
-    static inline bool registered = (CompilationUnitProfilerCount::value = N + 1, true);
+public:
+    SampledScope(const ProfileSite&) {}
 };
 
-#define SCOPE_ID (ScopeIdTracker<__COUNTER__>::value)
+template<>
+class SampledScope<true>
+{
+public:
+    SampledScope(const ProfileSite& site)
+        : slot(GlobalProfiler::getCurrentSlot())
+    {
+        if (slot)
+        {
+            const int depth = slot->depth.load(std::memory_order_relaxed);
+            if (depth < SampleSlot::maxDepth)
+            {
+                slot->sites[depth].store(&site, std::memory_order_relaxed);
+            }
+            slot->depth.store(depth + 1, std::memory_order_release);
+        }
+    }
+
+    ~SampledScope()
+    {
+        if (slot)
+        {
+            slot->depth.store(slot->depth.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+        }
+    }
+
+    SampledScope(const SampledScope&) = delete;
+    SampledScope& operator=(const SampledScope&) = delete;
+
+private:
+    SampleSlot* const slot;
+};
+
+#endif
+
+#undef SCOPE_ID
+#undef CREATE_NAMED_PROFILER
+#undef CREATE_PROFILER
+#undef PROFILE_SCOPE_IMPL2
+#undef PROFILE_SCOPE_IMPL
+#undef PROFILE_IF
+#undef PROFILE_SCOPE
+
+// Unique within a compilation unit
+#define SCOPE_ID (__COUNTER__)
+
+#if PROFILING_ENABLED && PROFILING_SAMPLED
+
+#define CREATE_NAMED_PROFILER(name) namespace { static CompilationUnitProfiler compilationUnitProfiler(name, true); }
+#define CREATE_PROFILER() CREATE_NAMED_PROFILER(__FILE__)
+
+#define PROFILE_SCOPE_IMPL2(condition, line, id, name) static const ProfileSite profileSite##line(compilationUnitProfiler, name); SampledScope<condition> scopeProfiler##line(profileSite##line);
+#define PROFILE_SCOPE_IMPL(condition, line, id, name) PROFILE_SCOPE_IMPL2(condition, line, id, name)
+#define PROFILE_IF(condition, name) PROFILE_SCOPE_IMPL(condition, __LINE__, SCOPE_ID, name)
+#define PROFILE_SCOPE(name) PROFILE_IF(true, name)
 
-#if PROFILING_ENABLED
+#elif PROFILING_ENABLED
 
-#define CREATE_NAMED_PROFILER(name) namespace { static CompilationUnitProfiler compilationUnitProfiler(name); }
+#define CREATE_NAMED_PROFILER(name) namespace { static CompilationUnitProfiler compilationUnitProfiler(name, false); }
 #define CREATE_PROFILER() CREATE_NAMED_PROFILER(__FILE__)
 
 #define PROFILE_SCOPE_IMPL2(condition, line, id, name) ScopeProfiler<condition> scopeProfiler##line(id, name, compilationUnitProfiler);
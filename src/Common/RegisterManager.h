@@ -1,5 +1,8 @@
 #pragma once
 
+#include <deque>
+#include <string>
+
 #include "Types.h"
 #include "System.h"
 #include "Output.h"
@@ -20,7 +23,7 @@ public:
 
     virtual void printMemoryRegister(bool write, Byte value, AddressType address, const std::string& info)
     {
-        if (supressOutput)
+        if (supressOutput || !output.isEnabled(Log::Level::Debug))
         {
             return;
         }
@@ -29,11 +32,11 @@ public:
 
     void makeWriteRegister(AddressType address, const std::string& info, bool debug, std::function<void(Byte)> callback = nullptr, bool openBus = false)
     {
-        std::function<void(Byte, Byte)> onWrite = [this, address, callback, info, debug](Byte oldValue, Byte newValue)
+        std::function<void(Byte, Byte)> onWrite = [this, address, callback, debugInfo = keepDebugInfo(info, debug)](Byte oldValue, Byte newValue)
             {
-                if (debug && /*newValue && */oldValue != newValue)
+                if (debugInfo && /*newValue && */oldValue != newValue)
                 {
-                    printMemoryRegister(true, newValue, address, info);
+                    printMemoryRegister(true, newValue, address, *debugInfo);
                 }
 
                 if (callback)
@@ -86,7 +89,7 @@ public:
     void makeReadRegister(AddressType address, const std::string& info, bool debug, std::function<void(Byte&)> callback = nullptr, bool throwOnWrite = true)
     {
         memory.template createLocation<ReadRegister>(address,
-            [this, address, callback, info, debug](Byte& value)
+            [this, address, callback, debugInfo = keepDebugInfo(info, debug)](Byte& value)
             {
                 if (callback)
                 {
@@ -97,9 +100,9 @@ public:
                     //throw NotYetImplementedException("Register ", address, ": ", info);
                 }
 
-                if (debug && value)
+                if (debugInfo && value)
                 {
-                    printMemoryRegister(false, value, address, info);
+                    printMemoryRegister(false, value, address, *debugInfo);
                 }
             },
             throwOnWrite
@@ -136,23 +139,24 @@ public:
 
     void makeReadWriteRegister(AddressType address, const std::string& info, bool debug, std::function<void(Byte&)> readCallback, std::function<void(Byte)> writeCallback)
     {
+        const std::string* debugInfo = keepDebugInfo(info, debug);
         memory.template createLocation<ReadWriteRegister>(address,
-            [this, address, readCallback, info, debug](Byte& value)
+            [this, address, readCallback, debugInfo](Byte& value)
             {
                 if (readCallback)
                 {
                     readCallback(value);
                 }
-                if (debug/* && value*/)
+                if (debugInfo/* && value*/)
                 {
-                    printMemoryRegister(false, value, address, info);
+                    printMemoryRegister(false, value, address, *debugInfo);
                 }
             },
-            [this, address, writeCallback, info, debug](Byte oldValue, Byte newValue)
+            [this, address, writeCallback, debugInfo](Byte oldValue, Byte newValue)
             {
-                if (debug /*newValue && */ && oldValue != newValue)
+                if (debugInfo /*newValue && */ && oldValue != newValue)
                 {
-                    printMemoryRegister(true, newValue, address, info);
+                    printMemoryRegister(true, newValue, address, *debugInfo);
                 }
                 if (writeCallback)
                 {
@@ -216,7 +220,20 @@ public:
     bool supressOutput = false;
 
 private:
+    // The description of a register is only kept if it is logged, the register callbacks then
+    // point to it. Otherwise they get null and never log.
+    const std::string* keepDebugInfo(const std::string& info, bool debug)
+    {
+        if (!debug || !Log::isCompiledIn(Log::Level::Debug))
+        {
+            return nullptr;
+        }
+        return &debugInfos.emplace_back(info);
+    }
+
     Output output;
 
     Memory& memory;
+
+    std::deque<std::string> debugInfos;
 };
\ No newline at end of file
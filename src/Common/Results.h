@@ -0,0 +1,42 @@
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "Exception.h"
+#include "Output.h"
+
+// For the tools that report one tab-separated line per run, like the batch runner and the
+// benchmark suite
+namespace Results {
+
+// Keeps an error message on one line and in one field of the results
+inline std::string toField(std::string text)
+{
+    std::replace_if(text.begin(), text.end(), [](char c) { return c == '\t' || c == '\n' || c == '\r'; }, ' ');
+    return text;
+}
+
+// Calls write with the file at path, or with the standard output if the path is empty, after
+// the log lines still queued so that the two do not interleave
+template<typename Write>
+void write(Output& output, const std::filesystem::path& path, Write write)
+{
+    if (path.empty())
+    {
+        Output::Lock lock(output);
+        write(std::cout);
+        return;
+    }
+    std::ofstream file(path);
+    write(file);
+    if (!file)
+    {
+        throw RuntimeError("Failed to write results to ", path.string());
+    }
+}
+
+}
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Exception.h"
+#include "Types.h"
+
+// A save state is a header followed by a sequence of sections. Every section starts with a
+// four-character tag and the byte size of its payload, so a reader can tell exactly where a
+// subsystem's data starts and ends. All values are stored in host byte order.
+//
+// Subsystems describe their state once, in a member template that works in both directions:
+//
+//   template<typename Archive>
+//   void serialize(Archive& archive)
+//   {
+//       archive(counter);
+//       archive.bytes(ram.data(), ram.size());
+//   }
+//
+// Flat memory regions go through bytes() and are copied with a single memcpy.
+namespace SaveState {
+
+EXCEPTION(FormatError, ::RuntimeError)
+
+static constexpr uint32_t magic = 0x53534e53; // "SNSS"
+static constexpr uint32_t version = 2;
+
+constexpr uint32_t makeTag(const char(&name)[5])
+{
+    return uint32_t(uint8_t(name[0])) | uint32_t(uint8_t(name[1])) << 8 | uint32_t(uint8_t(name[2])) << 16 | uint32_t(uint8_t(name[3])) << 24;
+}
+
+// Values that can be copied as raw bytes. The register wrappers have user-provided copy
+// constructors, but hold nothing but their integer.
+template<typename T>
+constexpr bool isPlain = std::is_trivially_copyable_v<T> || std::is_same_v<T, Byte> || std::is_same_v<T, Word> || std::is_same_v<T, Long>;
+
+static_assert(sizeof(Byte) == 1 && sizeof(Word) == 2, "Byte arrays are copied as raw memory");
+
+class Writer
+{
+public:
+    static constexpr bool loading = false;
+
+    Writer(std::vector<uint8_t>& buffer)
+        : buffer(buffer)
+    {
+        buffer.clear();
+    }
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    template<typename T>
+    void operator()(const T& value)
+    {
+        if constexpr (requires(T& t, Writer& w) { t.serialize(w); })
+        {
+            const_cast<T&>(value).serialize(*this);
+        }
+        else
+        {
+            static_assert(isPlain<T>, "Type needs a serialize member");
+            bytes(&value, sizeof(T));
+        }
+    }
+
+    template<typename T, size_t N>
+    void operator()(const std::array<T, N>& values)
+    {
+        if constexpr (isPlain<T>)
+        {
+            bytes(values.data(), sizeof(T) * N);
+        }
+        else
+        {
+            for (const T& value : values)
+            {
+                (*this)(value);
+            }
+        }
+    }
+
+    // The size of a vector is fixed by its owner, it is stored only to be verified
+    template<typename T>
+    void operator()(const std::vector<T>& values)
+    {
+        (*this)(uint32_t(values.size()));
+        if constexpr (isPlain<T>)
+        {
+            bytes(values.data(), sizeof(T) * values.size());
+        }
+        else
+        {
+            for (const T& value : values)
+            {
+                (*this)(value);
+            }
+        }
+    }
+
+    void operator()(const std::string& value)
+    {
+        (*this)(uint32_t(value.size()));
+        bytes(value.data(), value.size());
+    }
+
+    void bytes(const void* data, size_t size)
+    {
+        const size_t offset = buffer.size();
+        buffer.resize(offset + size);
+        std::memcpy(buffer.data() + offset, data, size);
+    }
+
+    template<typename Function>
+    void section(uint32_t tag, Function function)
+    {
+        (*this)(tag);
+        const size_t sizeOffset = buffer.size();
+        (*this)(uint32_t(0));
+        function();
+        const uint32_t size = uint32_t(buffer.size() - sizeOffset - sizeof(uint32_t));
+        std::memcpy(buffer.data() + sizeOffset, &size, sizeof(size));
+    }
+
+private:
+    std::vector<uint8_t>& buffer;
+};
+
+class Reader
+{
+public:
+    static constexpr bool loading = true;
+
+    Reader(const std::vector<uint8_t>& buffer)
+        : data(buffer.data())
+        , end(buffer.data() + buffer.size())
+    {
+    }
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    template<typename T>
+    void operator()(T& value)
+    {
+        if constexpr (requires(T& t, Reader& r) { t.serialize(r); })
+        {
+            value.serialize(*this);
+        }
+        else
+        {
+            static_assert(isPlain<T>, "Type needs a serialize member");
+            bytes(&value, sizeof(T));
+        }
+    }
+
+    template<typename T, size_t N>
+    void operator()(std::array<T, N>& values)
+    {
+        if constexpr (isPlain<T>)
+        {
+            bytes(values.data(), sizeof(T) * N);
+        }
+        else
+        {
+            for (T& value : values)
+            {
+                (*this)(value);
+            }
+        }
+    }
+
+    template<typename T>
+    void operator()(std::vector<T>& values)
+    {
+        uint32_t size = 0;
+        (*this)(size);
+        if (size != values.size())
+        {
+            throw FormatError("Array of ", values.size(), " elements stored with ", size, " elements");
+        }
+        if constexpr (isPlain<T>)
+        {
+            bytes(values.data(), sizeof(T) * values.size());
+        }
+        else
+        {
+            for (T& value : values)
+            {
+                (*this)(value);
+            }
+        }
+    }
+
+    void operator()(std::string& value)
+    {
+        uint32_t size = 0;
+        (*this)(size);
+        require(size);
+        value.assign(reinterpret_cast<const char*>(data), size);
+        data += size;
+    }
+
+    void bytes(void* destination, size_t size)
+    {
+        require(size);
+        std::memcpy(destination, data, size);
+        data += size;
+    }
+
+    template<typename Function>
+    void section(uint32_t tag, Function function)
+    {
+        uint32_t storedTag = 0;
+        uint32_t size = 0;
+        (*this)(storedTag);
+        (*this)(size);
+        if (storedTag != tag)
+        {
+            throw FormatError("Expected section ", tagToString(tag), ", found ", tagToString(storedTag));
+        }
+        require(size);
+        const uint8_t* sectionEnd = data + size;
+        // Reads stop at the end of the section, so that a section that is read with more bytes
+        // than it was written with fails at the first read past it rather than in the next one
+        const uint8_t* outerEnd = end;
+        const uint32_t outerTag = sectionTag;
+        end = sectionEnd;
+        sectionTag = tag;
+        function();
+        end = outerEnd;
+        sectionTag = outerTag;
+        if (data != sectionEnd)
+        {
+            throw FormatError("Section ", tagToString(tag), " has ", size, " bytes, ", (sectionEnd - data), " of them were not read");
+        }
+    }
+
+    bool atEnd() const
+    {
+        return data == end;
+    }
+
+private:
+    void require(size_t size) const
+    {
+        if (size_t(end - data) < size)
+        {
+            if (sectionTag)
+            {
+                throw FormatError("Read of ", size, " bytes past the end of section ", tagToString(sectionTag));
+            }
+            throw FormatError("Unexpected end of data");
+        }
+    }
+
+    static std::string tagToString(uint32_t tag)
+    {
+        return std::string{ char(tag), char(tag >> 8), char(tag >> 16), char(tag >> 24) };
+    }
+
+    const uint8_t* data;
+    // The end of the innermost section being read, or of the buffer outside them
+    const uint8_t* end;
+    uint32_t sectionTag = 0;
+};
+
+}
@@ -1,6 +1,7 @@
 #include "System.h"
 
 #include <iostream>
+#include <mutex>
 
 #ifdef _WIN32
 #define NOMINMAX
@@ -15,6 +16,7 @@ namespace System {
 namespace {
 std::filesystem::path romLibraryPath;
 std::filesystem::path workingDirectory = ".";
+std::mutex romLibraryPathMutex;
 }
 
 void focusConsoleWindow()
@@ -28,6 +30,8 @@ void focusConsoleWindow()
 
 const std::filesystem::path& getRomLibraryPath()
 {
+    // Emulators on several threads may ask at once, the path is assigned at most once
+    std::scoped_lock<std::mutex> lock(romLibraryPathMutex);
     if (romLibraryPath.empty())
     {
         std::filesystem::path path = workingDirectory;
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+// Hands complete values from one producer thread to one consumer thread without either of them
+// waiting. There are three buffers: the producer writes one, the consumer reads another, and
+// the third holds the latest published value. Publishing and picking up swap a buffer with the
+// middle one in a single atomic exchange, so the consumer never sees a half-written value, and
+// the producer never writes to a buffer the consumer may be reading.
+//
+// A flag next to the index of the middle buffer tells whether it holds a value the consumer
+// has not picked up yet. If the producer publishes faster than the consumer picks up, the
+// values in between are dropped.
+template<typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer(const T& initialValue = T())
+        : buffers{ initialValue, initialValue, initialValue }
+    {
+    }
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Producer: the buffer to write the next value to. It holds whatever value it held last.
+    T& getWriteBuffer()
+    {
+        return buffers[writeIndex];
+    }
+
+    // Producer: makes the write buffer the latest value and takes over another buffer to write
+    void publish()
+    {
+        publishedIndex = writeIndex;
+        writeIndex = middle.exchange(writeIndex | freshFlag, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // Producer: the value published last. It stays untouched until the next publish, as the
+    // consumer only ever reads it.
+    const T& getPublished() const
+    {
+        return buffers[publishedIndex];
+    }
+
+    // Consumer: picks up the latest value if there is one it has not seen, returns true if so
+    bool update()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & freshFlag))
+        {
+            return false;
+        }
+        readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+
+    // Consumer: the value picked up by the last update
+    const T& getReadBuffer() const
+    {
+        return buffers[readIndex];
+    }
+
+private:
+    static constexpr int indexMask = 0x3;
+    static constexpr int freshFlag = 0x4;
+
+    std::array<T, 3> buffers;
+
+    // Only touched by the producer
+    int writeIndex = 0;
+    int publishedIndex = 0;
+
+    std::atomic<int> middle = 1;
+
+    // Only touched by the consumer
+    int readIndex = 2;
+};
@@ -0,0 +1,440 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#include "Exception.h"
+#include "Output.h"
+#include "Types.h"
+#include "Memory.h"
+#include "SaveState.h"
+
+namespace SPC {
+
+// The SPC700 address space: 64 KB of audio RAM in one flat array. Only the register page
+// at $F0-$FF and the IPL boot ROM at $FFC0-$FFFF are overlaid on top of it, everything else
+// is read and written with a plain index.
+class AudioRam
+{
+public:
+    using AddressType = Word;
+
+    enum class WrappingMask
+    {
+        Page = Byte::bitMask,
+        Bank = Word::bitMask,
+        Full = AddressType::bitMask
+    };
+
+    static constexpr uint32_t registerPageStart = 0xf0;
+    static constexpr uint32_t registerPageEnd = 0x100;
+    static constexpr uint32_t bootRomStart = 0xffc0;
+
+    // The register page reads made since the last clearRegisterReads, bit n of the mask is $F0+n
+    struct RegisterReads
+    {
+        uint16_t mask = 0;
+        std::array<Byte, registerPageEnd - registerPageStart> values;
+        bool consistent = true;
+    };
+
+    AudioRam(Output& output)
+        : ram(AddressType::spaceSize, Byte(0x55))
+        , applicationCounts(AddressType::spaceSize, 0)
+        , output(output, "memory")
+    {
+        for (uint32_t address = bootRomStart; address < AddressType::spaceSize; ++address)
+        {
+            ram[address] = 0xff;
+        }
+    }
+
+    AudioRam(const AudioRam&) = delete;
+    AudioRam& operator=(const AudioRam&) = delete;
+
+    uint32_t size() const
+    {
+        return AddressType::spaceSize;
+    }
+
+    template<typename LocationType, typename... Args>
+    void createLocation(AddressType address, Args&&... args)
+    {
+        if (getRegion(address) != Region::Registers)
+        {
+            std::ostringstream ss;
+            ss << __FUNCTION__ << ": memory @" << address << " is audio RAM, only the register page can hold locations";
+            throw AccessException(ss.str());
+        }
+        std::shared_ptr<Location>& location = registers[address - registerPageStart];
+        if (location)
+        {
+            std::ostringstream ss;
+            ss << __FUNCTION__ << ": memory @" << address << " is aready initialized";
+            throw AccessException(ss.str());
+        }
+        location = std::make_shared<LocationType>(std::forward<Args>(args)...);
+    }
+
+    void finalize()
+    {
+        for (std::shared_ptr<Location>& location : registers)
+        {
+            if (location.get() == nullptr)
+            {
+                location = std::make_shared<InvalidLocation>();
+            }
+        }
+    }
+
+    void setBootRomEnabled(bool enabled)
+    {
+        bootRomEnabled = enabled;
+    }
+
+    bool isBootRomEnabled() const
+    {
+        return bootRomEnabled;
+    }
+
+    Byte readByte(AddressType address)
+    {
+        Byte result;
+        switch (getRegion(address))
+        {
+        case Region::Ram:
+            result = ram[address];
+            bus = result;
+            break;
+        case Region::Registers:
+            try
+            {
+                result = getRegister(address).read(bus);
+            }
+            catch (const AccessException& e)
+            {
+                handleAccessException(e, address);
+            }
+            logRegisterRead(address, result);
+            break;
+        case Region::BootRom:
+            result = bootRomEnabled ? bootRom[address - bootRomStart] : ram[address];
+            bus = result;
+            break;
+        }
+        if (breakpointMask[address])
+        {
+            breakpoints[address](Location::Operation::Read, result, 0);
+        }
+        return result;
+    }
+
+    template<WrappingMask Wrapping = WrappingMask::Full>
+    Word readWord(AddressType address)
+    {
+        return readWord(address, uint32_t(Wrapping));
+    }
+
+    Word readWord(AddressType lowAddress, uint32_t wrappingMask)
+    {
+        Byte lowByte = readByte(lowAddress);
+        Byte highByte = readByte(getNextAddress(lowAddress, wrappingMask));
+        return Word(lowByte, highByte);
+    }
+
+    Long readLong(AddressType, uint32_t)
+    {
+        throw AccessException("Long read access is not supported by the SPC700");
+    }
+
+    void writeByte(Byte value, AddressType address)
+    {
+        ++writeCount;
+        if (getRegion(address) == Region::Registers)
+        {
+            try
+            {
+                getRegister(address).write(value);
+            }
+            catch (const AccessException& e)
+            {
+                handleAccessException(e, address);
+            }
+        }
+        else
+        {
+            // The IPL region is write-through: writes always land in the RAM underneath
+            ram[address] = value;
+        }
+        if (breakpointMask[address])
+        {
+            breakpoints[address](Location::Operation::Write, value, 0);
+        }
+    }
+
+    template<WrappingMask Wrapping = WrappingMask::Full>
+    void writeWord(Word value, AddressType address)
+    {
+        writeWord(value, address, uint32_t(Wrapping));
+    }
+
+    void writeWord(Word value, AddressType lowAddress, uint32_t wrappingMask)
+    {
+        writeByte(value.getLowByte(), lowAddress);
+        writeByte(value.getHighByte(), getNextAddress(lowAddress, wrappingMask));
+    }
+
+    Byte applyByte(AddressType address)
+    {
+        ++applicationCounts[address];
+        switch (getRegion(address))
+        {
+        case Region::Ram:
+            bus = ram[address];
+            return bus;
+        case Region::Registers:
+            try
+            {
+                return getRegister(address).apply(bus);
+            }
+            catch (const AccessException& e)
+            {
+                handleAccessException(e, address);
+            }
+            return Byte();
+        case Region::BootRom:
+        default:
+            bus = bootRomEnabled ? bootRom[address - bootRomStart] : ram[address];
+            return bus;
+        }
+    }
+
+    uint64_t getWriteCount() const
+    {
+        return writeCount;
+    }
+
+    // The value the last access left on the data bus
+    Byte getBus() const
+    {
+        return bus;
+    }
+
+    void setBus(Byte value)
+    {
+        bus = value;
+    }
+
+    const RegisterReads& getRegisterReads() const
+    {
+        return registerReads;
+    }
+
+    void clearRegisterReads()
+    {
+        registerReads.mask = 0;
+        registerReads.consistent = true;
+    }
+
+    // The register page is backed by the audio registers, which are saved with the DSP
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        archive.section(SaveState::makeTag("ARAM"), [&]()
+            {
+                archive.bytes(ram.data(), ram.size());
+            });
+        archive(bootRomEnabled);
+        archive(bus);
+    }
+
+    void reset(AddressType address)
+    {
+        applicationCounts[address] = 0;
+    }
+
+    void resetApplicationCounts()
+    {
+        std::fill(applicationCounts.begin(), applicationCounts.end(), 0);
+    }
+
+    uint64_t getApplicationCount(AddressType address) const
+    {
+        return applicationCounts[address];
+    }
+
+    bool hasBreakpoint(AddressType address) const
+    {
+        return breakpointMask[address];
+    }
+
+    void applyBreakpoint(AddressType address) const
+    {
+        if (breakpointMask[address])
+        {
+            breakpoints.at(address)(Location::Operation::Apply, 0, applicationCounts[address] + 1);
+        }
+    }
+
+    bool setBreakpoint(AddressType address, Location::BreakpointCallback callback)
+    {
+        if (callback)
+        {
+            breakpoints[address] = callback;
+            breakpointMask.set(address);
+        }
+        else
+        {
+            breakpoints.erase(address);
+            breakpointMask.reset(address);
+        }
+        return true;
+    }
+
+    Byte inspect(AddressType address) const
+    {
+        Byte result;
+        switch (getRegion(address))
+        {
+        case Region::Ram:
+            result = ram[address];
+            break;
+        case Region::Registers:
+            try
+            {
+                result = getRegister(address).inspect();
+            }
+            catch (const AccessException& e)
+            {
+                handleAccessException(e, address);
+            }
+            break;
+        case Region::BootRom:
+            result = bootRomEnabled ? bootRom[address - bootRomStart] : ram[address];
+            break;
+        }
+        return result;
+    }
+
+    void accept(AddressType address, LocationVisitor& visitor) const
+    {
+        const Region region = getRegion(address);
+        if (region == Region::Registers)
+        {
+            getRegister(address).accept(visitor);
+        }
+        else
+        {
+            visitor.visit(ArrayLocation(applicationCounts[address], region == Region::BootRom && bootRomEnabled));
+        }
+    }
+
+    void print(AddressType address, std::ostream& out) const
+    {
+        if (getRegion(address) == Region::Registers)
+        {
+            getRegister(address).print(out);
+        }
+        else
+        {
+            out << inspect(address);
+        }
+    }
+
+private:
+    enum class Region
+    {
+        Ram,
+        Registers,
+        BootRom
+    };
+
+    static Region getRegion(AddressType address)
+    {
+        if (address < registerPageStart)
+        {
+            return Region::Ram;
+        }
+        else if (address < registerPageEnd)
+        {
+            return Region::Registers;
+        }
+        else if (address < bootRomStart)
+        {
+            return Region::Ram;
+        }
+        return Region::BootRom;
+    }
+
+    static AddressType getNextAddress(AddressType address, uint32_t wrappingMask)
+    {
+        return (address & ~wrappingMask) + ((address + 1) & wrappingMask);
+    }
+
+    Location& getRegister(AddressType address) const
+    {
+        const std::shared_ptr<Location>& location = registers[address - registerPageStart];
+        if (!location)
+        {
+            std::ostringstream ss;
+            ss << "memory @" << address << " is not initialized";
+            throw AccessException(ss.str());
+        }
+        return *location;
+    }
+
+    void logRegisterRead(AddressType address, Byte value)
+    {
+        const uint32_t index = address - registerPageStart;
+        const uint16_t bit = uint16_t(1 << index);
+        if (registerReads.mask & bit && registerReads.values[index] != value)
+        {
+            registerReads.consistent = false;
+        }
+        registerReads.mask |= bit;
+        registerReads.values[index] = value;
+    }
+
+    void handleAccessException(const AccessException& e, AddressType address) const
+    {
+#if DEBUG_MEMORY
+        std::ostringstream ss;
+        ss << " @" << address;
+        throw AccessException(e.what() + ss.str());
+#else
+        LOG_ERROR(output, e.what(), " @", address);
+#endif
+    }
+
+public:
+    Byte bus;
+
+private:
+    std::vector<Byte> ram;
+    std::vector<uint64_t> applicationCounts;
+
+    std::array<std::shared_ptr<Location>, registerPageEnd - registerPageStart> registers;
+
+    std::bitset<AddressType::spaceSize> breakpointMask;
+    std::unordered_map<uint16_t, Location::BreakpointCallback> breakpoints;
+
+    uint64_t writeCount = 0;
+    RegisterReads registerReads;
+
+    bool bootRomEnabled = true;
+
+    std::array<Byte, 64> bootRom = {
+       0xcd, 0xef, 0xbd, 0xe8, 0x00, 0xc6, 0x1d, 0xd0, 0xfc, 0x8f, 0xaa, 0xf4, 0x8f, 0xbb, 0xf5, 0x78,
+       0xcc, 0xf4, 0xd0, 0xfb, 0x2f, 0x19, 0xeb, 0xf4, 0xd0, 0xfc, 0x7e, 0xf4, 0xd0, 0x0b, 0xe4, 0xf5,
+       0xcb, 0xf4, 0xd7, 0x00, 0xfc, 0xd0, 0xf3, 0xab, 0x01, 0x10, 0xef, 0x7e, 0xf4, 0x10, 0xeb, 0xba,
+       0xf6, 0xda, 0x00, 0xba, 0xf4, 0xc4, 0xf4, 0xdd, 0x5d, 0xd0, 0xdb, 0x1f, 0x00, 0x00, 0xc0, 0xff,
+    };
+
+    Output output;
+};
+
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <array>
+#include <functional>
+
+#include "Types.h"
+
+#include "SpcState.h"
+#include "SpcAudioRam.h"
+
+namespace SPC {
+
+// Recognises the polling loops sound drivers spend most of their time in, e.g.
+//
+//   loop: MOV A, $F4
+//         CMP A, $00
+//         BNE loop
+//
+// A loop is idle when one iteration returns to the exact register state it started from
+// without writing memory, and the only register page locations it read are pollable
+// inputs (CPU ports, timer outputs). Until one of those inputs changes, every further
+// iteration is identical, so its instructions can be skipped by cycle count alone. The
+// inputs are checked before each skipped instruction and the real state of that point
+// in the loop is restored as soon as one differs, down to the stored flags and the value left
+// on the data bus, so the result is the same as executing. A scheduler that knows when the inputs can next
+// change can pass over all the instructions up to then at once instead.
+class IdleLoopDetector
+{
+public:
+    // Reads the current value of a pollable register without side effects
+    typedef std::function<Byte(Word)> InputReader;
+
+    static constexpr int maxLoopLength = 8;
+
+    IdleLoopDetector(State& state, uint16_t pollableRegisters, InputReader readInput)
+        : state(state)
+        , memory(state.getMemory())
+        , pollableRegisters(pollableRegisters)
+        , readInput(readInput)
+    {
+        next = capture();
+    }
+
+    IdleLoopDetector(const IdleLoopDetector&) = delete;
+    IdleLoopDetector& operator=(const IdleLoopDetector&) = delete;
+
+    // Call after every instruction that was actually executed
+    void update(int cycles)
+    {
+        Step executed = next;
+        executed.cycles = cycles;
+        next = capture();
+
+        if (!recording)
+        {
+            if (cycles > 0 && next.programCounter <= executed.programCounter)
+            {
+                // Backward jump: the target is a candidate loop head
+                startRecording();
+            }
+            return;
+        }
+
+        if (cycles == 0 || stepCount == maxLoopLength)
+        {
+            recording = false;
+            return;
+        }
+
+        steps[stepCount++] = executed;
+
+        if (next.programCounter == steps[0].programCounter)
+        {
+            const AudioRam::RegisterReads& reads = memory.getRegisterReads();
+            if (next == steps[0] && memory.getWriteCount() == writeCount && reads.consistent && (reads.mask & ~pollableRegisters) == 0)
+            {
+                enterIdle(reads);
+            }
+            else
+            {
+                startRecording();
+            }
+        }
+    }
+
+    // While idle and undisturbed, passes over the next instruction of the loop and returns its
+    // cycle count. Otherwise wakes up and returns 0, and the instruction must be executed.
+    int skip()
+    {
+        if (!idle)
+        {
+            return 0;
+        }
+        if (state.getProgramCounter() != steps[0].programCounter)
+        {
+            // The state was changed from outside, e.g. reset by the debugger
+            idle = false;
+            wake();
+            return 0;
+        }
+        for (int i = 0; i < inputCount; ++i)
+        {
+            if (readInput(inputs[i].address) != inputs[i].value)
+            {
+                wake();
+                return 0;
+            }
+        }
+        const int cycles = steps[stepIndex].cycles;
+        stepIndex = (stepIndex + 1) % stepCount;
+        return cycles;
+    }
+
+    // While idle, passes over the instructions of the loop that start less than the given number
+    // of cycles from now without checking the inputs, for when the caller knows that they cannot
+    // change before then. Returns the cycles passed over, which end at the first instruction
+    // that starts at or after that point.
+    int skipWithin(int cycles)
+    {
+        if (!idle || cycles <= 0)
+        {
+            return 0;
+        }
+        int skipped = cycles / loopCycles * loopCycles;
+        while (skipped < cycles)
+        {
+            skipped += steps[stepIndex].cycles;
+            stepIndex = (stepIndex + 1) % stepCount;
+        }
+        return skipped;
+    }
+
+    // Whether the idle loop polls a register the predicate accepts
+    template<typename Predicate>
+    bool polls(Predicate predicate) const
+    {
+        for (int i = 0; i < inputCount; ++i)
+        {
+            if (predicate(inputs[i].address))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Leaves the idle loop, writing back the state of the instruction it was at. Must be called
+    // before anything else inspects or modifies the SPC state.
+    void wake()
+    {
+        if (idle)
+        {
+            restore(steps[stepIndex]);
+            idle = false;
+        }
+        recording = false;
+        next = capture();
+    }
+
+    bool isIdle() const
+    {
+        return idle;
+    }
+
+private:
+    struct Step
+    {
+        Word programCounter;
+        Byte a;
+        Byte x;
+        Byte y;
+        Byte stackPointer;
+        // As stored, so that a state is put back with the stale PSW bits and all
+        State::StoredFlags flags;
+        // Not part of the comparison, the loop reads the same while idle
+        Byte bus;
+        int cycles = 0;
+
+        bool operator==(const Step& other) const
+        {
+            return programCounter == other.programCounter
+                && a == other.a
+                && x == other.x
+                && y == other.y
+                && stackPointer == other.stackPointer
+                && flags == other.flags;
+        }
+    };
+
+    struct Input
+    {
+        Word address;
+        Byte value;
+    };
+
+    Step capture() const
+    {
+        Step step;
+        step.programCounter = state.getProgramCounter();
+        step.a = state.readRegister<State::Register::A>();
+        step.x = state.readRegister<State::Register::X>();
+        step.y = state.readRegister<State::Register::Y>();
+        step.stackPointer = state.readRegister<State::Register::SP>();
+        step.flags = state.getStoredFlags();
+        step.bus = memory.getBus();
+        return step;
+    }
+
+    void restore(const Step& step)
+    {
+        state.setProgramCounter(step.programCounter);
+        state.writeRegister<State::Register::A>(step.a);
+        state.writeRegister<State::Register::X>(step.x);
+        state.writeRegister<State::Register::Y>(step.y);
+        state.writeRegister<State::Register::SP>(step.stackPointer);
+        state.setStoredFlags(step.flags);
+        memory.setBus(step.bus);
+    }
+
+    void startRecording()
+    {
+        recording = true;
+        stepCount = 0;
+        writeCount = memory.getWriteCount();
+        memory.clearRegisterReads();
+    }
+
+    void enterIdle(const AudioRam::RegisterReads& reads)
+    {
+        inputCount = 0;
+        for (uint32_t i = 0; i < reads.values.size(); ++i)
+        {
+            if (reads.mask & 1 << i)
+            {
+                inputs[inputCount++] = { Word(AudioRam::registerPageStart + i), reads.values[i] };
+            }
+        }
+        recording = false;
+        idle = true;
+        // The loop was entered from elsewhere, the bus is the one its last instruction leaves
+        steps[0].bus = next.bus;
+        stepIndex = 0;
+        loopCycles = 0;
+        for (int i = 0; i < stepCount; ++i)
+        {
+            loopCycles += steps[i].cycles;
+        }
+    }
+
+    State& state;
+    AudioRam& memory;
+
+    const uint16_t pollableRegisters;
+    const InputReader readInput;
+
+    Step next;
+
+    bool recording = false;
+    bool idle = false;
+
+    std::array<Step, maxLoopLength> steps;
+    int stepCount = 0;
+    int stepIndex = 0;
+    int loopCycles = 0;
+    uint64_t writeCount = 0;
+
+    std::array<Input, AudioRam::registerPageEnd - AudioRam::registerPageStart> inputs;
+    int inputCount = 0;
+};
+
+}
@@ -12,7 +12,8 @@ namespace SPC {
 class InstructionDecoder
 {
 public:
-    SHARED InstructionDecoder() {}
+    // Creates instruction objects of its own, so that no two emulators share any
+    SHARED InstructionDecoder();
 
     InstructionDecoder(const InstructionDecoder&) = delete;
     InstructionDecoder& operator=(const InstructionDecoder&) = delete;
@@ -24,11 +25,22 @@ public:
 
     Instruction<State>* getInstruction(Byte opcode) const
     {
-        return instructions[opcode];
+        return instructions[opcode].get();
     }
 
+    // Fetches and executes the next instruction through a plain function table, without the
+    // virtual Instruction wrapper. Breakpoints are not applied, the debugger needs the wrapper.
+    int execute(State& state) const
+    {
+        return handlers[state.inspectProgramByte()](state);
+    }
+
+    typedef int (*Handler)(State&);
+
 private:
-    static std::array<Instruction<State>*, Byte::spaceSize> instructions;
+    std::array<std::unique_ptr<Instruction<State>>, Byte::spaceSize> instructions;
+    // Plain functions, the table never changes
+    static const std::array<Handler, Byte::spaceSize> handlers;
 };
 
 }
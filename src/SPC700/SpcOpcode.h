@@ -13,10 +13,11 @@ namespace SPC {
 
 EXCEPTION(NotYetImplementedException, ::NotYetImplementedException)
 
-CREATE_PROFILER();
-
 }
 
+// The opcodes are specializations outside of the namespace
+CREATE_PROFILER();
+
 // ADC (X), (Y)
 // (X) = (X)+(Y)+C    	[NV..H.ZC]
 // Indirect Indirect (1-Byte)
@@ -13,13 +13,15 @@
 #include "Memory.h"
 #include "Util.h"
 
+#include "SpcAudioRam.h"
+
 namespace SPC {
 
 class State
 {
 public:
     typedef Word AddressType;
-    typedef Memory<AddressType> MemoryType;
+    typedef AudioRam MemoryType;
     typedef MemoryAccess<MemoryType> MemoryAccessType;
     typedef ConstMemoryAccess<MemoryType> ConstMemoryAccessType;
 
@@ -74,6 +76,12 @@ private:
             registers[size_t(RegisterIndex) + 1] = value.getHighByte();
         }
 
+        template<typename Archive>
+        void serialize(Archive& archive)
+        {
+            archive(registers);
+        }
+
     private:
         std::array<Byte, size_t(Register::Count)> registers;
     };
@@ -83,47 +91,39 @@ public:
     class RegisterAccess : public Access
     {
     public:
-        RegisterAccess(Registers& registers)//, Register registerIndex)
-            : registers(registers)
-            //, registerIndex(registerIndex)
+        RegisterAccess(State& state)
+            : state(state)
         {
         }
 
         Byte readByte() override
         {
-            return registers.readByte<RegisterIndex>();
+            return state.readRegister<RegisterIndex>();
         }
 
         Word readWord() override
         {
-            return registers.readWord<RegisterIndex>();
+            return state.registers.readWord<RegisterIndex>();
         }
 
         void writeByte(Byte value) override
         {
-            registers.writeByte<RegisterIndex>(value);
+            state.writeRegister<RegisterIndex>(value);
         }
 
         void writeWord(Word value) override
         {
-            registers.writeWord<RegisterIndex>(value);
+            state.registers.writeWord<RegisterIndex>(value);
         }
 
     private:
-        Registers& registers;
-        //Register registerIndex;
+        State& state;
     };
 
     State(Output& output)
         : programCounter(0xffc0)
         , memory(output)
     {
-        for (Word address = 0; address < 0xf0; ++address) {
-            memory.createLocation<ReadWriteMemory>(address, Byte(0x55));
-        }
-        for (Word address = 0x100; address < 0xffc0; ++address) {
-            memory.createLocation<ReadWriteMemory>(address, Byte(0x55));
-        }
     }
 
     State(const State&) = delete;
@@ -132,9 +132,17 @@ public:
     void reset()
     {
         programCounter = 0xffc0;
-        for (uint32_t i = 0; i < memory.size(); ++i) {
-            memory.reset(Word(i));
-        }
+        memory.resetApplicationCounts();
+    }
+
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        archive(programCounter);
+        archive(registers);
+        archive(negativeResult);
+        archive(zeroResult);
+        archive(memory);
     }
 
     size_t getMemorySize() const
@@ -297,19 +305,29 @@ public:
     template<Register RegisterIndex>
     RegisterAccess<RegisterIndex> getRegisterAccess()
     {
-        return RegisterAccess<RegisterIndex>(registers);
+        return RegisterAccess<RegisterIndex>(*this);
     }
 
     template<Register RegisterIndex>
     Byte readRegister() const
     {
-        return registers.readByte<RegisterIndex>();
+        if constexpr (RegisterIndex == Register::PSW) {
+            return getFlags();
+        }
+        else {
+            return registers.readByte<RegisterIndex>();
+        }
     }
 
     template<Register RegisterIndex>
     void writeRegister(Byte value)
     {
-        registers.writeByte<RegisterIndex>(value);
+        if constexpr (RegisterIndex == Register::PSW) {
+            setFlags(value);
+        }
+        else {
+            registers.writeByte<RegisterIndex>(value);
+        }
     }
 
     template<Register RegisterIndex>
@@ -338,29 +356,88 @@ public:
 
     void setMultipleFlags(Byte flags, bool value)
     {
+        if (flags & uint8_t(Flag::n)) {
+            negativeResult = value ? 0x80 : 0x00;
+        }
+        if (flags & uint8_t(Flag::z)) {
+            zeroResult = value ? 0x00 : 0x01;
+        }
         if (value) {
-            writeRegister<Register::PSW>(readRegister<Register::PSW>() | flags);
+            registers.writeByte<Register::PSW>(registers.readByte<Register::PSW>() | flags);
         }
         else {
-            writeRegister<Register::PSW>(readRegister<Register::PSW>() & ~flags);
+            registers.writeByte<Register::PSW>(registers.readByte<Register::PSW>() & ~flags);
         }
     }
 
     bool getFlag(Flag flag) const
     {
-        return readRegister<Register::PSW>() & int(flag);
+        switch (flag) {
+        case Flag::n:
+            return negativeResult.isNegative();
+        case Flag::z:
+            return zeroResult == 0;
+        default:
+            return registers.readByte<Register::PSW>() & int(flag);
+        }
+    }
+
+    Byte getFlags() const
+    {
+        Byte flags = registers.readByte<Register::PSW>() & ~uint8_t(uint8_t(Flag::n) | uint8_t(Flag::z));
+        if (getFlag(Flag::n)) {
+            flags |= uint8_t(Flag::n);
+        }
+        if (getFlag(Flag::z)) {
+            flags |= uint8_t(Flag::z);
+        }
+        return flags;
     }
 
     void setFlags(Byte value)
     {
-        writeRegister<Register::PSW>(value);
+        registers.writeByte<Register::PSW>(value);
+        negativeResult = value & uint8_t(Flag::n);
+        zeroResult = value & uint8_t(Flag::z) ? 0x00 : 0x01;
+    }
+
+    // The flags the way they are stored, with N and Z still in the form getFlags derives them
+    // from, for putting a state back exactly as it was
+    struct StoredFlags
+    {
+        Byte psw;
+        Byte negativeResult;
+        Byte zeroResult;
+
+        bool operator==(const StoredFlags& other) const
+        {
+            return psw == other.psw && negativeResult == other.negativeResult && zeroResult == other.zeroResult;
+        }
+    };
+
+    StoredFlags getStoredFlags() const
+    {
+        return { registers.readByte<Register::PSW>(), negativeResult, zeroResult };
     }
 
-    template<typename T>
-    void updateSignFlags(T value)
+    void setStoredFlags(const StoredFlags& flags)
     {
-        setFlag(State::Flag::z, value == 0);
-        setFlag(State::Flag::n, value.isNegative());
+        registers.writeByte<Register::PSW>(flags.psw);
+        negativeResult = flags.negativeResult;
+        zeroResult = flags.zeroResult;
+    }
+
+    // N and Z are only recorded here, getFlag and getFlags derive them on demand
+    void updateSignFlags(Byte value)
+    {
+        negativeResult = value;
+        zeroResult = value;
+    }
+
+    void updateSignFlags(Word value)
+    {
+        negativeResult = value.getHighByte();
+        zeroResult = value.getHighByte() | value.getLowByte();
     }
 
     void pushToStack(Byte byte)
@@ -426,6 +503,11 @@ private:
 
     MemoryType memory;
     Registers registers;
+
+    // Last results that N and Z are lazily evaluated from: N is bit 7 of negativeResult,
+    // Z is set when zeroResult is zero. The N and Z bits of the PSW register itself are stale.
+    Byte negativeResult = 0x00;
+    Byte zeroResult = 0x01;
 };
 
 }
\ No newline at end of file
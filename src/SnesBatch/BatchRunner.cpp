@@ -0,0 +1,199 @@
+#include "BatchRunner.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+#include "Common/Exception.h"
+#include "Common/Results.h"
+#include "Common/System.h"
+
+#include "SnesEmulator/Emulator.h"
+#include "SnesEmulator/Rom.h"
+
+namespace {
+
+std::filesystem::path resolvePath(const std::filesystem::path& path)
+{
+    return path.is_relative() ? System::getRomLibraryPath() / path : path;
+}
+
+}
+
+BatchRunner::BatchRunner(Output& output, unsigned threadCount)
+    : output(output, "batch")
+    , threadCount(threadCount ? threadCount : std::max(std::thread::hardware_concurrency(), 1u))
+{
+}
+
+void BatchRunner::loadManifest(const std::filesystem::path& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        throw RuntimeError("Failed to open manifest ", path.string());
+    }
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); ++lineNumber)
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        const size_t separator = line.find('\t');
+        if (separator == std::string::npos)
+        {
+            throw RuntimeError(path.string(), ":", lineNumber, ": Expected <ROM image><tab><frame count>[<tab><input movie>]");
+        }
+        const size_t movieSeparator = line.find('\t', separator + 1);
+        Job job;
+        job.romPath = resolvePath(line.substr(0, separator));
+        if (movieSeparator != std::string::npos)
+        {
+            job.moviePath = resolvePath(line.substr(movieSeparator + 1));
+        }
+        try
+        {
+            job.frameCount = std::stoi(line.substr(separator + 1, movieSeparator - separator - 1));
+        }
+        catch (const std::exception&)
+        {
+            job.frameCount = 0;
+        }
+        if (job.frameCount <= 0)
+        {
+            throw RuntimeError(path.string(), ":", lineNumber, ": Bad frame count");
+        }
+        jobs.push_back(job);
+    }
+    output.info("Read ", jobs.size(), " jobs from ", path.string());
+}
+
+void BatchRunner::run()
+{
+    results.assign(jobs.size(), Result());
+    nextJob = 0;
+
+    const unsigned workerCount = unsigned(std::min<size_t>(threadCount, jobs.size()));
+    output.info("Running ", jobs.size(), " jobs on ", workerCount, " threads");
+
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < workerCount; ++i)
+    {
+        workers.emplace_back(&BatchRunner::runWorker, this);
+    }
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    const std::chrono::duration<double> elapsedTime = std::chrono::steady_clock::now() - startTime;
+
+    const size_t failures = std::count_if(results.begin(), results.end(), [](const Result& result) { return !result.succeeded; });
+    output.info("Ran ", jobs.size(), " jobs in ", elapsedTime.count(), " s, ", failures, " failed");
+}
+
+void BatchRunner::runWorker()
+{
+    // Every job is independent, the workers only share the index of the next one
+    for (size_t index = nextJob++; index < jobs.size(); index = nextJob++)
+    {
+        const Job& job = jobs[index];
+        Result& result = results[index];
+        runJob(index, result);
+        if (result.succeeded)
+        {
+            output.info(job.romPath.filename().string(), ": ", result.completedFrames, " frames in ", result.elapsedTime.count(), " s");
+        }
+        else
+        {
+            output.error(job.romPath.filename().string(), ": ", result.error);
+        }
+    }
+}
+
+void BatchRunner::runJob(size_t index, Result& result)
+{
+    const Job& job = jobs[index];
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    try
+    {
+        Rom rom(output);
+        rom.loadFromFile(job.romPath);
+
+        Emulator emulator(output, rom, true);
+        if (hashLogDirectory.empty())
+        {
+            emulator.enableOutputHashing();
+        }
+        else
+        {
+            emulator.enableOutputHashing(hashLogDirectory / (std::to_string(index) + "_" + job.romPath.stem().string() + ".hashes"));
+        }
+        emulator.setFrameListener([&result, &emulator](int, const std::vector<Video::Renderer::Pixel>&)
+            {
+                const Emulator::OutputHashes& hashes = emulator.getOutputHashes();
+                result.frameHash = hashes.video;
+                result.lastFrameHash = hashes.frame;
+                result.audioHash = hashes.audioStream;
+                ++result.completedFrames;
+            });
+        if (!job.moviePath.empty())
+        {
+            emulator.playMovie(job.moviePath);
+        }
+        if (!telemetryDirectory.empty())
+        {
+            emulator.setTelemetrySink(telemetryDirectory / (std::to_string(index) + "_" + job.romPath.stem().string() + ".telemetry.csv"));
+        }
+        emulator.initialize();
+        if (!guestProfileDirectory.empty())
+        {
+            emulator.startGuestProfiling();
+        }
+        emulator.runFrames(job.frameCount);
+        if (!guestProfileDirectory.empty())
+        {
+            emulator.writeGuestProfiles(guestProfileDirectory / (std::to_string(index) + "_" + job.romPath.stem().string()));
+        }
+        result.succeeded = true;
+    }
+    catch (const std::exception& e)
+    {
+        result.error = Results::toField(e.what());
+    }
+    result.elapsedTime = std::chrono::steady_clock::now() - startTime;
+}
+
+void BatchRunner::writeResults(std::ostream& stream) const
+{
+    stream << std::hex << std::setfill('0');
+    for (size_t i = 0; i < jobs.size(); ++i)
+    {
+        const Job& job = jobs[i];
+        const Result& result = results[i];
+        const double seconds = result.elapsedTime.count();
+        stream << job.romPath.string()
+            << '\t' << std::dec << job.frameCount
+            << '\t' << (result.succeeded ? "ok" : result.error)
+            << '\t' << result.completedFrames
+            << '\t' << std::hex << std::setw(16) << result.frameHash
+            << '\t' << std::setw(16) << result.lastFrameHash
+            << '\t' << std::setw(16) << result.audioHash
+            << '\t' << std::dec << std::setw(0) << uint64_t(seconds * 1000.0)
+            << '\t' << (seconds > 0.0 ? result.completedFrames / seconds : 0.0)
+            << '\n';
+    }
+    stream << std::setfill(' ');
+}
+
+bool BatchRunner::allSucceeded() const
+{
+    return std::all_of(results.begin(), results.end(), [](const Result& result) { return result.succeeded; });
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "Common/Output.h"
+
+// Runs the jobs of a manifest on a pool of threads, every job in a headless emulator of its
+// own, for regression and soak testing over a whole ROM library.
+//
+// The manifest has one job per line, the fields separated by tabs:
+//
+//     <ROM image>  <frame count>  [<input movie>]
+//
+// The frame count has to be positive. ROM and movie paths are relative to the ROM library
+// unless absolute. Without a movie no buttons are pressed. Empty lines and lines starting with #
+// are skipped. The results are written in manifest order, one tab-separated line per job:
+//
+//     <ROM image>  <frame count>  <status>  <frames run>  <frame hash>  <last frame hash>  <audio hash>  <ms>  <FPS>
+//
+// The frame and audio hashes cover the whole run, so two runs with equal hashes drew the same
+// pictures and played the same sound. The status is "ok", or the error that ended the run
+// early. For finding the frame where two runs part, every job can also write a log with the
+// hashes of each frame, see Emulator::enableOutputHashing.
+class BatchRunner
+{
+public:
+    struct Job
+    {
+        std::filesystem::path romPath;
+        int frameCount = 0;
+        std::filesystem::path moviePath;
+    };
+
+    struct Result
+    {
+        bool succeeded = false;
+        std::string error;
+        int completedFrames = 0;
+        uint64_t frameHash = 0;
+        uint64_t lastFrameHash = 0;
+        uint64_t audioHash = 0;
+        std::chrono::duration<double> elapsedTime = std::chrono::duration<double>(0);
+    };
+
+    // Zero threads means one per hardware thread
+    BatchRunner(Output& output, unsigned threadCount);
+
+    BatchRunner(const BatchRunner&) = delete;
+    BatchRunner& operator=(const BatchRunner&) = delete;
+
+    void loadManifest(const std::filesystem::path& path);
+
+    // Per-frame hash logs are written to <directory>/<job index>_<ROM name>.hashes
+    void setHashLogDirectory(const std::filesystem::path& directory)
+    {
+        hashLogDirectory = directory;
+    }
+
+    // Frame records are written to <directory>/<job index>_<ROM name>.telemetry.csv
+    void setTelemetryDirectory(const std::filesystem::path& directory)
+    {
+        telemetryDirectory = directory;
+    }
+
+    // Guest profiles are written to <directory>/<job index>_<ROM name>.*, see
+    // Emulator::writeGuestProfiles
+    void setGuestProfileDirectory(const std::filesystem::path& directory)
+    {
+        guestProfileDirectory = directory;
+    }
+
+    void run();
+
+    void writeResults(std::ostream& stream) const;
+
+    bool allSucceeded() const;
+
+private:
+    void runWorker();
+    void runJob(size_t index, Result& result);
+
+    Output output;
+
+    const unsigned threadCount;
+    std::filesystem::path hashLogDirectory;
+    std::filesystem::path guestProfileDirectory;
+    std::filesystem::path telemetryDirectory;
+
+    std::vector<Job> jobs;
+    std::vector<Result> results;
+    std::atomic<size_t> nextJob = 0;
+};
@@ -0,0 +1,69 @@
+#include <filesystem>
+
+#include "Output.h"
+#include "Results.h"
+
+#include "BatchRunner.h"
+
+// SnesBatch <manifest> [<results file>] [--threads <count>] [--hash-logs <directory>] [--guest-profiles <directory>] [--telemetry <directory>] [--log-file <file>]
+int main(int argc, char** argv)
+{
+    Output::System outputSystem("logconfig.txt");
+    Output output(outputSystem, "main");
+
+    if (argc < 2)
+    {
+        output.error("Usage: SnesBatch <manifest> [<results file>] [--threads <count>] [--hash-logs <directory>] [--guest-profiles <directory>] [--telemetry <directory>] [--log-file <file>]");
+        return 2;
+    }
+    try
+    {
+        std::filesystem::path resultsPath;
+        unsigned threadCount = 0;
+        std::filesystem::path hashLogDirectory;
+        std::filesystem::path guestProfileDirectory;
+        std::filesystem::path telemetryDirectory;
+        for (int i = 2; i < argc; ++i)
+        {
+            const std::string argument = argv[i];
+            if (argument == "--threads" && i + 1 < argc)
+            {
+                threadCount = unsigned(std::stoul(argv[++i]));
+            }
+            else if (argument == "--hash-logs" && i + 1 < argc)
+            {
+                hashLogDirectory = argv[++i];
+            }
+            else if (argument == "--guest-profiles" && i + 1 < argc)
+            {
+                guestProfileDirectory = argv[++i];
+            }
+            else if (argument == "--telemetry" && i + 1 < argc)
+            {
+                telemetryDirectory = argv[++i];
+            }
+            else if (argument == "--log-file" && i + 1 < argc)
+            {
+                outputSystem.setLogFile(argv[++i]);
+            }
+            else
+            {
+                resultsPath = argument;
+            }
+        }
+
+        BatchRunner runner(output, threadCount);
+        runner.setHashLogDirectory(hashLogDirectory);
+        runner.setGuestProfileDirectory(guestProfileDirectory);
+        runner.setTelemetryDirectory(telemetryDirectory);
+        runner.loadManifest(argv[1]);
+        runner.run();
+        Results::write(output, resultsPath, [&runner](std::ostream& stream) { runner.writeResults(stream); });
+        return runner.allSucceeded() ? 0 : 1;
+    }
+    catch (const std::exception& e)
+    {
+        output.error("Batch failure: ", e.what());
+        return 2;
+    }
+}
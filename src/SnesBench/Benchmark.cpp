@@ -0,0 +1,132 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+#include "Common/Results.h"
+
+namespace {
+
+volatile uint64_t keptResult = 0;
+
+double getMedian(std::vector<double> values)
+{
+    const size_t middle = values.size() / 2;
+    std::nth_element(values.begin(), values.begin() + middle, values.end());
+    if (values.size() % 2)
+    {
+        return values[middle];
+    }
+    const double upper = values[middle];
+    return (*std::max_element(values.begin(), values.begin() + middle) + upper) / 2.0;
+}
+
+}
+
+void keepResult(uint64_t value)
+{
+    keptResult = keptResult + value;
+}
+
+BenchmarkRunner::BenchmarkRunner(Output& output, int warmUpIterations, int iterations)
+    : output(output, "bench")
+    , warmUpIterations(warmUpIterations)
+    , iterations(std::max(iterations, 1))
+{
+}
+
+void BenchmarkRunner::add(const std::string& name, uint64_t operations, Function function)
+{
+    benchmarks.push_back({ name, operations, std::move(function) });
+}
+
+void BenchmarkRunner::run(const std::string& filter)
+{
+    results.clear();
+    for (size_t i = 0; i < benchmarks.size(); ++i)
+    {
+        const Benchmark& benchmark = benchmarks[i];
+        if (benchmark.name.find(filter) == std::string::npos)
+        {
+            continue;
+        }
+        const Result result = measure(benchmark);
+        if (result.succeeded)
+        {
+            output.info(benchmark.name, ": ", std::fixed, std::setprecision(2), result.medianNanoseconds, " ns per operation, +/- ", result.deviationNanoseconds);
+        }
+        else
+        {
+            output.error(benchmark.name, ": ", result.error);
+        }
+        results.emplace_back(i, result);
+    }
+    output.info("Ran ", results.size(), " of ", benchmarks.size(), " benchmarks");
+}
+
+BenchmarkRunner::Result BenchmarkRunner::measure(const Benchmark& benchmark) const
+{
+    Result result;
+    try
+    {
+        for (int i = 0; i < warmUpIterations; ++i)
+        {
+            benchmark.function();
+        }
+
+        std::vector<double> times;
+        times.reserve(iterations);
+        for (int i = 0; i < iterations; ++i)
+        {
+            const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+            benchmark.function();
+            const std::chrono::duration<double, std::nano> elapsedTime = std::chrono::steady_clock::now() - startTime;
+            times.push_back(elapsedTime.count() / double(benchmark.operations));
+        }
+
+        result.medianNanoseconds = getMedian(times);
+        for (double& time : times)
+        {
+            time = std::abs(time - result.medianNanoseconds);
+        }
+        result.deviationNanoseconds = getMedian(times);
+        result.iterations = iterations;
+        result.succeeded = true;
+    }
+    catch (const std::exception& e)
+    {
+        result.error = Results::toField(e.what());
+    }
+    return result;
+}
+
+void BenchmarkRunner::writeResults(std::ostream& stream) const
+{
+    stream << std::fixed << std::setprecision(3);
+    for (const auto& [index, result] : results)
+    {
+        const Benchmark& benchmark = benchmarks[index];
+        stream << benchmark.name
+            << '\t' << benchmark.operations
+            << '\t' << result.iterations;
+        if (result.succeeded)
+        {
+            stream << '\t' << result.medianNanoseconds
+                << '\t' << result.deviationNanoseconds
+                << '\t' << (result.medianNanoseconds > 0.0 ? 100.0 * result.deviationNanoseconds / result.medianNanoseconds : 0.0)
+                << '\t' << (result.medianNanoseconds > 0.0 ? 1e9 / result.medianNanoseconds : 0.0);
+        }
+        else
+        {
+            stream << '\t' << result.error;
+        }
+        stream << '\n';
+    }
+    stream << std::defaultfloat;
+}
+
+bool BenchmarkRunner::allSucceeded() const
+{
+    return std::all_of(results.begin(), results.end(), [](const auto& result) { return result.second.succeeded; });
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Common/Output.h"
+
+// Runs microbenchmarks of the emulator subsystems, each on a synthetic machine state of its
+// own, to prove optimizations and guard against regressions.
+//
+// A benchmark is a function that does a fixed number of operations, like reading a byte or
+// drawing a scanline. It is run a few times to warm up caches and branch predictors, and then
+// measured a number of times. The result is the median time per operation, and the median
+// absolute deviation from it as a measure of the noise, which, unlike the mean and standard
+// deviation, the odd preempted run does not throw off.
+//
+// The results are written one tab-separated line per benchmark:
+//
+//     <name>  <operations>  <iterations>  <median ns/operation>  <MAD ns/operation>  <MAD %>  <operations/s>
+//
+// A benchmark that throws is reported as failed, with zero iterations and the error message
+// in place of the measurements.
+class BenchmarkRunner
+{
+public:
+    typedef std::function<void()> Function;
+
+    struct Benchmark
+    {
+        std::string name;
+        uint64_t operations = 0;
+        Function function;
+    };
+
+    struct Result
+    {
+        bool succeeded = false;
+        std::string error;
+        int iterations = 0;
+        double medianNanoseconds = 0.0;
+        double deviationNanoseconds = 0.0;
+    };
+
+    BenchmarkRunner(Output& output, int warmUpIterations, int iterations);
+
+    BenchmarkRunner(const BenchmarkRunner&) = delete;
+    BenchmarkRunner& operator=(const BenchmarkRunner&) = delete;
+
+    // Names are grouped by subsystem, like "ppu/mode1"
+    void add(const std::string& name, uint64_t operations, Function function);
+
+    // Runs the benchmarks whose names contain the filter, all of them if it is empty
+    void run(const std::string& filter);
+
+    void writeResults(std::ostream& stream) const;
+
+    bool allSucceeded() const;
+
+private:
+    Result measure(const Benchmark& benchmark) const;
+
+    Output output;
+
+    const int warmUpIterations;
+    const int iterations;
+
+    std::vector<Benchmark> benchmarks;
+
+    // In the order run, with the index of their benchmark
+    std::vector<std::pair<size_t, Result>> results;
+};
+
+// Keeps the compiler from dropping computations whose results are otherwise unused
+void keepResult(uint64_t value);
@@ -0,0 +1,440 @@
+#include "Benchmarks.h"
+
+#include <array>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "WDC65816/CpuState.h"
+#include "WDC65816/CpuInstructionDecoder.h"
+#include "SPC700/SpcState.h"
+
+#include "SnesEmulator/VideoRegisters.h"
+#include "SnesEmulator/AudioRegisters.h"
+#include "SnesEmulator/DmaInstruction.h"
+
+namespace {
+
+// The CPU side of a console without a cartridge: random bytes as ROM in the LoROM banks, the
+// work RAM with its mirror in bank $00, the PPU and DMA registers and the APU ports
+class CpuMachine
+{
+public:
+    static constexpr uint32_t romBankCount = 0x20;
+    static constexpr uint32_t romBankSize = 0x8000;
+
+    CpuMachine(Output& output)
+        : state(output)
+        , videoRegisters(output, state, "SnesBench", true)
+        , dmaInstruction(output, state, videoRegisters)
+        , rom(romBankCount * romBankSize)
+        , wram(0x20000, Byte(0x55))
+    {
+        std::mt19937 random(1);
+        for (Byte& byte : rom)
+        {
+            byte = Byte(uint8_t(random()));
+        }
+
+        CPU::State::MemoryType& memory = state.getMemory();
+
+        videoRegisters.initialize();
+
+        std::shared_ptr<MemoryRegion> region = std::make_shared<MemoryRegion>(rom.data(), uint32_t(rom.size()));
+        for (uint32_t bank = 0; bank < romBankCount; ++bank)
+        {
+            memory.mapRegion(Long(Word(0x8000), Byte(bank)), region, bank * romBankSize, romBankSize);
+        }
+
+        memory.mapRegion(Long(0x7e0000), std::make_shared<MemoryRegion>(wram), 0, uint32_t(wram.size()));
+        memory.createMirrors(Long(0x000000), Long(0x7e0000), 0x2000);
+
+        for (Word i = 0; i < 4; ++i)
+        {
+            memory.createLocation<ReadWriteRegister>(Long(0x2140 + i),
+                [this, i](Byte& value)
+                {
+                    value = ports[i];
+                },
+                [this, i](Byte, Byte newValue)
+                {
+                    ports[i] = newValue;
+                }
+            );
+        }
+
+        memory.finalize();
+        state.reset();
+    }
+
+    CpuMachine(const CpuMachine&) = delete;
+    CpuMachine& operator=(const CpuMachine&) = delete;
+
+    void write(uint32_t address, Byte value)
+    {
+        state.getMemory().writeByte(value, Long(address));
+    }
+
+    void writeWord(uint32_t address, Word value)
+    {
+        write(address, value.getLowByte());
+        write(address + 1, value.getHighByte());
+    }
+
+    CPU::State state;
+    Video::Registers videoRegisters;
+    DmaInstruction dmaInstruction;
+
+    std::vector<Byte> rom;
+    std::vector<Byte> wram;
+    std::array<Byte, 4> ports;
+};
+
+// From first up to last, with the given bits set in every address
+struct AddressRange
+{
+    uint32_t first;
+    uint32_t last;
+    uint32_t setBits;
+};
+
+// Random addresses of the given kinds, read over and over
+std::vector<Long> makeAddresses(const std::vector<AddressRange>& ranges, size_t count)
+{
+    std::mt19937 random(2);
+    std::vector<Long> addresses(count);
+    for (Long& address : addresses)
+    {
+        const AddressRange& range = ranges[random() % ranges.size()];
+        address = (range.first + random() % (range.last - range.first)) | range.setBits;
+    }
+    return addresses;
+}
+
+void addReadBenchmark(BenchmarkRunner& runner, const std::string& name, const std::shared_ptr<CpuMachine>& machine, std::vector<Long> addresses)
+{
+    runner.add(name, addresses.size(),
+        [machine, addresses]()
+        {
+            CPU::State::MemoryType& memory = machine->state.getMemory();
+            uint64_t sum = 0;
+            for (Long address : addresses)
+            {
+                sum += memory.readByte(address);
+            }
+            keepResult(sum);
+        });
+}
+
+}
+
+void addMemoryBenchmarks(BenchmarkRunner& runner, Output& output)
+{
+    std::shared_ptr<CpuMachine> machine = std::make_shared<CpuMachine>(output);
+
+    constexpr size_t readCount = 1 << 16;
+    const AddressRange rom = { 0x000000, 0x200000, 0x8000 };
+    const AddressRange wram = { 0x7e0000, 0x800000, 0 };
+    const AddressRange wramMirror = { 0x000000, 0x002000, 0 };
+    const AddressRange ports = { 0x002140, 0x002144, 0 };
+
+    // Mapped regions, and those mixed with mirrors and register locations as a program would
+    addReadBenchmark(runner, "memory/read rom", machine, makeAddresses({ rom }, readCount));
+    addReadBenchmark(runner, "memory/read wram", machine, makeAddresses({ wram }, readCount));
+    addReadBenchmark(runner, "memory/read mixed", machine, makeAddresses({ rom, wram, wramMirror, ports }, readCount));
+}
+
+void addCpuBenchmarks(BenchmarkRunner& runner, Output& output)
+{
+    struct Machine
+    {
+        Machine(Output& output)
+            : cpu(output)
+        {
+        }
+
+        CpuMachine cpu;
+        CPU::InstructionDecoder decoder;
+    };
+    std::shared_ptr<Machine> machine = std::make_shared<Machine>(output);
+
+    // A generated program of common instructions in the work RAM, in emulation mode with 8-bit
+    // registers. Direct page and absolute operands stay in the first 4 KiB of the work RAM,
+    // branches have zero offsets so that the program runs straight through either way, and the
+    // last instruction jumps back to the start.
+    enum class Operand { None, Immediate, Direct, Absolute, Branch };
+    const std::vector<std::pair<Byte, Operand>> mix = {
+        { 0xea, Operand::None }, { 0x18, Operand::None }, { 0x38, Operand::None }, { 0xe8, Operand::None },
+        { 0xc8, Operand::None }, { 0xca, Operand::None }, { 0x88, Operand::None }, { 0x1a, Operand::None },
+        { 0x3a, Operand::None }, { 0xaa, Operand::None }, { 0xa8, Operand::None }, { 0x8a, Operand::None },
+        { 0x98, Operand::None }, { 0x0a, Operand::None }, { 0x4a, Operand::None },
+        { 0xa9, Operand::Immediate }, { 0x69, Operand::Immediate }, { 0x29, Operand::Immediate }, { 0x09, Operand::Immediate },
+        { 0x49, Operand::Immediate }, { 0xc9, Operand::Immediate }, { 0xa2, Operand::Immediate }, { 0xa0, Operand::Immediate },
+        { 0xa5, Operand::Direct }, { 0x85, Operand::Direct }, { 0x65, Operand::Direct }, { 0xe6, Operand::Direct },
+        { 0xc6, Operand::Direct }, { 0x05, Operand::Direct }, { 0xa6, Operand::Direct }, { 0x86, Operand::Direct },
+        { 0xad, Operand::Absolute }, { 0x8d, Operand::Absolute }, { 0x6d, Operand::Absolute }, { 0xee, Operand::Absolute },
+        { 0x9c, Operand::Absolute }, { 0xae, Operand::Absolute },
+        { 0xd0, Operand::Branch }, { 0xf0, Operand::Branch }, { 0x90, Operand::Branch },
+    };
+    constexpr uint32_t programStart = 0x7e1000;
+    constexpr int programLength = 4096;
+
+    std::mt19937 random(3);
+    uint32_t address = programStart;
+    for (int i = 0; i < programLength; ++i)
+    {
+        const auto& [opcode, operand] = mix[random() % mix.size()];
+        machine->cpu.write(address++, opcode);
+        switch (operand)
+        {
+        case Operand::Immediate:
+        case Operand::Direct:
+            machine->cpu.write(address++, Byte(uint8_t(random())));
+            break;
+        case Operand::Absolute:
+            machine->cpu.writeWord(address, Word(uint16_t(0x0200 + random() % 0x0e00)));
+            address += 2;
+            break;
+        case Operand::Branch:
+            machine->cpu.write(address++, Byte(0));
+            break;
+        default:
+            break;
+        }
+    }
+    machine->cpu.write(address++, Byte(0x4c));
+    machine->cpu.writeWord(address, Word(programStart & 0xffff));
+    machine->cpu.state.setProgramAddress(Long(programStart));
+
+    constexpr int instructionCount = 100000;
+    runner.add("cpu/dispatch", instructionCount,
+        [machine]()
+        {
+            CPU::State& state = machine->cpu.state;
+            uint64_t cycles = 0;
+            for (int i = 0; i < instructionCount; ++i)
+            {
+                cycles += machine->decoder.getNextInstruction(state)->execute(state);
+            }
+            keepResult(cycles);
+        });
+}
+
+void addVideoBenchmarks(BenchmarkRunner& runner, Output& output)
+{
+    struct Configuration
+    {
+        std::string name;
+        Byte backgroundMode;
+        bool objects;
+    };
+
+    // The modes the processor draws; the others only report that they are not implemented
+    const std::vector<Configuration> configurations = {
+        { "ppu/mode1", Byte(0x01), false },
+        { "ppu/mode1 bg3 priority", Byte(0x09), false },
+        { "ppu/mode1 objects", Byte(0x01), true },
+        { "ppu/mode7", Byte(0x07), false },
+    };
+
+    for (const Configuration& configuration : configurations)
+    {
+        const bool objects = configuration.objects;
+
+        std::shared_ptr<CpuMachine> machine = std::make_shared<CpuMachine>(output);
+        CpuMachine& cpu = *machine;
+        std::mt19937 random(4);
+
+        // Random tiles and tilemaps everywhere, and random colors
+        cpu.write(0x2115, Byte(0x80));
+        cpu.writeWord(0x2116, Word(0));
+        for (int i = 0; i < 0x8000; ++i)
+        {
+            cpu.writeWord(0x2118, Word(uint16_t(random())));
+        }
+        cpu.write(0x2121, Byte(0));
+        for (int i = 0; i < 0x200; ++i)
+        {
+            cpu.write(0x2122, Byte(uint8_t(random())));
+        }
+
+        // The objects off screen, or randomly placed 8x8 and 16x16 ones
+        cpu.write(0x2101, Byte(0));
+        cpu.writeWord(0x2102, Word(0));
+        for (int i = 0; i < 128; ++i)
+        {
+            cpu.write(0x2104, Byte(uint8_t(random())));
+            cpu.write(0x2104, Byte(uint8_t(objects ? random() % 224 : 240)));
+            cpu.write(0x2104, Byte(uint8_t(random())));
+            cpu.write(0x2104, Byte(uint8_t(random())));
+        }
+        for (int i = 0; i < 32; ++i)
+        {
+            cpu.write(0x2104, Byte(uint8_t(objects ? random() : 0)));
+        }
+
+        // Tilemaps at $7000-$7FFF, characters below
+        cpu.write(0x2105, configuration.backgroundMode);
+        cpu.write(0x2107, Byte(0x70));
+        cpu.write(0x2108, Byte(0x74));
+        cpu.write(0x2109, Byte(0x78));
+        cpu.write(0x210a, Byte(0x7c));
+        cpu.write(0x210b, Byte(0x20));
+        cpu.write(0x210c, Byte(0x54));
+        for (uint32_t scroll = 0x210d; scroll < 0x2115; ++scroll)
+        {
+            cpu.write(scroll, Byte(uint8_t(random())));
+            cpu.write(scroll, Byte(uint8_t(random() & 0x03)));
+        }
+
+        // A slight rotation and the center in the middle of the screen
+        const std::array<int, 4> matrix = { 0x0100, 0x0020, -0x0020, 0x0100 };
+        cpu.write(0x211a, Byte(0));
+        for (int i = 0; i < 4; ++i)
+        {
+            cpu.write(0x211b + i, Byte(matrix[i] & 0xff));
+            cpu.write(0x211b + i, Byte((matrix[i] >> 8) & 0xff));
+        }
+        for (uint32_t center = 0x211f; center < 0x2121; ++center)
+        {
+            cpu.write(center, Byte(0x80));
+            cpu.write(center, Byte(0));
+        }
+
+        cpu.write(0x212c, Byte(0x1f));
+        cpu.write(0x212d, Byte(0));
+        cpu.write(0x2100, Byte(0x0f));
+
+        runner.add(configuration.name, 224,
+            [machine]()
+            {
+                Video::Processor& processor = machine->videoRegisters.processor;
+                for (int vCounter = 1; vCounter <= 224; ++vCounter)
+                {
+                    processor.drawScanline(vCounter);
+                }
+            });
+    }
+}
+
+void addAudioBenchmarks(BenchmarkRunner& runner, Output& output)
+{
+    struct Machine
+    {
+        Machine(Output& output)
+            : state(output)
+            , registers(output, state)
+        {
+            registers.initialize(ports);
+            state.getMemory().finalize();
+        }
+
+        void writeDsp(int address, Byte value)
+        {
+            state.getMemory().writeByte(Byte(address), Word(0xf2));
+            state.getMemory().writeByte(value, Word(0xf3));
+        }
+
+        SPC::State state;
+        Audio::Registers registers;
+        std::array<Byte, 4> ports;
+    };
+    std::shared_ptr<Machine> machine = std::make_shared<Machine>(output);
+    SPC::State::MemoryType& memory = machine->state.getMemory();
+    std::mt19937 random(5);
+
+    // A looping BRR sample of random noise for each voice, with all four filters, listed in
+    // the source directory at $0200
+    constexpr int directory = 0x0200;
+    constexpr int blockCount = 32;
+    for (int voice = 0; voice < 8; ++voice)
+    {
+        const int start = 0x0300 + voice * blockCount * 9;
+        for (int block = 0; block < blockCount; ++block)
+        {
+            const int blockStart = start + block * 9;
+            Byte header = Byte((0x0a << 4) | (block & 0x03) << 2);
+            if (block == blockCount - 1)
+            {
+                header = header | Byte(0x03);
+            }
+            memory.writeByte(header, Word(blockStart));
+            for (int i = 1; i < 9; ++i)
+            {
+                memory.writeByte(Byte(uint8_t(random())), Word(blockStart + i));
+            }
+        }
+        for (int i = 0; i < 2; ++i)
+        {
+            memory.writeByte(Byte(start & 0xff), Word(directory + voice * 4 + i * 2));
+            memory.writeByte(Byte(start >> 8), Word(directory + voice * 4 + i * 2 + 1));
+        }
+    }
+
+    // Every voice keyed on at its own pitch with an ADSR envelope, echo off
+    for (int voice = 0; voice < 8; ++voice)
+    {
+        const int base = voice << 4;
+        const int pitch = 0x0800 + voice * 0x0300;
+        machine->writeDsp(base + 0x00, Byte(0x40));
+        machine->writeDsp(base + 0x01, Byte(0x40));
+        machine->writeDsp(base + 0x02, Byte(pitch & 0xff));
+        machine->writeDsp(base + 0x03, Byte(pitch >> 8));
+        machine->writeDsp(base + 0x04, Byte(voice));
+        machine->writeDsp(base + 0x05, Byte(0x8f));
+        machine->writeDsp(base + 0x06, Byte(0xe0));
+    }
+    machine->writeDsp(0x0c, Byte(0x7f));
+    machine->writeDsp(0x1c, Byte(0x7f));
+    machine->writeDsp(0x2c, Byte(0));
+    machine->writeDsp(0x3c, Byte(0));
+    machine->writeDsp(0x5d, Byte(directory >> 8));
+    machine->writeDsp(0x6c, Byte(0x20));
+    machine->writeDsp(0x5c, Byte(0));
+    machine->writeDsp(0x4c, Byte(0xff));
+
+    // A sample takes 32 ticks, this is a second of sound
+    constexpr int sampleCount = 32000;
+    runner.add("dsp/8 voices", sampleCount,
+        [machine]()
+        {
+            Audio::Processor& processor = machine->registers.processor;
+            for (int i = 0; i < sampleCount * 32; ++i)
+            {
+                processor.tick();
+            }
+        });
+}
+
+void addDmaBenchmarks(BenchmarkRunner& runner, Output& output)
+{
+    std::shared_ptr<CpuMachine> machine = std::make_shared<CpuMachine>(output);
+
+    std::mt19937 random(6);
+    for (Byte& byte : machine->wram)
+    {
+        byte = Byte(uint8_t(random()));
+    }
+
+    // Channel 0 copying 32 KiB of work RAM to VRAM a word at a time, as games upload graphics
+    constexpr int byteCount = 0x8000;
+    runner.add("dma/wram to vram", byteCount,
+        [machine]()
+        {
+            CpuMachine& cpu = *machine;
+            cpu.write(0x2115, Byte(0x80));
+            cpu.writeWord(0x2116, Word(0));
+            cpu.write(0x4300, Byte(0x01));
+            cpu.write(0x4301, Byte(0x18));
+            cpu.writeWord(0x4302, Word(0));
+            cpu.write(0x4304, Byte(0x7e));
+            cpu.writeWord(0x4305, Word(byteCount));
+            cpu.write(0x420b, Byte(0x01));
+            uint64_t cycles = 0;
+            while (cpu.dmaInstruction.enabled())
+            {
+                cycles += cpu.dmaInstruction.execute(cpu.state);
+            }
+            keepResult(cycles);
+        });
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "Common/Output.h"
+
+#include "Benchmark.h"
+
+// The benchmarks of each subsystem, every one on a synthetic machine made from fixed seeds, so
+// that runs on one host are comparable
+void addMemoryBenchmarks(BenchmarkRunner& runner, Output& output);
+void addCpuBenchmarks(BenchmarkRunner& runner, Output& output);
+void addVideoBenchmarks(BenchmarkRunner& runner, Output& output);
+void addAudioBenchmarks(BenchmarkRunner& runner, Output& output);
+void addDmaBenchmarks(BenchmarkRunner& runner, Output& output);
@@ -0,0 +1,66 @@
+#include <filesystem>
+
+#include "Output.h"
+#include "Results.h"
+
+#include "Benchmark.h"
+#include "Benchmarks.h"
+
+// SnesBench [<results file>] [--iterations <count>] [--warmup <count>] [--filter <text>] [--log-file <file>]
+int main(int argc, char** argv)
+{
+    Output::System outputSystem("logconfig.txt");
+    Output output(outputSystem, "main");
+
+    try
+    {
+        std::filesystem::path resultsPath;
+        int iterations = 15;
+        int warmUpIterations = 3;
+        std::string filter;
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string argument = argv[i];
+            if (argument == "--iterations" && i + 1 < argc)
+            {
+                iterations = std::stoi(argv[++i]);
+            }
+            else if (argument == "--warmup" && i + 1 < argc)
+            {
+                warmUpIterations = std::stoi(argv[++i]);
+            }
+            else if (argument == "--filter" && i + 1 < argc)
+            {
+                filter = argv[++i];
+            }
+            else if (argument == "--log-file" && i + 1 < argc)
+            {
+                outputSystem.setLogFile(argv[++i]);
+            }
+            else if (argument.starts_with("--"))
+            {
+                output.error("Usage: SnesBench [<results file>] [--iterations <count>] [--warmup <count>] [--filter <text>] [--log-file <file>]");
+                return 2;
+            }
+            else
+            {
+                resultsPath = argument;
+            }
+        }
+
+        BenchmarkRunner runner(output, warmUpIterations, iterations);
+        addMemoryBenchmarks(runner, output);
+        addCpuBenchmarks(runner, output);
+        addVideoBenchmarks(runner, output);
+        addAudioBenchmarks(runner, output);
+        addDmaBenchmarks(runner, output);
+        runner.run(filter);
+        Results::write(output, resultsPath, [&runner](std::ostream& stream) { runner.writeResults(stream); });
+        return runner.allSucceeded() ? 0 : 1;
+    }
+    catch (const std::exception& e)
+    {
+        output.error("Benchmark failure: ", e.what());
+        return 2;
+    }
+}
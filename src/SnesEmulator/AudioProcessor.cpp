@@ -1,13 +1,16 @@
 #include "AudioProcessor.h"
 
+#include <bit>
 #include <iostream>
 
 #include <portaudio.h>
 
 #include "System.h"
 #include "Util.h"
+#include "Hash.h"
 
 #define PROFILING_ENABLED false
+#define PROFILE_DSP_STEPS false
 
 #include "Profiler.h"
 
@@ -58,7 +61,7 @@ struct StreamHandler
         }
         catch (const AccessException& e)
         {
-            processor.output.debug("Caught AccessException in Audio processor: ", e.what());
+            LOG_DEBUG(processor.output, "Caught AccessException in Audio processor: ", e.what());
             return paContinue;
         }
         catch (const std::exception& e)
@@ -79,13 +82,13 @@ void check(PaError error)
 
 static constexpr Processor::SampleCycleTable createSampleCycleTable();
 
-Processor::Processor(Output& output, Memory<Word>& spcMemory)
+Processor::Processor(Output& output, SPC::AudioRam& spcMemory)
     : RegisterManager(output, "audio", dspMemory)
     , output(output, "audio")
     , spcMemory(spcMemory)
     , dspMemory(0x80, output)
 {
-    timers[2].highPrecision = true;
+    timers[2].divider = 16;
 
     Voice* previousVoice = nullptr;
     for (Voice& voice : voices)
@@ -127,6 +130,11 @@ void Processor::initialize()
 
 void Processor::startStream()
 {
+    if (!initialized)
+    {
+        initialize();
+    }
+
     PaStreamParameters outputParameters;
     outputParameters.device = Pa_GetDefaultOutputDevice();
     if (outputParameters.device == paNoDevice)
@@ -192,7 +200,7 @@ void Processor::outputNextSample(float& leftChannel, float& rightChannel)
 
         dspOutputCount = rightOutputCount;
 
-        output.debug("Starting dsp output cycle ", rightOutputCount);
+        LOG_DEBUG(output, "Starting dsp output cycle ", rightOutputCount);
     }
 
     if (dspOutputCount <= rightOutputCount)
@@ -218,7 +226,7 @@ void Processor::outputNextSample(float& leftChannel, float& rightChannel)
 
         if (oldOutputBufferSize != outputBufferSize)
         {
-            output.debug("Iteration ", dspOutputCount, " New buffer size ", outputBufferSize);
+            LOG_DEBUG(output, "Iteration ", dspOutputCount, " New buffer size ", outputBufferSize);
         }
 
         maxOutputLag = std::max<size_t>(maxOutputLag, outputLag);
@@ -232,11 +240,11 @@ void Processor::outputNextSample(float& leftChannel, float& rightChannel)
 
         if (lastDebugOutputCounter++ == 100000)
         {
-            output.debug("Output count ", dspOutputCount);
-            output.debug("Output index ", outputIndex);
-            output.debug("Current ouput lag ", outputLag);
-            output.debug("Max output lag ", maxOutputLag);
-            output.debug("Buffer underrun counter ", outputBufferUnderrunCounter);
+            LOG_DEBUG(output, "Output count ", dspOutputCount);
+            LOG_DEBUG(output, "Output index ", outputIndex);
+            LOG_DEBUG(output, "Current ouput lag ", outputLag);
+            LOG_DEBUG(output, "Max output lag ", maxOutputLag);
+            LOG_DEBUG(output, "Buffer underrun counter ", outputBufferUnderrunCounter);
             lastDebugOutputCounter = 0;
         }
     }
@@ -863,26 +871,12 @@ void Processor::Voice::doStep<9>()
 
 }
 
-void Processor::tickTimers(bool tickAllTimers)
-{
-    for (int i = 0; i < 3; ++i)
-    {
-        if (timers[i].enabled && (timers[i].highPrecision || tickAllTimers))
-        {
-            ++timers[i].tick;
-            if (timers[i].tick == timers[i].target)
-            {
-                timers[i].tick = 0;
-                timers[i].counter = (timers[i].counter + 1) & 0xf;
-            }
-        }
-    }
-}
-
 //  0.
 template<>
 void Processor::onSampleCycle<0>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 0");
+
     //  1. Voice steps : V0:S5  V1 : S2
     //doSteps({ 0, 5 }, { 1, 2 });
     voices[0].doStep<5>();
@@ -890,7 +884,7 @@ void Processor::onSampleCycle<0>()
 
     //  2. Tick the SPC700 Stage 1 timers, always for T2 and every 4 samples for
     //  T0 and T1.
-    tickTimers((sampleCount & 3) == 0);
+    // Derived from the tick count, see Timer
 
     ++dspCycle;
     ++targetTickCounter;
@@ -900,6 +894,8 @@ void Processor::onSampleCycle<0>()
 template<>
 void Processor::onSampleCycle<1>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 1");
+
     //  1. Voice steps : V0:S6  V1 : S3
     voices[0].doStep<6>();
     voices[1].doStep<3>();
@@ -909,6 +905,8 @@ void Processor::onSampleCycle<1>()
 template<>
 void Processor::onSampleCycle<2>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 2");
+
     //  1. Voice steps : V0:S7  V1 : S4         V3 : S1
     voices[0].doStep<7>();
     voices[1].doStep<4>();
@@ -919,6 +917,8 @@ void Processor::onSampleCycle<2>()
 template<>
 void Processor::onSampleCycle<3>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 3");
+
     //  1. Voice steps : V0:S8  V1 : S5  V2 : S2
     voices[0].doStep<8>();
     voices[1].doStep<5>();
@@ -929,6 +929,8 @@ void Processor::onSampleCycle<3>()
 template<>
 void Processor::onSampleCycle<4>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 4");
+
     //  1. Voice steps : V0:S9  V1 : S6  V2 : S3
     voices[0].doStep<9>();
     voices[1].doStep<6>();
@@ -939,6 +941,8 @@ void Processor::onSampleCycle<4>()
 template<>
 void Processor::onSampleCycle<5>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 5");
+
     //  1. Voice steps : V1:S7  V2 : S4         V4 : S1
     voices[1].doStep<7>();
     voices[2].doStep<4>();
@@ -949,6 +953,8 @@ void Processor::onSampleCycle<5>()
 template<>
 void Processor::onSampleCycle<6>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 6");
+
     //  1. Voice steps : V1:S8  V2 : S5  V3 : S2
     voices[1].doStep<8>();
     voices[2].doStep<5>();
@@ -959,6 +965,8 @@ void Processor::onSampleCycle<6>()
 template<>
 void Processor::onSampleCycle<7>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 7");
+
     //  1. Voice steps : V1:S9  V2 : S6  V3 : S3
     voices[1].doStep<9>();
     voices[2].doStep<6>();
@@ -969,6 +977,8 @@ void Processor::onSampleCycle<7>()
 template<>
 void Processor::onSampleCycle<8>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 8");
+
     //  1. Voice steps : V2:S7  V3 : S4         V5 : S1
     voices[2].doStep<7>();
     voices[3].doStep<4>();
@@ -979,6 +989,8 @@ void Processor::onSampleCycle<8>()
 template<>
 void Processor::onSampleCycle<9>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 9");
+
     //  1. Voice steps : V2:S8  V3 : S5  V4 : S2
     voices[2].doStep<8>();
     voices[3].doStep<5>();
@@ -989,6 +1001,8 @@ void Processor::onSampleCycle<9>()
 template<>
 void Processor::onSampleCycle<10>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 10");
+
     //  1. Voice steps : V2:S9  V3 : S6  V4 : S3
     voices[2].doStep<9>();
     voices[3].doStep<6>();
@@ -999,6 +1013,8 @@ void Processor::onSampleCycle<10>()
 template<>
 void Processor::onSampleCycle<11>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 11");
+
     //  1. Voice steps : V3:S7  V4 : S4         V6 : S1
     voices[3].doStep<7>();
     voices[4].doStep<4>();
@@ -1009,6 +1025,8 @@ void Processor::onSampleCycle<11>()
 template<>
 void Processor::onSampleCycle<12>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 12");
+
     //  1. Voice steps : V3:S8  V4 : S5  V5 : S2
     voices[3].doStep<8>();
     voices[4].doStep<5>();
@@ -1019,6 +1037,8 @@ void Processor::onSampleCycle<12>()
 template<>
 void Processor::onSampleCycle<13>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 13");
+
     //  1. Voice steps : V3:S9  V4 : S6  V5 : S3
     voices[3].doStep<9>();
     voices[4].doStep<6>();
@@ -1029,6 +1049,8 @@ void Processor::onSampleCycle<13>()
 template<>
 void Processor::onSampleCycle<14>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 14");
+
     //  1. Voice steps : V4:S7  V5 : S4         V7 : S1
     voices[4].doStep<7>();
     voices[5].doStep<4>();
@@ -1039,6 +1061,8 @@ void Processor::onSampleCycle<14>()
 template<>
 void Processor::onSampleCycle<15>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 15");
+
     //  1. Voice steps : V4:S8  V5 : S5  V6 : S2
     voices[4].doStep<8>();
     voices[5].doStep<5>();
@@ -1049,19 +1073,23 @@ void Processor::onSampleCycle<15>()
 template<>
 void Processor::onSampleCycle<16>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 16");
+
     //  1. Voice steps : V4:S9  V5 : S6  V6 : S3
     voices[4].doStep<9>();
     voices[5].doStep<6>();
     voices[6].doStep<3>();
 
     //  2. Tick the SPC700 Stage 1 timer for T2.
-    tickTimers(false);
+    // Derived from the tick count, see Timer
 }
 
 //  17.
 template<>
 void Processor::onSampleCycle<17>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 17");
+
     //  1. Voice steps : V0:S1                              V5 : S7  V6 : S4
     voices[0].doStep<1>();
     voices[5].doStep<7>();
@@ -1072,6 +1100,8 @@ void Processor::onSampleCycle<17>()
 template<>
 void Processor::onSampleCycle<18>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 18");
+
     //  1. Voice steps : V5:S8  V6 : S5  V7 : S2
     voices[5].doStep<8>();
     voices[6].doStep<5>();
@@ -1082,6 +1112,8 @@ void Processor::onSampleCycle<18>()
 template<>
 void Processor::onSampleCycle<19>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 19");
+
     //  1. Voice steps : V5:S9  V6 : S6  V7 : S3
     voices[5].doStep<9>();
     voices[6].doStep<6>();
@@ -1092,6 +1124,8 @@ void Processor::onSampleCycle<19>()
 template<>
 void Processor::onSampleCycle<20>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 20");
+
     //  1. Voice steps : V1:S1                              V6 : S7  V7 : S4
     voices[1].doStep<1>();
     voices[6].doStep<7>();
@@ -1102,6 +1136,8 @@ void Processor::onSampleCycle<20>()
 template<>
 void Processor::onSampleCycle<21>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 21");
+
     //  1. Voice steps : V0:S2                                     V6 : S8  V7 : S5
     voices[0].doStep<2>();
     voices[6].doStep<8>();
@@ -1112,6 +1148,8 @@ void Processor::onSampleCycle<21>()
 template<>
 void Processor::onSampleCycle<22>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 22");
+
     //  1. Voice steps : V0:S3a                                    V6 : S9  V7 : S6
     voices[0].doStep3a();
     voices[6].doStep<9>();
@@ -1133,6 +1171,8 @@ void Processor::onSampleCycle<22>()
 template<>
 void Processor::onSampleCycle<23>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 23");
+
     //  1. Voice steps : V7:S7
     voices[7].doStep<7>();
 
@@ -1148,6 +1188,8 @@ void Processor::onSampleCycle<23>()
 template<>
 void Processor::onSampleCycle<24>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 24");
+
     //  1. Voice steps : V7:S8
     voices[7].doStep<8>();
 
@@ -1159,6 +1201,8 @@ void Processor::onSampleCycle<24>()
 template<>
 void Processor::onSampleCycle<25>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 25");
+
     //  1. Voice steps : V0:S3b                                           V7 : S9
     voices[0].doStep3b();
     voices[7].doStep<9>();
@@ -1179,6 +1223,8 @@ float applyMainVolume(int32_t& sample, int32_t mainVolume)
 template<>
 void Processor::onSampleCycle<26>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 26");
+
     //  1. Load and apply MVOLL.
     mainVolumeLeft = registers[size_t(Register::MVOLL)];
 
@@ -1194,6 +1240,7 @@ void Processor::onSampleCycle<26>()
         const size_t outputIndex = leftOutputCount & (outputBufferSize - 1);
         leftOutputBuffer[outputIndex] = leftOutput;
         ++leftOutputCount;
+        outputHash = Hash::combine(outputHash, std::bit_cast<uint32_t>(leftOutput));
     }
 
     //  4. Load and apply EFB.
@@ -1205,6 +1252,8 @@ void Processor::onSampleCycle<26>()
 template<>
 void Processor::onSampleCycle<27>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 27");
+
     //  1. Load and apply MVOLR.
     mainVolumeRight = registers[size_t(Register::MVOLR)];
 
@@ -1220,6 +1269,7 @@ void Processor::onSampleCycle<27>()
         const size_t outputIndex = rightOutputCount & (outputBufferSize - 1);
         rightOutputBuffer[outputIndex] = rightOutput;
         ++rightOutputCount;
+        outputHash = Hash::combine(outputHash, std::bit_cast<uint32_t>(rightOutput));
     }
 
     //  4. Load PMON
@@ -1230,6 +1280,8 @@ void Processor::onSampleCycle<27>()
 template<>
 void Processor::onSampleCycle<28>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 28");
+
     //  1. Load NON, EON, and DIR.
     sourceDirectory = registers[size_t(Register::DIR)];
     // TODO
@@ -1242,6 +1294,8 @@ void Processor::onSampleCycle<28>()
 template<>
 void Processor::onSampleCycle<29>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 29");
+
     //  1. Update global counter.
     // TODO
 
@@ -1268,6 +1322,8 @@ void Processor::onSampleCycle<29>()
 template<>
 void Processor::onSampleCycle<30>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 30");
+
     if ((sampleCount & 1) == 1)
     {
         //  5. ** Load KOFF and internal KON.
@@ -1306,6 +1362,8 @@ void Processor::onSampleCycle<30>()
 template<>
 void Processor::onSampleCycle<31>()
 {
+    PROFILE_IF(PROFILE_DSP_STEPS, "Sample cycle 31");
+
     //  1. Voice steps : V0:S4         V2 : S1
     voices[0].doStep<4>();
     voices[2].doStep<1>();
@@ -1372,7 +1430,7 @@ void Processor::printTimeInfo(double currentTime)
     double elapsedTime = currentTime - previousTimeInfoTime;
     if (elapsedTime >= 10.0)
     {
-        output.debug("Audio ticks: ", targetTickCounter / elapsedTime, " / ", timeInfoTickCounter / elapsedTime, "(", 100.0 * targetTickCounter / timeInfoTickCounter, "%)");
+        LOG_DEBUG(output, "Audio ticks: ", targetTickCounter / elapsedTime, " / ", timeInfoTickCounter / elapsedTime, "(", 100.0 * targetTickCounter / timeInfoTickCounter, "%)");
         targetTickCounter = 0;
         timeInfoTickCounter = 0;
         previousTimeInfoTime = currentTime;
@@ -7,6 +7,7 @@
 #include <map>
 #include <bitset>
 #include <mutex>
+#include <algorithm>
 
 #include "Exception.h"
 #include "Types.h"
@@ -14,6 +15,8 @@
 #include "Memory.h"
 #include "RegisterManager.h"
 
+#include "SPC700/SpcAudioRam.h"
+
 namespace Audio {
 
 EXCEPTION(NotYetImplementedException, ::NotYetImplementedException)
@@ -21,17 +24,75 @@ EXCEPTION(RuntimeError, ::RuntimeError)
 
 class Processor : public RegisterManager<Memory<Byte>, Output::Color::Cyan>
 {
-private:
+public:
+    // The stage 1 clock of the timers is a fixed division of the DSP tick count, so a timer is
+    // not stepped along with the DSP. It is brought up to date only when the SPC accesses it.
     class Timer
     {
     public:
-        bool highPrecision = false;
+        void synchronize(uint64_t dspTicks)
+        {
+            const uint64_t stage1 = (dspTicks + divider - 1) / divider;
+            uint64_t elapsed = stage1 - stage1Ticks;
+            stage1Ticks = stage1;
+            if (!enabled)
+            {
+                return;
+            }
+            // Stage 2 is an 8-bit counter that is cleared when it reaches the target, a target
+            // below the current value is only reached after wrapping around
+            const uint64_t untilTarget = tick < target ? target - tick : 0x100 - tick + target;
+            if (elapsed < untilTarget)
+            {
+                tick = int((tick + elapsed) & 0xff);
+            }
+            else
+            {
+                elapsed -= untilTarget;
+                counter = int((counter + 1 + elapsed / target) & 0xf);
+                tick = int(elapsed % target);
+            }
+        }
+
+        // The DSP tick count at which the counter of an enabled timer changes next, once the
+        // timer is synchronized to the current count
+        uint64_t getNextCounterTick() const
+        {
+            const uint64_t untilTarget = tick < target ? target - tick : 0x100 - tick + target;
+            return (stage1Ticks + untilTarget - 1) * divider + 1;
+        }
+
+        void reset(uint64_t dspTicks)
+        {
+            enabled = false;
+            synchronize(dspTicks);
+            tick = 0;
+            target = 0x100;
+            counter = 0;
+        }
+
+        template<typename Archive>
+        void serialize(Archive& archive)
+        {
+            archive(enabled);
+            archive(tick);
+            archive(target);
+            archive(counter);
+            archive(stage1Ticks);
+        }
+
+        // DSP ticks per stage 1 tick
+        int divider = 128;
         bool enabled = false;
         int tick = 0;
-        int target = 256;
+        int target = 0x100;
         int counter = 0;
+
+    private:
+        uint64_t stage1Ticks = 0;
     };
 
+private:
     class FrequencyCounter
     {
     private:
@@ -275,6 +336,47 @@ public:
         template<int N>
         void doStep() = delete;
 
+        template<typename Archive>
+        void serialize(Archive& archive)
+        {
+            archive(registers);
+            archive(adsrStage);
+            archive(sourceAddress);
+            archive(headerAddress);
+            archive(nextSampleAddress);
+            archive(header);
+            archive(endOfSample);
+            archive(shouldLoop);
+            archive(sampleSource);
+            archive(sampleBuffer);
+            archive(leftVolume);
+            archive(rightVolume);
+            archive(pitch);
+            archive(attackRate);
+            archive(decayRate);
+            archive(sustainRate);
+            archive(sustainLevel);
+            archive(sourceNumber);
+            archive(envelope);
+            archive(nextSample);
+            archive(output);
+            archive(setupPhase);
+            archive(sampleStage);
+            archive(keyOn);
+            archive(keyOnInternal);
+            archive(keyOff);
+            archive(sourceEndBlock);
+            archive(pitchModulation);
+            archive(noiseOn);
+            archive(echoOn);
+            archive(coefficient);
+            archive(interpolationIndex);
+            archive(frequencyCounter);
+            archive(envelopeType);
+            archive(gainMode);
+            archive(gainLevel);
+        }
+
     public:
         std::array<Byte, size_t(Register::Count)> registers;
 
@@ -390,7 +492,7 @@ public:
     //static constexpr int tableSize = 50;
     static constexpr const int voiceCount = 8;
 
-    Processor(Output& output, Memory<Word>& spcMemory);
+    Processor(Output& output, SPC::AudioRam& spcMemory);
 
     Processor(const Processor&) = delete;
     Processor& operator=(const Processor&) = delete;
@@ -447,29 +549,84 @@ public:
 
     void printMemoryRegister(bool write, Byte value, AddressType address, const std::string& info) override
     {
-        if (supressOutput)
+        if (!supressOutput && output.isEnabled(Log::Level::Debug))
         {
-            return;
+            output.log(Log::Level::Debug, Output::Color::Cyan, value != 0, (write ? "Write " : "Read "), value, " (", std::bitset<8>(value), ") @", address, " (", info, "), cycle ", dspCycle, " (+", (dspCycle - lastDspCycle), ")", " (sampleCount=", sampleCount, ")", " (sampleCycle=", sampleCycle, ")");
         }
-        static uint64_t lastDspCycle = 0;
-        output.log(Log::Level::Debug, Output::Color::Cyan, value != 0, (write ? "Write " : "Read "), value, " (", std::bitset<8>(value), ") @", address, " (", info, "), cycle ", dspCycle, " (+", (dspCycle - lastDspCycle), ")", " (sampleCount=", sampleCount, ")", " (sampleCycle=", sampleCycle, ")");
         lastDspCycle = dspCycle;
     }
 
-    void tickTimers(bool tickAllTimers);
-
     template<int N>
     void onSampleCycle() = delete;
 
     void tick();
 
+    uint64_t getTickCount() const
+    {
+        return sampleCount * 32 + sampleCycle;
+    }
+
+    // Brings a timer up to date, must be used for every access from the SPC side
+    Timer& getTimer(int index)
+    {
+        Timer& timer = timers[index];
+        timer.synchronize(getTickCount());
+        return timer;
+    }
+
     void resetTimers()
     {
-        timers = {};
+        for (Timer& timer : timers)
+        {
+            timer.reset(getTickCount());
+        }
     }
 
     void printDebuggerInfo(Output& output, Output::Lock& lock) const;
 
+    // Samples put out and not yet taken by the host audio stream, zero until the stream starts
+    size_t getOutputFill() const
+    {
+        return dspOutputStarted ? rightOutputCount - std::min(dspOutputCount, rightOutputCount) : 0;
+    }
+
+    // Hash of the samples put out since the last call
+    uint64_t takeOutputHash()
+    {
+        std::lock_guard outputBufferLock(outputBufferMutex);
+        const uint64_t hash = outputHash;
+        outputHash = 0;
+        return hash;
+    }
+
+    // The output buffers belong to the host audio stream and are not part of the state
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        archive(voices);
+        archive(timers);
+        archive(dspMemory);
+        archive(registers);
+        archive(sampleCycle);
+        archive(sampleCount);
+        archive(leftSampleSum);
+        archive(rightSampleSum);
+        archive(dspCycle);
+        archive(mainVolumeLeft);
+        archive(mainVolumeRight);
+        archive(echoVolumeLeft);
+        archive(echoVolumeRight);
+        archive(reset);
+        archive(mute);
+        archive(echoOff);
+        archive(end);
+        archive(noiseGeneratorClock);
+        archive(echoFeedback);
+        archive(sourceDirectory);
+        archive(echoRegionOffset);
+        archive(echoDelay);
+    }
+
 private:
     bool checkStreamStatus(unsigned long flags);
     void outputNextSample(float& leftChannel, float& rightChannel);
@@ -499,8 +656,9 @@ private:
     //uint64_t spcCycle = 0;
 
     uint64_t dspCycle = 0;
+    uint64_t lastDspCycle = 0;
 
-    Memory<Word>& spcMemory;
+    SPC::AudioRam& spcMemory;
 
     int8_t mainVolumeLeft;
     int8_t mainVolumeRight;
@@ -535,6 +693,8 @@ private:
     size_t rightOutputCount = 0;
     size_t dspOutputCount = 0;
 
+    uint64_t outputHash = 0;
+
     void* stream;
 
     bool initialized = false;
@@ -37,12 +37,13 @@ public:
             {
                 for (int i = 0; i < 3; ++i)
                 {
-                    if (!processor.timers[i].enabled && byte.getBit(i))
+                    Processor::Timer& timer = processor.getTimer(i);
+                    if (!timer.enabled && byte.getBit(i))
                     {
-                        processor.timers[i].tick = 0;
-                        processor.timers[i].counter = 0;
+                        timer.tick = 0;
+                        timer.counter = 0;
                     }
-                    processor.timers[i].enabled = byte.getBit(i);
+                    timer.enabled = byte.getBit(i);
                 }
                 if (byte.getBit(4))
                 {
@@ -54,7 +55,7 @@ public:
                     cpuToSpcBuffers[2] = 0;
                     cpuToSpcBuffers[3] = 0;
                 }
-                bootRomDataEnabled = byte.getBit(7);
+                spcMemory.setBootRomEnabled(byte.getBit(7));
             });
         makeWriteRegister(0xf2, "DSP Communication Address", false,
             [this](Byte value)
@@ -84,22 +85,17 @@ public:
             makeWriteRegister(Word(0xfa + i), std::string("Timer ") + char('1' + i) + " Scaling Target", true,
                 [this, i](Byte value)
                 {
-                    processor.timers[i].target = value == 0 ? 0x100 : int(value);
+                    processor.getTimer(i).target = value == 0 ? 0x100 : int(value);
                 });
             makeReadRegister(Word(0xfd + i), std::string("Timer ") + char('1' + i) + " Output", false,
                 [this, i](Byte& value)
                 {
-                    value = Byte(processor.timers[i].counter);
-                    processor.timers[i].counter = 0;
+                    Processor::Timer& timer = processor.getTimer(i);
+                    value = Byte(timer.counter);
+                    timer.counter = 0;
                 });
         }
 
-        for (int i = 0; i < bootRomData.size(); ++i)
-        {
-            Word address(0xffc0 + i);
-            spcMemory.createLocation<BootRomLocation>(address, Byte(0xff), bootRomData[i], std::ref(bootRomDataEnabled));
-        }
-
         //// DSP Registers
         //for (int i = 0; i < processor.voices.size(); ++i)
         //{
@@ -300,15 +296,21 @@ public:
         processor.dspMemory.writeWord(0xaa, 0x07);*/
 
         output.debug("All audio registers created");
-        processor.initialize();
     }
 
     void reset()
     {
-        bootRomDataEnabled = true;
+        spcMemory.setBootRomEnabled(true);
         processor.resetTimers();
     }
 
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        archive(dspAddress);
+        archive(processor);
+    }
+
     Output output;
 
     SPC::State::MemoryType& spcMemory;
@@ -319,15 +321,6 @@ public:
 
     Byte dspAddress;
 
-    bool bootRomDataEnabled = true;
-
-    std::array<Byte, 64> bootRomData = {
-       0xcd, 0xef, 0xbd, 0xe8, 0x00, 0xc6, 0x1d, 0xd0, 0xfc, 0x8f, 0xaa, 0xf4, 0x8f, 0xbb, 0xf5, 0x78,
-       0xcc, 0xf4, 0xd0, 0xfb, 0x2f, 0x19, 0xeb, 0xf4, 0xd0, 0xfc, 0x7e, 0xf4, 0xd0, 0x0b, 0xe4, 0xf5,
-       0xcb, 0xf4, 0xd7, 0x00, 0xfc, 0xd0, 0xf3, 0xab, 0x01, 0x10, 0xef, 0x7e, 0xf4, 0x10, 0xeb, 0xba,
-       0xf6, 0xda, 0x00, 0xba, 0xf4, 0xc4, 0xf4, 0xdd, 0x5d, 0xd0, 0xdb, 0x1f, 0x00, 0x00, 0xc0, 0xff,
-    };
-
     int libraryByteCount = 0;
 };
 
@@ -24,9 +24,11 @@ public:
             uint64_t iteration = 0;
             //uint64_t masterCycle = 0;
             //uint64_t nextSpc = 0;
+            GlobalProfiler::Binding profilerBinding(system.profiler);
             system.output.debug("HELLO AUDIO SYSTEM!");
             system.now = std::chrono::steady_clock::now();
             std::chrono::steady_clock::time_point startTime = system.now;
+            std::chrono::steady_clock::time_point lastReportTime = startTime;
             constexpr AudioSystem::CycleCount oneCycle(1);
             AudioSystem::CycleCount masterCycle(0);
             //double startTime = system.processor.renderer.getStreamTime();
@@ -34,25 +36,57 @@ public:
             {
                 system.processor.checkStreamErrors();
 
+                if (system.suspendRequested)
+                {
+                    std::unique_lock<std::mutex> lock(system.suspendMutex);
+                    system.suspended = true;
+                    system.suspendCondition.notify_all();
+                    system.suspendCondition.wait(lock, [this]() { return !system.suspendRequested; });
+                    system.suspended = false;
+                    // The state may have been replaced, continue from here rather than catching up
+                    system.nextSpc = masterCycle;
+                }
+
                 if (system.threaded && masterCycle == system.nextSpc)
                 {
-                    Instruction<SPC::State>* instruction = system.instructionDecoder.getNextInstruction(system.state);
-                    system.context.nextInstruction = instruction;
+                    int cycles = 0;
+                    if (system.context.hasBreakpoints())
+                    {
+                        system.idleLoop.wake();
 
-                    instruction->applyBreakpoints(system.state);
+                        Instruction<SPC::State>* instruction = system.instructionDecoder.getNextInstruction(system.state);
+                        system.context.nextInstruction = instruction;
 
-                    system.context.addKnownAddress(system.state.getProgramAddress());
+                        instruction->applyBreakpoints(system.state);
 
-                    if (system.debugger.isPaused())
-                    {
-                        break;
-                    }
+                        system.context.addKnownAddress(system.state.getProgramAddress());
 
+                        if (system.debugger.isPaused())
+                        {
+                            break;
+                        }
 
-                    int cycles = 0;
-                    {
                         PROFILE_SCOPE("Execute SPC Instruction (threaded)");
+                        system.beginProfiledInstruction(instruction);
                         cycles = instruction->execute(system.state);
+                        system.endProfiledInstruction(cycles);
+                        system.idleLoop.update(cycles);
+                    }
+                    else
+                    {
+                        if (!system.idleLoop.isIdle())
+                        {
+                            system.context.addKnownAddress(system.state.getProgramAddress());
+                        }
+
+                        // The debugger reads the SPC state as soon as the CPU side pauses
+                        if (system.debugger.isPaused())
+                        {
+                            break;
+                        }
+
+                        PROFILE_SCOPE("Execute SPC Instruction (threaded)");
+                        cycles = system.executeNext();
                     }
                     if (cycles)
                     {
@@ -90,11 +124,11 @@ public:
                     //std::this_thread::sleep_until(startTime + nextCycle);
                 }
                 ++iteration;
-                static std::chrono::steady_clock::time_point lastTime = startTime;
-                if (system.now - lastTime > std::chrono::seconds(10))
+                if (system.now - lastReportTime > std::chrono::seconds(10))
                 {
-                    system.output.debug("Audio cycles: ", masterCycle.count(), " / ", iteration, " (", (100.0 * masterCycle.count() / iteration), "%)");
-                    lastTime = system.now;
+                    LOG_DEBUG(system.output, "Audio cycles: ", masterCycle.count(), " / ", iteration, " (", (100.0 * masterCycle.count() / iteration), "%)");
+                    system.profiler.printEntries(system.output);
+                    lastReportTime = system.now;
                 }
             }
             system.output.debug("BYE AUDIO MONKEY! ");
@@ -117,9 +151,14 @@ public:
             system.context.printAddressHistory(system.output);
             //std::getchar();
         }
+        system.idleLoop.wake();
         system.elapsedTime = std::chrono::nanoseconds(0);
         system.pauseRequested = true;
-        system.threaded = false;
+        {
+            std::scoped_lock<std::mutex> lock(system.suspendMutex);
+            system.threaded = false;
+        }
+        system.suspendCondition.notify_all();
     }
 
 private:
@@ -128,10 +167,33 @@ private:
 
 void AudioSystem::start()
 {
+    if (headless)
+    {
+        return;
+    }
     processor.startStream();
     if (threaded)
     {
         systemThread = std::thread(AudioSystemRunner(*this));
         systemThreadStarted = true;
     }
-}
\ No newline at end of file
+}
+
+void AudioSystem::suspend()
+{
+    std::unique_lock<std::mutex> lock(suspendMutex);
+    if (systemThreadStarted)
+    {
+        suspendRequested = true;
+        suspendCondition.wait(lock, [this]() { return suspended || !threaded; });
+    }
+}
+
+void AudioSystem::resume()
+{
+    {
+        std::scoped_lock<std::mutex> lock(suspendMutex);
+        suspendRequested = false;
+    }
+    suspendCondition.notify_all();
+}
@@ -1,12 +1,18 @@
 #pragma once
 
 #include <iostream>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 
 #include "Common/System.h"
+#include "Common/Profiler.h"
 
 #include "SPC700/SpcState.h"
 #include "SPC700/SpcInstructionDecoder.h"
+#include "SPC700/SpcIdleLoopDetector.h"
 
 #include "Debugger.h"
 
@@ -16,9 +22,19 @@
 class AudioSystem
 {
 public:
-    AudioSystem(Output& output, Debugger& debugger)
+    // A headless system opens no audio stream, the SPC is then run on the emulator thread
+    AudioSystem(Output& output, Debugger& debugger, bool headless)
         : output(output, "audio")
         , instructionDecoder()
+        , idleLoop(state, pollableRegisters,
+            [this](Word address)
+            {
+                if (address >= 0xfd)
+                {
+                    return Byte(processor.getTimer(address - 0xfd).counter);
+                }
+                return (*cpuToSpcBuffers)[address - 0xf4];
+            })
         , registers(output, state)
         , processor(registers.processor)
         , debugger(debugger)
@@ -26,6 +42,8 @@ public:
         , elapsedTime(0)
         , nextSpc(0)
         , state(output)
+        , headless(headless)
+        , threaded(!headless)
     {
     }
 
@@ -50,8 +68,15 @@ public:
         return processor;
     }
 
+    uint64_t takeOutputHash()
+    {
+        return processor.takeOutputHash();
+    }
+
     void initialize(std::array<Byte, 4>& cpuToSpcBuffers, std::array<Byte, 4>& spcToCpuBuffers)
     {
+        this->cpuToSpcBuffers = &cpuToSpcBuffers;
+
         SPC::State::MemoryType& memory = state.getMemory();
 
         // I/O between the CPU and SPC700
@@ -72,7 +97,10 @@ public:
         registers.initialize(cpuToSpcBuffers);
         memory.finalize();
 
-        debugger.loadBreakpoints(context, state);
+        if (!headless)
+        {
+            debugger.loadBreakpoints(context, state);
+        }
 
         context.nextInstruction = instructionDecoder.getNextInstruction(state);
     }
@@ -82,13 +110,126 @@ public:
         processor.tick();
     }
 
+    size_t getOutputFill() const
+    {
+        return processor.getOutputFill();
+    }
+
     void reset()
     {
+        idleLoop.wake();
         registers.reset();
     }
 
+    // The DSP ticks until the output of a timer the idle loop polls can change next, at most the
+    // given number
+    uint64_t getTicksToPolledTimerOutput(uint64_t maxTicks)
+    {
+        const uint64_t tickCount = processor.getTickCount();
+        for (int i = 0; i < 3; ++i)
+        {
+            if (idleLoop.polls([i](Word address) { return address == 0xfd + i; }))
+            {
+                const Audio::Processor::Timer& timer = processor.getTimer(i);
+                if (timer.enabled)
+                {
+                    maxTicks = std::min(maxTicks, timer.getNextCounterTick() - tickCount);
+                }
+            }
+        }
+        return maxTicks;
+    }
+
+    static bool isCpuPort(Word address)
+    {
+        return address >= 0xf4 && address <= 0xf7;
+    }
+
+    // Executes the next SPC instruction without debugger support, or skips it while the SPC
+    // spins in an idle loop that nothing has disturbed
+    int executeNext()
+    {
+        int cycles = idleLoop.skip();
+        if (cycles == 0)
+        {
+            if (context.profiler.isRunning())
+            {
+                beginProfiledInstruction(instructionDecoder.getNextInstruction(state));
+                cycles = instructionDecoder.execute(state);
+                endProfiledInstruction(cycles);
+            }
+            else
+            {
+                cycles = instructionDecoder.execute(state);
+            }
+            idleLoop.update(cycles);
+        }
+        else if (context.profiler.isRunning())
+        {
+            context.profiler.countIdleCycles(state, cycles);
+        }
+        return cycles;
+    }
+
+    // Around an instruction executed outside of executeNext, counted in SPC cycles
+    void beginProfiledInstruction(const Instruction<SPC::State>* instruction)
+    {
+        if (context.profiler.isRunning())
+        {
+            context.profiler.beginInstruction(state, instruction);
+        }
+    }
+
+    void endProfiledInstruction(int cycles)
+    {
+        if (context.profiler.isRunning() && cycles)
+        {
+            context.profiler.endInstruction(state, cycles);
+        }
+    }
+
     void start();
 
+    // Parks the audio thread between two instructions, so that the SPC and DSP state can be
+    // accessed from the emulator thread until resume is called
+    void suspend();
+    void resume();
+
+    class Suspension
+    {
+    public:
+        Suspension(AudioSystem& system)
+            : system(system)
+        {
+            system.suspend();
+        }
+
+        ~Suspension()
+        {
+            system.resume();
+        }
+
+        Suspension(const Suspension&) = delete;
+        Suspension& operator=(const Suspension&) = delete;
+
+    private:
+        AudioSystem& system;
+    };
+
+    // Must be called while suspended
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        idleLoop.wake();
+        archive(state);
+        archive(registers);
+        if constexpr (Archive::loading)
+        {
+            idleLoop.wake();
+            context.nextInstruction = instructionDecoder.getNextInstruction(state);
+        }
+    }
+
 private:
     Output output;
 
@@ -98,20 +239,35 @@ public:
     SPC::State state;
     SPC::InstructionDecoder instructionDecoder;
 
+    // The CPU ports $F4-$F7 and the timer outputs $FD-$FF
+    static constexpr uint16_t pollableRegisters = 0xe0f0;
+    SPC::IdleLoopDetector idleLoop;
+
 private:
     Audio::Registers registers;
     Audio::Processor& processor;
 
     Debugger& debugger;
 
+    std::array<Byte, 4>* cpuToSpcBuffers = nullptr;
+
     bool systemThreadStarted = false;
 
+    std::atomic<bool> suspendRequested = false;
+    bool suspended = false;
+    std::mutex suspendMutex;
+    std::condition_variable suspendCondition;
+
 public:
     std::thread systemThread;
 
     Debugger::Context<SPC::State> context;
 
-    bool threaded = true;
+    const bool headless;
+    bool threaded;
+
+    // Scope timings of the audio thread
+    GlobalProfiler profiler;
 
     bool pauseRequested = false;
 
@@ -3,7 +3,10 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <map>
+#include <memory>
 #include <set>
+#include <sstream>
 
 #include "Common/System.h"
 
@@ -12,6 +15,8 @@
 
 #include "Instruction.h"
 
+#include "GuestProfiler.h"
+
 #include "VideoProcessor.h"
 #include "VideoRegisters.h"
 #include "VideoDebugger.h"
@@ -82,13 +87,13 @@ private:
             color = Output::Color::Yellow;
         }
 
-        void visit(const BootRomLocation& location) override
+        void visit(const ArrayLocation& location) override
         {
             if (location.getApplicationCount() > 0)
             {
                 color = Output::Color::Cyan;
             }
-            else if (location.bootRomDataEnabled)
+            else if (location.isReadOnly())
             {
                 color = Output::Color::Blue;
             }
@@ -177,9 +182,17 @@ public:
             return stepMode;
         }
 
+        bool hasBreakpoints() const
+        {
+            return !breakpoints.empty();
+        }
+
     public:
         const Instruction<State>* nextInstruction = nullptr;
 
+        // Fed by the emulator while running, see the prof command
+        GuestProfiler<State> profiler;
+
     private:
         bool stepMode = false;
         Byte lastKnownAddressIndex = 0;
@@ -328,9 +341,12 @@ public:
             output.printLine(lock, "w: watch executing program memory");
             output.printLine(lock, "[hex]: inspect memory page containing address [hex]");
             output.printLine(lock, "v [hex]: inspect videoProcessor memory containing address [hex]");
+            output.printLine(lock, "o [oam|bg1-4|obj1-4|mode7]: toggle video viewer");
             output.printLine(lock, "[p|s|a|x|y|d|f]=[hex]: set register to [hex]");
             output.printLine(lock, "[a]=[hex]: set address [a] to [hex]");
             output.printLine(lock, "s: switch contexts");
+            output.printLine(lock, "log: reload log levels from the log config file");
+            output.printLine(lock, "prof: start or stop profiling the current context, stopping prints the hottest code and writes its folded call stacks");
         }
         else if (command == "n")
         {
@@ -452,6 +468,26 @@ public:
                 output.error("Not a valid value: ", e.what());
             }
         }
+        else if (command.substr(0, 2) == "o ")
+        {
+            toggleViewer(command.substr(2));
+        }
+        else if (command == "log")
+        {
+            try
+            {
+                output.getSystem().reloadLogConfig();
+                output.info("Reloaded log levels");
+            }
+            catch (const std::exception& e)
+            {
+                output.error("Failed to reload log levels: ", e.what());
+            }
+        }
+        else if (command == "prof")
+        {
+            toggleProfiler(context);
+        }
         else if (command == "w")
         {
             context.watchMode = !context.watchMode;
@@ -695,14 +731,7 @@ public:
                     bool bright = false;
                     setColor(spcState, spcContext, spcAddress, access, color, bright);
                     Output::ColorScope outputColor(lock, output, color, bright);
-                    if (spcAddress >= 0xffc0 && audioRegisters.bootRomDataEnabled)
-                    {
-                        output.print(lock, audioRegisters.bootRomData[spcAddress - 0xffc0], ' ');
-                    }
-                    else
-                    {
-                        output.print(lock, access, ' ');
-                    }
+                    output.print(lock, access, ' ');
                     ++spcAddress;
                 }
             }
@@ -767,6 +796,80 @@ public:
         return paused;
     }
 
+    void toggleViewer(const std::string& name)
+    {
+        auto it = viewers.find(name);
+        if (it != viewers.end())
+        {
+            viewers.erase(it);
+            output.info("Closed viewer ", name);
+            return;
+        }
+        std::unique_ptr<Video::Viewer> viewer = Video::Viewer::create(videoProcessor, name);
+        if (!viewer)
+        {
+            output.error("No viewer named ", name);
+            return;
+        }
+        viewer->open();
+        viewer->offerSnapshot(true);
+        viewers.emplace(name, std::move(viewer));
+        output.info("Opened viewer ", name);
+    }
+
+    template<typename State>
+    void toggleProfiler(Context<State>& context)
+    {
+        GuestProfiler<State>& profiler = context.profiler;
+        if (!profiler.isRunning())
+        {
+            profiler.start();
+            output.info("Profiling ", GuestProfilerTraits<State>::name);
+            return;
+        }
+        profiler.stop();
+
+        std::ostringstream report;
+        profiler.writeReport(report, 20);
+        {
+            Output::Lock lock(output);
+            std::string line;
+            for (std::istringstream lines(report.str()); std::getline(lines, line);)
+            {
+                output.printLine(lock, line);
+            }
+        }
+
+        const std::string path = std::string(GuestProfilerTraits<State>::name) + ".folded";
+        std::ofstream file(path);
+        profiler.writeFoldedStacks(file);
+        if (file)
+        {
+            output.info("Wrote call stacks to ", path);
+        }
+        else
+        {
+            output.error("Failed to write call stacks to ", path);
+        }
+    }
+
+    // At the end of every frame. Nothing happens unless a viewer is open.
+    void updateViewers()
+    {
+        for (auto it = viewers.begin(); it != viewers.end();)
+        {
+            if (it->second->isWindowClosed())
+            {
+                it = viewers.erase(it);
+            }
+            else
+            {
+                it->second->offerSnapshot(false);
+                ++it;
+            }
+        }
+    }
+
     std::time_t startTime = 0LL;
 
 private:
@@ -781,4 +884,6 @@ private:
     bool& running;
     Word inspectedVideoMemory = 0x0;
     bool paused = false;
+
+    std::map<std::string, std::unique_ptr<Video::Viewer>> viewers;
 };
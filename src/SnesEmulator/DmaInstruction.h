@@ -92,6 +92,7 @@ public:
                     }
                     channel.dataSize -= byteCount;
                     cycles += byteCount;
+                    transferredBytes += byteCount;
 
                     if (channel.dataSize == 0) {
                         registers.dmaEnabled.setBit(i, false);
@@ -147,9 +148,19 @@ public:
     {
     }
 
+    // The channels are saved with the registers, the blocked instruction is set anew before each execution
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        archive(iteration);
+    }
+
 public:
     Instruction<CPU::State>* blockedInstruction = nullptr;
 
+    // Since power-on, for the frame telemetry. Not part of the state.
+    uint64_t transferredBytes = 0;
+
 private:
     CPU::State::MemoryType& memory;
     Video::Registers& registers;
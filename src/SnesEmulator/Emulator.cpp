@@ -1,17 +1,18 @@
 #include "Emulator.h"
 
+#include <chrono>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
 #include <string>
 
 #include "Common/Exception.h"
+#include "Common/Hash.h"
 #include "Common/Memory.h"
 
 #include "VideoDebugger.h"
 
-#include "DmaInstruction.h"
-#include "HdmaInstruction.h"
-
 #define PROFILING_ENABLED false
 
 #include "Profiler.h"
@@ -29,113 +30,134 @@ void Emulator::initialize()
 
     CPU::State::MemoryType& cpuMemory = cpuState.getMemory();
 
-    if (rom.isLowRom())
+    const Mapper::BankTable bankTable = rom.getBankTable();
+
+    output.debug("Memory map: ", rom.getMapper().getName());
+
+    // RAM
+    cpuMemory.mapRegion(Long(0x7e0000), std::make_shared<MemoryRegion>(wram), 0, uint32_t(wram.size()));
+
+    // I/O between the CPU and SPC700
+    for (Word i = 0; i < 4; ++i)
+    {
+        cpuMemory.createLocation<ReadWriteRegister>(Long(0x2140 + i),
+            [this, i](Byte& value)
+            {
+                value = spcToCpuBuffers[i];
+            },
+            [this, i](Byte, Byte newValue)
+            {
+                cpuToSpcBuffers[i] = newValue;
+            }
+        );
+    }
+
+    // RAM and register mirrors in the system banks, $00-$3F and $80-$BF
+    for (uint32_t bank = 0; bank < 0x100; ++bank)
     {
-        // RAM
-        for (Long address = 0x7e0000; address < 0x800000; address++)
+        if (bank & 0x40)
         {
-            cpuMemory.createLocation<ReadWriteMemory>(address, Byte(0x55));
+            continue;
         }
-
-        // RAM mirrors
-        for (Byte bank = 0; bank < 0x40; ++bank)
+        cpuMemory.createMirrors(Long(Word(0x0000), Byte(bank)), Long(Word(0x0000), Byte(0x7e)), 0x2000);
+        if (bank != 0)
         {
-            for (Word address = 0; address < 0x2000; ++address)
-            {
-                cpuMemory.createMirror(Long(address, bank), Long(address, 0x7E));
-            }
+            cpuMemory.createMirrors(Long(Word(0x2000), Byte(bank)), Long(Word(0x2000), Byte(0x00)), 0x4000);
         }
+    }
 
-        // I/O between the CPU and SPC700
-        for (Word i = 0; i < 4; ++i)
+    // Access speeds in master cycles: the system area as fixed by the CPU, the cartridge banks
+    // from $80 on fast when FastROM is selected through $420D
+    for (uint32_t bank = 0; bank < bankTable.size(); ++bank)
+    {
+        const uint8_t cartridgeFastCycles = bankTable[bank].fastRom ? 6 : 8;
+        if (bank & 0x40)
         {
-            cpuMemory.createLocation<ReadWriteRegister>(Long(0x2140 + i),
-                [this, i](Byte& value)
-                {
-                    value = spcToCpuBuffers[i];
-                },
-                [this, i](Byte, Byte newValue)
-                {
-                    cpuToSpcBuffers[i] = newValue;
-                }
-            );
+            cpuMemory.setAccessCycles(Long(Word(0x0000), Byte(bank)), 0x10000, 8, cartridgeFastCycles);
         }
-
-        // Register mirrors
-        for (Byte bank = 0x01; bank < 0x60; ++bank)
+        else
         {
-            for (Word address = 0x2000; address < 0x8000; ++address)
-            {
-                cpuMemory.createMirror(Long(address, bank), Long(address, 0x00));
-            }
+            cpuMemory.setAccessCycles(Long(Word(0x0000), Byte(bank)), 0x2000, 8, 8);
+            cpuMemory.setAccessCycles(Long(Word(0x2000), Byte(bank)), 0x2000, 6, 6);
+            cpuMemory.setAccessCycles(Long(Word(0x4000), Byte(bank)), 0x0200, 12, 12);
+            cpuMemory.setAccessCycles(Long(Word(0x4200), Byte(bank)), 0x1e00, 6, 6);
+            cpuMemory.setAccessCycles(Long(Word(0x6000), Byte(bank)), 0x2000, 8, 8);
+            cpuMemory.setAccessCycles(Long(Word(0x8000), Byte(bank)), 0x8000, 8, cartridgeFastCycles);
         }
+    }
 
-        // ROM mirrors
-        for (Long address = 0; address < 0x600000; ++address)
+    // Save RAM
+    if (rom.saveRamSize > 0)
+    {
+        if (playingMovie)
         {
-            cpuMemory.createMirror(address + 0x800000, address);
+            saveRamSaver.assign(playbackMovie->saveRam);
         }
-
-        // Save RAM
+        else if (headless)
+        {
+            saveRamSaver.clear(Byte());
+        }
+        else
+        {
+            saveRamSaver.load(Byte());
+        }
+        // Where each save RAM byte was mapped first, every later appearance mirrors it, in runs
+        // so that whole mirrored pages share the locations of the first
+        std::vector<Long> origins(rom.saveRamSize);
+        std::vector<bool> mapped(rom.saveRamSize);
+        for (uint32_t bank = 0; bank < bankTable.size(); ++bank)
         {
-            if (rom.saveRamSize > 0)
+            const BankDescriptor& descriptor = bankTable[bank];
+            for (uint32_t offset = descriptor.saveRamStart; offset < descriptor.saveRamEnd; )
             {
-                std::ifstream file(System::getRomLibraryPath() / (rom.gameTitle + ".save"));
-                file >> std::hex;
-                Long saveRamAddress = 0x700000;
-                for (Long address = saveRamAddress; address < 0x7e0000; ++address, ++saveRamAddress)
+                const Long address = Long(Word(offset), Byte(bank));
+                const uint32_t localAddress = (descriptor.saveRamOffset + offset - descriptor.saveRamStart) % rom.saveRamSize;
+                if (mapped[localAddress])
                 {
-                    if (saveRamAddress == Long(0x700000 + rom.saveRamSize))
+                    const Long origin = origins[localAddress];
+                    uint32_t size = 1;
+                    while (offset + size < descriptor.saveRamEnd && localAddress + size < rom.saveRamSize
+                        && mapped[localAddress + size] && origins[localAddress + size] == Long(origin + size))
                     {
-                        saveRamAddress = 0x700000;
+                        ++size;
                     }
-                    if (address == saveRamAddress)
+                    cpuMemory.createMirrors(address, origin, size);
+                    offset += size;
+                    continue;
+                }
+                cpuMemory.createLocation<ReadWriteRegister>(address,
+                    [this, localAddress](Byte& value)
                     {
-                        Byte byte;
-                        int inputValue;
-                        if (file >> inputValue)
-                        {
-                            byte = Byte(inputValue);
-                        }
-                        Long localAddress = address - 0x700000;
-                        saveRamSaver.saveRam[localAddress] = byte;
-                        cpuMemory.createLocation<ReadWriteRegister>(address,
-                            [this, localAddress](Byte& value)
-                            {
-                                value = saveRamSaver.saveRam[localAddress];
-                            },
-                            [this, localAddress](Byte oldValue, Byte newValue)
-                            {
-                                if (oldValue != saveRamSaver.saveRam[localAddress])
-                                {
-                                    std::stringstream ss;
-                                    ss << __FUNCTION__ << ": ";
-                                    ss << "oldValue=" << oldValue << " != saveRamSaver.saveRam[address]=" << saveRamSaver.saveRam[localAddress];
-                                    ss << " @" << localAddress << std::endl;
-                                    throw std::logic_error(ss.str());
-                                }
-                                if (newValue != saveRamSaver.saveRam[localAddress])
-                                {
-                                    saveRamSaver.saveRam[localAddress] = newValue;
-                                    std::scoped_lock<std::mutex> lock(saveRamSaver.mutex);
-                                    saveRamSaver.saveRamModified = true;
-                                }
-                                saveRamSaver.condition.notify_one();
-                            },
-                            byte);
-                    }
-                    else
+                        value = saveRamSaver.read(localAddress);
+                    },
+                    [this, localAddress](Byte, Byte newValue)
                     {
-                        cpuMemory.createMirror(address, saveRamAddress);
-                    }
-                }
-                output.debug("Save RAM end address: ", saveRamAddress);
+                        // The save RAM is the authority, not the last written value, as loading a state replaces it
+                        saveRamSaver.write(localAddress, newValue);
+                    },
+                    saveRamSaver.read(localAddress));
+                origins[localAddress] = address;
+                mapped[localAddress] = true;
+                ++offset;
             }
         }
     }
+
+    // Controllers
+    if (playingMovie)
+    {
+        input = std::make_unique<PlaybackInputSource>(output, std::move(playbackMovie));
+    }
     else
     {
-        throw std::runtime_error("Only the low-rom mempory map is supported for now");
+        input = std::make_unique<LiveInputSource>(videoProcessor.renderer);
+        if (!recordingPath.empty())
+        {
+            const std::vector<Byte> powerOnSaveRam(saveRamSaver.data(), saveRamSaver.data() + saveRamSaver.size());
+            std::unique_ptr<RecordingInputSource> recording = std::make_unique<RecordingInputSource>(output, std::move(input), recordingPath, rom.computeHash(), powerOnSaveRam);
+            recorder = recording.get();
+            input = std::move(recording);
+        }
     }
 
     videoProcessor.initialize(rom.gameTitle);
@@ -146,53 +168,58 @@ void Emulator::initialize()
 
     cpuState.reset();
 
-    debugger.loadBreakpoints(cpuContext, cpuState);
+    if (!headless)
+    {
+        debugger.loadBreakpoints(cpuContext, cpuState);
+    }
 
     cpuContext.nextInstruction = cpuInstructionDecoder.getNextInstruction(cpuState);
 
-    saveRamSaverThread = std::thread(std::ref(saveRamSaver));
+    if (!headless && !playingMovie)
+    {
+        saveRamSaver.start();
+    }
+
+    // Done here rather than in run, which may be called again to continue with more frames
+    nextCpu = masterCycle;
+    nextSpc = masterCycle;
+    nextAudioTick = masterCycle;
+    videoRegisters.hCounter = int(masterCycle.count());
+    nmiRequested = false;
+    irqRequested = false;
 
     isInitialized = true;
 }
 
 void Emulator::run()
 {
-    Video::OamViewer oamViewer(videoProcessor, 1080, 760);
-    Video::BackgroundViewer background1Viewer(videoProcessor, Video::Layer::Background1, 0, 10);
-    Video::BackgroundViewer background2Viewer(videoProcessor, Video::Layer::Background2, Video::rendererWidth * 2 + 20, 10);
-    Video::BackgroundViewer background3Viewer(videoProcessor, Video::Layer::Background3, 0, Video::rendererWidth * 2 + 20);
-    Video::BackgroundViewer background4Viewer(videoProcessor, Video::Layer::Background4, Video::rendererWidth * 2, Video::rendererWidth * 2 + 20);
-    Video::SpriteLayerViewer spriteLayer1Viewer(videoProcessor, 0, Video::rendererWidth * 2 + 20, Video::rendererWidth * 2 + 40);
-    Video::SpriteLayerViewer spriteLayer2Viewer(videoProcessor, 1, Video::rendererWidth * 2 + 20 + Video::rendererWidth + 20, Video::rendererWidth * 2 + 40);
-    Video::SpriteLayerViewer spriteLayer3Viewer(videoProcessor, 2, Video::rendererWidth * 2 + 20, Video::rendererWidth * 2 + 40 + Video::rendererWidth);
-    Video::SpriteLayerViewer spriteLayer4Viewer(videoProcessor, 3, Video::rendererWidth * 2 + 20 + Video::rendererWidth + 20, Video::rendererWidth * 2 + 40 + Video::rendererWidth);
-    Video::Mode7Viewer mode7Viewer(videoProcessor, 0, 40);
-
-    DmaInstruction dmaInstruction(output, cpuState, videoRegisters);
-    HdmaInstruction hdmaInstruction(output, cpuState, videoRegisters);
-
-    CycleCount nextCpu = masterCycle;
-    CycleCount nextSpc = masterCycle;
-    CycleCount nextAudioTick = masterCycle;
+    GlobalProfiler::Binding profilerBinding(profiler);
+
     CycleCount lostCycles(0);
     CycleCount oneCycle(1);
 
     //uint64_t audioCycle = 0;
 
-    videoRegisters.hCounter = int(masterCycle.count());
-
-    bool nmiRequested = false;
-    bool irqRequested = false;
-
     //cpuContext.setPaused(true);
 
-    double runStartTime = 0.0;
+    FrameTelemetry::Session telemetrySession(telemetry);
+
+    // The frame being measured, kept per run rather than in statics as several emulators may run at once
+    FrameRecord frameRecord;
+    std::chrono::steady_clock::time_point frameStartTime = std::chrono::steady_clock::now();
+    uint64_t frameStartTicks = GlobalProfiler::readTimestampCounter();
+    uint64_t ppuTicks = 0;
+    uint64_t dspTicks = 0;
+    uint64_t waitTicks = 0;
+    CycleCount frameStartCycle = masterCycle;
+    uint64_t frameStartIteration = 0;
+    uint64_t frameStartDmaBytes = dmaInstruction.transferredBytes + hdmaInstruction.transferredBytes;
+    std::chrono::steady_clock::time_point previousProfileReportTime = frameStartTime;
     //uint64_t cycleCountDelta = 0;
     bool stepMode = debugger.isPaused();
     if (!stepMode)
     {
         debugger.startTime = clock();
-        runStartTime = videoProcessor.renderer.getTime();
     }
     stepMode = true;
 
@@ -203,74 +230,178 @@ void Emulator::run()
     //bool dmaActive = false;
     while (running)
     {
+        if (headless && debugger.isPaused())
+        {
+            throw RuntimeError("Emulation stopped in frame ", videoRegisters.frame);
+        }
+
         try
         {
             if (masterCycle == nextCpu)
             {
-                if (nmiRequested)
+                // In master cycles, the idle loop detector keeps the time each instruction took
+                int idleCycles = 0;
+                if (cpuState.isWaitingForInterrupt())
                 {
-                    nmiRequested = false;
-                    cpuState.startInterrupt(true);
-                    nextCpu += CycleCount(9 * 8); // TODO: check the correct cycles for interrupt
+                    if (nmiRequested || irqRequested)
+                    {
+                        cpuState.setWaitingForInterrupt(false);
+                    }
+                    else if (!dmaInstruction.enabled() && !hdmaInstruction.isActive())
+                    {
+                        // Stopped by WAI, nothing happens until the next interrupt or DMA. Only
+                        // the CPU can start DMA through $420B, so the next thing that can happen
+                        // is a video event, and the 6 cycle steps up to it are passed at once.
+                        idleCycles = (getCyclesToVideoEvent() + 5) / 6 * 6;
+                    }
                 }
-                else if (irqRequested && !cpuState.getFlag(CPU::State::Flag::i) && !cpuState.isNmiActive())
+                else if (nmiRequested || irqRequested || dmaInstruction.enabled() || hdmaInstruction.isActive() || cpuContext.isStepMode() || cpuContext.hasBreakpoints())
                 {
-                    irqRequested = false;
-                    cpuState.startInterrupt(false);
-                    nextCpu += CycleCount(9 * 8); // TODO: check the correct cycles for interrupt
+                    cpuIdleLoop.wake();
                 }
-
-                Instruction<CPU::State>* instruction = cpuInstructionDecoder.getNextInstruction(cpuState);
-
-                bool dmaPicked = false;
-                if (dmaInstruction.enabled())
+                else
                 {
-                    //cpuContext.setPaused(true);
-                    dmaInstruction.blockedInstruction = instruction;
-                    instruction = static_cast<Instruction<CPU::State>*>(&dmaInstruction);
-                    dmaPicked = true;
-                    if (!videoRegisters.vBlank)
+                    idleCycles = cpuIdleLoop.skip();
+                    if (idleCycles)
                     {
-                        //output << "DMA not during V blank" << std::endl;
-                        //cpuContext.stepMode = true;
+                        // What the loop polls changes at video events, and the APU ports when
+                        // the SPC runs, which may be on a thread of its own. The instructions
+                        // that start before then are passed over without checking the inputs.
+                        int quietCycles = getCyclesToVideoEvent();
+                        if (cpuIdleLoop.polls(isApuPort))
+                        {
+                            quietCycles = audioSystem.threaded ? 0 : std::min(quietCycles, int((nextSpc - masterCycle).count()) + 1);
+                        }
+                        idleCycles += cpuIdleLoop.skipWithin(quietCycles - idleCycles);
                     }
                 }
 
-                if (hdmaInstruction.isActive())
+                ++frameRecord.cpuSteps;
+                if (idleCycles)
                 {
-                    hdmaInstruction.blockedInstruction = instruction;
-                    instruction = static_cast<Instruction<CPU::State>*>(&hdmaInstruction);
-                    if (dmaPicked)
+                    nextCpu += CycleCount(idleCycles);
+                    if (cpuContext.profiler.isRunning())
                     {
-                        output.info("HDMA interrupts DMA");
+                        cpuContext.profiler.countIdleCycles(cpuState, idleCycles);
                     }
                 }
+                else
+                {
+                    // Interrupts and DMA break the instruction flow the idle loop detector follows
+                    bool resynchronize = false;
 
-                cpuContext.nextInstruction = instruction;
+                    if (nmiRequested)
+                    {
+                        nmiRequested = false;
+                        const Word stackPointer = cpuState.getStackPointer();
+                        cpuState.startInterrupt(true);
+                        ++frameRecord.interrupts;
+                        if (cpuContext.profiler.isRunning())
+                        {
+                            cpuContext.profiler.enterInterrupt(cpuState, stackPointer);
+                        }
+                        nextCpu += CycleCount(9 * 8); // TODO: check the correct cycles for interrupt
+                        resynchronize = true;
+                    }
+                    else if (irqRequested && !cpuState.getFlag(CPU::State::Flag::i) && !cpuState.isNmiActive())
+                    {
+                        irqRequested = false;
+                        const Word stackPointer = cpuState.getStackPointer();
+                        cpuState.startInterrupt(false);
+                        ++frameRecord.interrupts;
+                        if (cpuContext.profiler.isRunning())
+                        {
+                            cpuContext.profiler.enterInterrupt(cpuState, stackPointer);
+                        }
+                        nextCpu += CycleCount(9 * 8); // TODO: check the correct cycles for interrupt
+                        resynchronize = true;
+                    }
 
-                instruction->applyBreakpoints(cpuState);
+                    Instruction<CPU::State>* instruction = cpuInstructionDecoder.getNextInstruction(cpuState);
 
-                if (cpuContext.isStepMode())
-                {
-                    output.debug("Cycle count: ", masterCycle.count(), ", Next cpu: ", nextCpu.count(), ", Next spc: ", nextSpc.count());
-                    output.debug("Frame: ", videoRegisters.frame, ", V counter: ", videoRegisters.vCounter, ", H counter: ", videoRegisters.hCounter, ", V blank: ", videoRegisters.vBlank, ", H blank: ", videoRegisters.hBlank, ", nmi: ", cpuState.isNmiActive(), ", irq: ", cpuState.isIrqActive());
-                    debugger.printBreakpoints(cpuContext, audioSystem.context);
-                    debugger.printMemory(cpuState, cpuContext, audioSystem.state, audioSystem.context);
-                }
+                    bool dmaPicked = false;
+                    if (dmaInstruction.enabled())
+                    {
+                        //cpuContext.setPaused(true);
+                        dmaInstruction.blockedInstruction = instruction;
+                        instruction = static_cast<Instruction<CPU::State>*>(&dmaInstruction);
+                        dmaPicked = true;
+                        resynchronize = true;
+                        if (!videoRegisters.vBlank)
+                        {
+                            //output << "DMA not during V blank" << std::endl;
+                            //cpuContext.stepMode = true;
+                        }
+                    }
 
-                int cycles = 0;
-                {
-                    PROFILE_SCOPE("Execute CPU Instruction");
-                    cycles = executeNext(instruction, cpuState, debugger, cpuContext, audioSystem.state, audioSystem.context, output);
-                }
-                if (cycles)
-                {
-                    nextCpu += CycleCount(cycles * 6);
-                    cpuContext.nextInstruction = cpuInstructionDecoder.getNextInstruction(cpuState);
-                }
-                else
-                {
-                    continue;
+                    if (hdmaInstruction.isActive())
+                    {
+                        hdmaInstruction.blockedInstruction = instruction;
+                        instruction = static_cast<Instruction<CPU::State>*>(&hdmaInstruction);
+                        resynchronize = true;
+                        if (dmaPicked)
+                        {
+                            output.info("HDMA interrupts DMA");
+                        }
+                    }
+
+                    cpuContext.nextInstruction = instruction;
+
+                    instruction->applyBreakpoints(cpuState);
+
+                    if (cpuContext.isStepMode())
+                    {
+                        LOG_DEBUG(output, "Cycle count: ", masterCycle.count(), ", Next cpu: ", nextCpu.count(), ", Next spc: ", nextSpc.count());
+                        LOG_DEBUG(output, "Frame: ", videoRegisters.frame, ", V counter: ", videoRegisters.vCounter, ", H counter: ", videoRegisters.hCounter, ", V blank: ", videoRegisters.vBlank, ", H blank: ", videoRegisters.hBlank, ", nmi: ", cpuState.isNmiActive(), ", irq: ", cpuState.isIrqActive());
+                        debugger.printBreakpoints(cpuContext, audioSystem.context);
+                        debugger.printMemory(cpuState, cpuContext, audioSystem.state, audioSystem.context);
+                    }
+
+                    // DMA is not guest code, it is left out of the profile
+                    const bool profiling = cpuContext.profiler.isRunning() && instruction != &dmaInstruction && instruction != &hdmaInstruction;
+                    if (profiling)
+                    {
+                        cpuContext.profiler.beginInstruction(cpuState, instruction);
+                    }
+
+                    int cycles = 0;
+                    CPU::State::MemoryType::AccessTime accessTime;
+                    {
+                        PROFILE_SCOPE("Execute CPU Instruction");
+                        cpuState.getMemory().takeAccessTime();
+                        cycles = executeNext(instruction, cpuState, debugger, cpuContext, audioSystem.state, audioSystem.context, output);
+                        accessTime = cpuState.getMemory().takeAccessTime();
+                    }
+
+                    // Every bus access takes the time of the region it goes to, the remaining
+                    // internal cycles 6 master cycles each. DMA is still counted in CPU cycles.
+                    int masterCycles = cycles * 6;
+                    if (cycles && instruction != &dmaInstruction && instruction != &hdmaInstruction)
+                    {
+                        masterCycles = int(accessTime.cycles) + std::max(cycles - int(accessTime.count), 0) * 6;
+                    }
+
+                    if (resynchronize)
+                    {
+                        cpuIdleLoop.wake();
+                    }
+                    else
+                    {
+                        cpuIdleLoop.update(masterCycles);
+                    }
+                    if (cycles)
+                    {
+                        if (profiling)
+                        {
+                            cpuContext.profiler.endInstruction(cpuState, masterCycles);
+                        }
+                        nextCpu += CycleCount(masterCycles);
+                        cpuContext.nextInstruction = cpuInstructionDecoder.getNextInstruction(cpuState);
+                    }
+                    else
+                    {
+                        continue;
+                    }
                 }
             }
 
@@ -292,27 +423,78 @@ void Emulator::run()
             {
                 if (masterCycle == nextSpc)
                 {
-                    Instruction<SPC::State>* instruction = audioSystem.instructionDecoder.getNextInstruction(audioSystem.state);
-                    audioSystem.context.nextInstruction = instruction;
+                    ++frameRecord.spcSteps;
+                    int cycles = 0;
+                    if (audioSystem.context.isStepMode() || audioSystem.context.hasBreakpoints())
+                    {
+                        audioSystem.idleLoop.wake();
 
-                    instruction->applyBreakpoints(audioSystem.state);
+                        Instruction<SPC::State>* instruction = audioSystem.instructionDecoder.getNextInstruction(audioSystem.state);
+                        audioSystem.context.nextInstruction = instruction;
 
-                    if (audioSystem.context.isStepMode())
-                    {
-                        output.debug("cycleCount=", masterCycle.count(), ", nextCpu=", nextCpu.count(), ", nextSpc=", nextSpc.count());
-                        debugger.printBreakpoints(cpuContext, audioSystem.context);
-                        debugger.printMemory(cpuState, cpuContext, audioSystem.state, audioSystem.context);
-                    }
+                        instruction->applyBreakpoints(audioSystem.state);
+
+                        if (audioSystem.context.isStepMode())
+                        {
+                            LOG_DEBUG(output, "cycleCount=", masterCycle.count(), ", nextCpu=", nextCpu.count(), ", nextSpc=", nextSpc.count());
+                            debugger.printBreakpoints(cpuContext, audioSystem.context);
+                            debugger.printMemory(cpuState, cpuContext, audioSystem.state, audioSystem.context);
+                        }
 
-                    int cycles = 0;
-                    {
                         //PROFILE_SCOPE("Execute SPC Instruction");
+                        audioSystem.beginProfiledInstruction(instruction);
                         cycles = executeNext(instruction, audioSystem.state, debugger, audioSystem.context, cpuState, cpuContext, output);
+                        audioSystem.endProfiledInstruction(cycles);
+                        audioSystem.idleLoop.update(cycles);
+                        if (cycles)
+                        {
+                            audioSystem.context.nextInstruction = audioSystem.instructionDecoder.getNextInstruction(audioSystem.state);
+                        }
+                    }
+                    else
+                    {
+                        cycles = audioSystem.idleLoop.skip();
+                        if (cycles == 0)
+                        {
+                            Instruction<SPC::State>* instruction = audioSystem.instructionDecoder.getNextInstruction(audioSystem.state);
+                            audioSystem.context.nextInstruction = instruction;
+                            audioSystem.beginProfiledInstruction(instruction);
+                            cycles = executeNext(instruction, audioSystem.state, debugger, audioSystem.context, cpuState, cpuContext, output);
+                            audioSystem.endProfiledInstruction(cycles);
+                            audioSystem.idleLoop.update(cycles);
+                            if (cycles)
+                            {
+                                audioSystem.context.nextInstruction = audioSystem.instructionDecoder.getNextInstruction(audioSystem.state);
+                            }
+                        }
+                        else
+                        {
+                            // What the loop polls changes when a polled timer output counts up,
+                            // which the DSP ticks after the SPC steps of the same cycle, and when
+                            // the CPU writes a port, which it does before them. The instructions
+                            // that start before then are passed over without checking the inputs,
+                            // up to the next video event at most, where the frame may end.
+                            int64_t quietCycles = getCyclesToVideoEvent();
+                            const uint64_t maxTicks = uint64_t(quietCycles) / 21 + 2;
+                            const uint64_t ticks = audioSystem.getTicksToPolledTimerOutput(maxTicks);
+                            if (ticks < maxTicks)
+                            {
+                                quietCycles = std::min(quietCycles, int64_t((nextAudioTick - masterCycle).count()) + int64_t(ticks - 1) * 21 + 1);
+                            }
+                            if (audioSystem.idleLoop.polls(AudioSystem::isCpuPort))
+                            {
+                                quietCycles = std::min(quietCycles, int64_t((nextCpu - masterCycle).count()));
+                            }
+                            cycles += audioSystem.idleLoop.skipWithin(int((quietCycles + 15) / 16) - cycles);
+                            if (audioSystem.context.profiler.isRunning())
+                            {
+                                audioSystem.context.profiler.countIdleCycles(audioSystem.state, cycles);
+                            }
+                        }
                     }
                     if (cycles)
                     {
                         nextSpc += CycleCount(cycles * 16);
-                        audioSystem.context.nextInstruction = audioSystem.instructionDecoder.getNextInstruction(audioSystem.state);
                     }
                     else
                     {
@@ -360,7 +542,9 @@ void Emulator::run()
             }
             if (!audioSystem.threaded && masterCycle == nextAudioTick)
             {
+                const uint64_t startTicks = GlobalProfiler::readTimestampCounter();
                 audioSystem.tick();
+                dspTicks += GlobalProfiler::readTimestampCounter() - startTicks;
                 nextAudioTick += CycleCount(21);
             }
 
@@ -377,7 +561,9 @@ void Emulator::run()
                         if (videoRegisters.vCounter > 0)
                         {
                             //PROFILE_SCOPE("draw scanline");
+                            const uint64_t startTicks = GlobalProfiler::readTimestampCounter();
                             videoProcessor.drawScanline(videoRegisters.vCounter);
+                            ppuTicks += GlobalProfiler::readTimestampCounter() - startTicks;
                         }
                         if (hdmaInstruction.enabled() && !hdmaInstruction.isActive())
                         {
@@ -386,52 +572,60 @@ void Emulator::run()
                     }
                     if (videoRegisters.vCounter == 224)
                     {
-                        static std::chrono::steady_clock::time_point previousTime = std::chrono::steady_clock::now();
-                        static uint32_t frameCount = 0;
-                        static uint32_t totalFrameCount = 0;
-
-                        std::chrono::steady_clock::time_point currentTime = std::chrono::steady_clock::now();
-                        ++frameCount;
-                        ++totalFrameCount;
-                        static uint32_t minFrameCount = uint32_t(-1);
-                        static uint32_t maxFrameCount = 0;
-                        static int printOuts = 0;
-                        if (currentTime - previousTime >= std::chrono::seconds(1))
+                        const std::chrono::steady_clock::time_point currentTime = std::chrono::steady_clock::now();
+                        const uint64_t currentTicks = GlobalProfiler::readTimestampCounter();
+                        const uint64_t dmaBytes = dmaInstruction.transferredBytes + hdmaInstruction.transferredBytes;
+
+                        // The stages are timed in timestamp counter ticks, which are cheaper to
+                        // read, and converted by the ratio of ticks to time over the whole frame
+                        frameRecord.frame = videoRegisters.frame;
+                        frameRecord.wallTime = std::chrono::duration_cast<FrameRecord::Duration>(currentTime - frameStartTime);
+                        const double nanosecondsPerTick = currentTicks > frameStartTicks ? double(frameRecord.wallTime.count()) / double(currentTicks - frameStartTicks) : 0.0;
+                        frameRecord.ppuTime = FrameRecord::Duration(int64_t(ppuTicks * nanosecondsPerTick));
+                        frameRecord.dspTime = FrameRecord::Duration(int64_t(dspTicks * nanosecondsPerTick));
+                        frameRecord.waitTime = FrameRecord::Duration(int64_t(waitTicks * nanosecondsPerTick));
+                        frameRecord.cpuTime = std::max(frameRecord.wallTime - frameRecord.ppuTime - frameRecord.dspTime - frameRecord.waitTime, FrameRecord::Duration(0));
+                        frameRecord.dmaBytes = uint32_t(dmaBytes - frameStartDmaBytes);
+                        frameRecord.audioFill = uint32_t(audioSystem.getOutputFill());
+                        frameRecord.masterCycles = uint64_t((masterCycle - frameStartCycle).count());
+                        frameRecord.iterations = iteration - frameStartIteration;
+                        frameRecord.lostCycles = lostCycles.count();
+                        telemetry.push(frameRecord);
+
+                        saveRamSaver.update();
+
+                        frameRecord = FrameRecord();
+                        frameStartTime = currentTime;
+                        frameStartTicks = currentTicks;
+                        ppuTicks = 0;
+                        dspTicks = 0;
+                        waitTicks = 0;
+                        frameStartCycle = masterCycle;
+                        frameStartIteration = iteration;
+                        frameStartDmaBytes = dmaBytes;
+
+                        if (currentTime - previousProfileReportTime >= std::chrono::seconds(10))
                         {
-                            minFrameCount = std::min(minFrameCount, frameCount);
-                            maxFrameCount = std::max(maxFrameCount, frameCount);
-
-                            output.debug("FPS: ", frameCount);
-
-                            frameCount = 0;
-                            previousTime = currentTime;
-
-                            if (++printOuts % 10 == 0)
-                            {
-                                double elapsedTime = videoProcessor.renderer.getTime() - runStartTime;
-                                output.debug("Avg. FPS: ", (totalFrameCount / elapsedTime));
-                                output.debug("Min. FPS: ", minFrameCount);
-                                output.debug("Max. FPS: ", maxFrameCount);
-
-                                GlobalProfiler::get().printEntries(output);
-                            }
+                            profiler.printEntries(output);
+                            previousProfileReportTime = currentTime;
                         }
 
                         //videoProcessor.renderer.update();
 
-                        oamViewer.update();
-                        background1Viewer.update();
-                        background2Viewer.update();
-                        background3Viewer.update();
-                        background4Viewer.update();
-                        spriteLayer1Viewer.update();
-                        spriteLayer2Viewer.update();
-                        spriteLayer3Viewer.update();
-                        spriteLayer4Viewer.update();
-                        mode7Viewer.update();
+                        debugger.updateViewers();
 
                         videoProcessor.renderer.swapPixelBuffers();
 
+                        if (outputHashing)
+                        {
+                            hashOutput();
+                        }
+
+                        if (frameListener)
+                        {
+                            frameListener(videoRegisters.frame, videoProcessor.renderer.getCompletedFrame());
+                        }
+
                         std::this_thread::yield();
                     }
                     videoRegisters.hBlank = true;
@@ -458,7 +652,7 @@ void Emulator::run()
                     }
                     else if (videoRegisters.vCounter == 227)
                     {
-                        videoRegisters.readControllers();
+                        videoRegisters.readControllers(input->read(videoRegisters.frame));
                     }
                     else if (videoRegisters.vCounter == 262)
                     {
@@ -468,7 +662,40 @@ void Emulator::run()
                             debugger.pause(cpuContext);
                         }
 
+                        if (videoProcessor.renderer.saveStateRequested)
+                        {
+                            videoProcessor.renderer.saveStateRequested = false;
+                            saveStateToFile();
+                        }
+
+                        if (videoProcessor.renderer.loadStateRequested)
+                        {
+                            videoProcessor.renderer.loadStateRequested = false;
+                            loadStateFromFile();
+                            // Let the pacing against the audio clock continue from the loaded cycle
+                            lostCycles = std::chrono::duration_cast<CycleCount>(audioSystem.elapsedTime) - masterCycle;
+                        }
+
+                        if (videoProcessor.renderer.rewindRequested)
+                        {
+                            if (rewindBuffer.pop(rewindState))
+                            {
+                                loadState(rewindState);
+                                lostCycles = std::chrono::duration_cast<CycleCount>(audioSystem.elapsedTime) - masterCycle;
+                            }
+                        }
+                        else if (!headless && videoRegisters.frame % rewindInterval == 0)
+                        {
+                            PROFILE_SCOPE("Capture rewind state");
+                            saveState(rewindBuffer.getCaptureBuffer());
+                            rewindBuffer.submit();
+                        }
+
                         ++videoRegisters.frame;
+                        if (frameLimit && videoRegisters.frame >= *frameLimit)
+                        {
+                            running = false;
+                        }
                         videoRegisters.vCounter = 0;
                         videoRegisters.interlaceField = !videoRegisters.interlaceField;
                         videoRegisters.vBlank = false;
@@ -489,16 +716,9 @@ void Emulator::run()
             }
             else
             {
+                const uint64_t startTicks = GlobalProfiler::readTimestampCounter();
                 std::this_thread::yield();
-            }
-            static std::chrono::steady_clock::time_point lastTime = std::chrono::steady_clock::now();
-            std::chrono::steady_clock::time_point currentTime = std::chrono::steady_clock::now();
-            if (currentTime - lastTime > std::chrono::seconds(10))
-            {
-                //lostCycles = std::chrono::duration_cast<CycleCount>(audioSystem.elapsedTime) - masterCycle;
-                output.debug("Video cycles: ", masterCycle.count(), " / ", iteration, " (", (100.0 * masterCycle.count() / iteration), "%)");
-                output.debug("Lost cycles: ", lostCycles.count());
-                lastTime = currentTime;
+                waitTicks += GlobalProfiler::readTimestampCounter() - startTicks;
             }
             ++iteration;
         }
@@ -516,6 +736,268 @@ void Emulator::run()
     }*/
 }
 
+void Emulator::runFrames(int frameCount)
+{
+    if (frameCount < 0)
+    {
+        throw RuntimeError("Cannot run ", frameCount, " frames");
+    }
+    if (frameCount == 0)
+    {
+        return;
+    }
+    frameLimit = videoRegisters.frame + frameCount;
+    running = true;
+    run();
+    frameLimit.reset();
+}
+
+void Emulator::enableOutputHashing(const std::filesystem::path& logPath)
+{
+    outputHashing = true;
+    if (!logPath.empty())
+    {
+        hashLog.open(logPath);
+        if (!hashLog)
+        {
+            throw RuntimeError("Could not open hash log ", logPath.string());
+        }
+        hashLog << std::hex << std::setfill('0');
+    }
+}
+
+void Emulator::startGuestProfiling()
+{
+    cpuContext.profiler.start();
+    audioSystem.context.profiler.start();
+}
+
+namespace {
+
+template<typename State>
+void writeGuestProfile(const GuestProfiler<State>& profiler, const std::filesystem::path& path)
+{
+    const std::string basePath = path.string() + "." + GuestProfilerTraits<State>::name;
+    std::ofstream report(basePath + ".txt");
+    profiler.writeReport(report, 50);
+    std::ofstream stacks(basePath + ".folded");
+    profiler.writeFoldedStacks(stacks);
+    if (!report || !stacks)
+    {
+        throw RuntimeError("Could not write guest profile ", basePath);
+    }
+}
+
+}
+
+void Emulator::writeGuestProfiles(const std::filesystem::path& path) const
+{
+    writeGuestProfile(cpuContext.profiler, path);
+    writeGuestProfile(audioSystem.context.profiler, path);
+}
+
+void Emulator::hashOutput()
+{
+    PROFILE_SCOPE("Hash output");
+
+    const std::vector<Video::Renderer::Pixel>& pixels = videoProcessor.renderer.getCompletedFrame();
+    outputHashes.frame = Hash::xxh64(pixels.data(), pixels.size() * sizeof(Video::Renderer::Pixel));
+    outputHashes.audio = audioSystem.takeOutputHash();
+    outputHashes.video = Hash::combine(outputHashes.video, outputHashes.frame);
+    outputHashes.audioStream = Hash::combine(outputHashes.audioStream, outputHashes.audio);
+    if (hashLog.is_open())
+    {
+        hashLog << std::dec << videoRegisters.frame << std::hex
+            << ' ' << std::setw(16) << outputHashes.frame
+            << ' ' << std::setw(16) << outputHashes.audio << '\n';
+    }
+}
+
+void Emulator::recordMovie(const std::filesystem::path& path)
+{
+    if (isInitialized)
+    {
+        throw RuntimeError("Movies are recorded from power-on");
+    }
+    recordingPath = path;
+}
+
+void Emulator::playMovie(const std::filesystem::path& path)
+{
+    if (isInitialized)
+    {
+        throw RuntimeError("Movies are played from power-on");
+    }
+    std::unique_ptr<InputMovie> movie = std::make_unique<InputMovie>();
+    movie->load(path);
+    if (movie->romHash != rom.computeHash())
+    {
+        throw RuntimeError("Movie ", path.string(), " was recorded with another ROM image");
+    }
+    if (movie->saveRam.size() != size_t(rom.saveRamSize))
+    {
+        throw RuntimeError("Movie ", path.string(), " has ", movie->saveRam.size(), " bytes of save RAM, expected ", rom.saveRamSize);
+    }
+    output.info("Playing ", movie->frames.size(), " frames of ", path.string());
+    playbackMovie = std::move(movie);
+    playingMovie = true;
+}
+
+void Emulator::saveState(std::vector<uint8_t>& buffer)
+{
+    AudioSystem::Suspension suspension(audioSystem);
+    writeState(buffer);
+}
+
+void Emulator::loadState(const std::vector<uint8_t>& buffer)
+{
+    AudioSystem::Suspension suspension(audioSystem);
+    std::vector<uint8_t> backup;
+    writeState(backup);
+    try
+    {
+        readState(buffer);
+    }
+    catch (const SaveState::FormatError&)
+    {
+        readState(backup);
+        throw;
+    }
+}
+
+void Emulator::writeState(std::vector<uint8_t>& buffer)
+{
+    SaveState::Writer writer(buffer);
+    writer(SaveState::magic);
+    writer(SaveState::version);
+    writer(rom.gameTitle);
+    serialize(writer);
+}
+
+void Emulator::readState(const std::vector<uint8_t>& buffer)
+{
+    SaveState::Reader reader(buffer);
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    std::string gameTitle;
+    reader(magic);
+    if (magic != SaveState::magic)
+    {
+        throw SaveState::FormatError("Not a save state");
+    }
+    reader(version);
+    if (version != SaveState::version)
+    {
+        throw SaveState::FormatError("Unsupported save state version ", version, ", expected ", SaveState::version);
+    }
+    reader(gameTitle);
+    if (gameTitle != rom.gameTitle)
+    {
+        throw SaveState::FormatError("Save state of ", gameTitle, " does not match ", rom.gameTitle);
+    }
+    serialize(reader);
+    if (!reader.atEnd())
+    {
+        throw SaveState::FormatError("Unexpected data after the last section");
+    }
+}
+
+template<typename Archive>
+void Emulator::serialize(Archive& archive)
+{
+    cpuIdleLoop.wake();
+
+    archive.section(SaveState::makeTag("CPU "), [&]()
+        {
+            archive(cpuState);
+        });
+    archive.section(SaveState::makeTag("WRAM"), [&]()
+        {
+            archive.bytes(wram.data(), wram.size());
+        });
+    archive.section(SaveState::makeTag("SRAM"), [&]()
+        {
+            archive.bytes(saveRamSaver.data(), saveRamSaver.size());
+        });
+    archive.section(SaveState::makeTag("PPU "), [&]()
+        {
+            archive(videoRegisters);
+        });
+    archive.section(SaveState::makeTag("DMA "), [&]()
+        {
+            archive(dmaInstruction);
+            archive(hdmaInstruction);
+        });
+    archive.section(SaveState::makeTag("APU "), [&]()
+        {
+            archive(cpuToSpcBuffers);
+            archive(spcToCpuBuffers);
+            archive(audioSystem);
+        });
+    archive.section(SaveState::makeTag("SCHD"), [&]()
+        {
+            archive(masterCycle);
+            archive(nextCpu);
+            archive(nextSpc);
+            archive(nextAudioTick);
+            archive(nmiRequested);
+            archive(irqRequested);
+        });
+
+    if constexpr (Archive::loading)
+    {
+        cpuIdleLoop.wake();
+        cpuContext.nextInstruction = cpuInstructionDecoder.getNextInstruction(cpuState);
+        saveRamSaver.markAllDirty();
+    }
+}
+
+void Emulator::saveStateToFile()
+{
+    std::vector<uint8_t> buffer;
+    const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    saveState(buffer);
+    const std::chrono::microseconds elapsedTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime);
+
+    std::ofstream file(getStatePath(), std::ios::binary);
+    file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    if (!file)
+    {
+        output.error("Failed to write ", getStatePath().string());
+        return;
+    }
+    output.info("State saved to ", getStatePath().string(), ", ", buffer.size(), " bytes in ", elapsedTime.count(), " us");
+}
+
+void Emulator::loadStateFromFile()
+{
+    std::ifstream file(getStatePath(), std::ios::binary);
+    if (!file)
+    {
+        output.error("No saved state at ", getStatePath().string());
+        return;
+    }
+    const std::vector<uint8_t> buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    try
+    {
+        const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+        loadState(buffer);
+        const std::chrono::microseconds elapsedTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime);
+        output.info("State loaded from ", getStatePath().string(), " in ", elapsedTime.count(), " us");
+        // The movie could not be replayed past this point, as it does not start from power-on
+        if (recorder)
+        {
+            output.info("Loading a state ends the recording");
+            recorder->stop();
+            recorder = nullptr;
+        }
+    }
+    catch (const SaveState::FormatError& e)
+    {
+        output.error(e.what());
+    }
+}
+
 template<typename State, typename OtherState>
 int executeNext(Instruction<State>* instruction, State& state, Debugger& debugger, Debugger::Context<State>& context, OtherState& otherState, Debugger::Context<OtherState>& otherContext, Output& output)
 {
@@ -3,13 +3,19 @@
 #include <ctime>
 #include <set>
 #include <condition_variable>
+#include <functional>
+#include <fstream>
+#include <optional>
 
 #include "Common/Instruction.h"
 #include "Common/System.h"
+#include "Common/SaveState.h"
+#include "Common/Profiler.h"
 
 #include "WDC65816/CpuState.h"
 
 #include "WDC65816/CpuInstructionDecoder.h"
+#include "WDC65816/CpuIdleLoopDetector.h"
 
 #include "Rom.h"
 #include "Debugger.h"
@@ -20,97 +26,212 @@
 
 #include "AudioSystem.h"
 
+#include "RewindBuffer.h"
+#include "SaveRamSaver.h"
+#include "InputSource.h"
+
+#include "DmaInstruction.h"
+#include "HdmaInstruction.h"
+
+#include "FrameTelemetry.h"
+
 class Emulator
 {
-private:
-    struct SaveRamSaver {
-        SaveRamSaver(Emulator& emulator)
-            : saveRam(emulator.rom.romSize)
-            , rom(emulator.rom)
-        {
-        }
-
-        ~SaveRamSaver()
-        {
-        }
+public:
+    typedef std::function<void(int frame, const std::vector<Video::Renderer::Pixel>& pixels)> FrameListener;
 
-        void operator()()
-        {
-            while (run) {
-                bool save = false;
-                {
-                    std::unique_lock<std::mutex> lock(mutex);
-                    condition.wait(lock, [this]() { return saveRamModified || !run; });
-                    save = saveRamModified;
-                    saveRamModified = false;
-                }
-                if (save) {
-                    std::ofstream file(System::getRomLibraryPath() / (rom.gameTitle + ".save"));
-                    for (int address = 0; address < rom.saveRamSize; ++address) {
-                        file << saveRam[address] << ' ';
-                    }
-                    std::cout << "*";
-                }
-            }
-        }
+    struct OutputHashes
+    {
+        // The frame just completed, and the DSP output since the frame before
+        uint64_t frame = 0;
+        uint64_t audio = 0;
 
-        bool run = true;
-        bool saveRamModified = false;
-        std::mutex mutex;
-        std::condition_variable condition;
-        const Rom& rom;
-        std::vector<Byte> saveRam;
+        // Both chained over every frame since power-on
+        uint64_t video = 0;
+        uint64_t audioStream = 0;
     };
 
-public:
-    Emulator(Output& output, const Rom& rom)
+    // Rewinding keeps up to this much of the recent past by default
+    static constexpr size_t defaultRewindMemoryBudget = 64 << 20;
+
+    // A headless emulator opens no windows or audio stream and runs as fast as it can. It
+    // starts from blank save RAM, ignores the breakpoint files and does not write any files.
+    // It does not capture rewind states either, so the rewind memory budget only applies to
+    // emulators with a window.
+    Emulator(Output& output, const Rom& rom, bool headless = false, size_t rewindMemoryBudget = defaultRewindMemoryBudget)
         : output(output, "emulator")
+        , telemetry(this->output)
+        , headless(headless)
         , rom(rom)
         , cpuState(output)
         , cpuInstructionDecoder()
-        , videoRegisters(output, cpuState, rom.gameTitle)
+        , cpuIdleLoop(cpuState, isPollableRegister,
+            [this](Long address)
+            {
+                return cpuState.getMemory().readByte(address);
+            })
+        , videoRegisters(output, cpuState, rom.gameTitle, headless)
         , videoProcessor(videoRegisters.processor)
-        , audioSystem(output, debugger)
+        , dmaInstruction(output, cpuState, videoRegisters)
+        , hdmaInstruction(output, cpuState, videoRegisters)
+        , audioSystem(output, debugger, headless)
         , debugger(output, videoRegisters, audioSystem.getRegisters(), running)
         , cpuContext("cpu.txt", Output::Color::Green, debugger)
-        , saveRamSaver(*this)
+        , saveRamSaver(output, rom)
+        , rewindBuffer(rewindMemoryBudget)
+        , wram(0x20000, Byte(0x55))
         , masterCycle(0)
+        , nextCpu(0)
+        , nextSpc(0)
+        , nextAudioTick(0)
     {
     }
 
     Emulator(const Emulator&) = delete;
     Emulator& operator=(const Emulator&) = delete;
 
-    ~Emulator()
+    void initialize();
+    void run();
+
+    // Runs until the given number of frames have been completed, none for zero. When headless,
+    // entering the debugger ends the run with a RuntimeError instead, as there is nobody to take
+    // commands.
+    void runFrames(int frameCount);
+
+    // Called from the emulator thread with every completed frame
+    void setFrameListener(FrameListener listener)
     {
-        if (isInitialized) {
-            saveRamSaver.run = false;
-            saveRamSaver.condition.notify_one();
-            saveRamSaverThread.join();
-        }
+        frameListener = std::move(listener);
     }
 
-    void initialize();
-    void run();
+    // Hashes every completed frame and the audio along with it, to compare runs against golden
+    // output without storing any. With a log, a line per frame is written to it:
+    //
+    //     <frame> <frame hash> <audio hash>
+    //
+    // The hashes are in hexadecimal. The audio hash is only reproducible when headless, where
+    // the DSP runs in step with the CPU.
+    void enableOutputHashing(const std::filesystem::path& logPath = std::filesystem::path());
+
+    // Up to date when the frame listener is called
+    const OutputHashes& getOutputHashes() const
+    {
+        return outputHashes;
+    }
+
+    // Frame records are written to the sink while running, see FrameTelemetry
+    void setTelemetrySink(const std::filesystem::path& path)
+    {
+        telemetry.setSink(path);
+    }
+
+    FrameTelemetry::Summary getTelemetrySummary() const
+    {
+        return telemetry.getSummary();
+    }
+
+    // Profiles the code run by the CPU and the SPC from here on, see GuestProfiler
+    void startGuestProfiling();
+
+    // Writes the hottest code of each processor to <path>.cpu.txt and <path>.spc.txt, and their
+    // call stacks to <path>.cpu.folded and <path>.spc.folded
+    void writeGuestProfiles(const std::filesystem::path& path) const;
+
+    // Input movies, chosen before initialize. A recording starts at power-on and is written when
+    // the emulator is destroyed or a state is loaded. A played movie replaces the controllers and
+    // provides the save RAM, which is then not written back to its file.
+    void recordMovie(const std::filesystem::path& path);
+    void playMovie(const std::filesystem::path& path);
+
+    // Snapshots of the whole machine in the SaveState format. Loading checks the header and
+    // leaves the machine untouched if the data turns out to be malformed.
+    void saveState(std::vector<uint8_t>& buffer);
+    void loadState(const std::vector<uint8_t>& buffer);
 
     std::string getRomTitle() const
     {
         return rom.gameTitle;
     }
 
+    // Registers that idle loops may poll: APU ports, NMI/IRQ flags, PPU status, math results and auto joypad data
+    static bool isPollableRegister(Long address)
+    {
+        const uint32_t offset = address & 0xffff;
+        return (offset >= 0x2140 && offset <= 0x2143)
+            || (offset >= 0x4210 && offset <= 0x4212)
+            || (offset >= 0x4214 && offset <= 0x421f);
+    }
+
+    static bool isApuPort(Long address)
+    {
+        const uint32_t offset = address & 0xffff;
+        return offset >= 0x2140 && offset <= 0x2143;
+    }
+
 private:
+    // The master cycles until the H counter reaches the next point where the video side can
+    // request an interrupt, start HDMA or change the PPU status and auto joypad registers: the
+    // H blank, the start of the next line, or the H timer when it is used
+    int getCyclesToVideoEvent() const
+    {
+        const int hCounter = videoRegisters.hCounter;
+        int event = 1374;
+        if (hCounter < 274)
+        {
+            event = 274;
+        }
+        const int hTimer = videoRegisters.hTimer;
+        if ((videoRegisters.irqMode == Video::Registers::IrqMode::HCounter || videoRegisters.irqMode == Video::Registers::IrqMode::HAndVCounter)
+            && hTimer > hCounter && hTimer < event)
+        {
+            event = hTimer;
+        }
+        return event - hCounter;
+    }
+
+    void writeState(std::vector<uint8_t>& buffer);
+    void readState(const std::vector<uint8_t>& buffer);
+
+    template<typename Archive>
+    void serialize(Archive& archive);
+
+    std::filesystem::path getStatePath() const
+    {
+        return System::getRomLibraryPath() / (rom.gameTitle + ".state");
+    }
+
+    void saveStateToFile();
+    void loadStateFromFile();
+
+    void hashOutput();
+
+    // A snapshot every sixth frame, rewinding steps back one per frame
+    static constexpr int rewindInterval = 6;
+
     bool isInitialized = false;
 
     Output output;
 
+    // Scope timings of the emulator thread
+    GlobalProfiler profiler;
+
+    // Frame timings, replacing the frame rate prints
+    FrameTelemetry telemetry;
+
+    const bool headless;
+
     const Rom& rom;
 
     CPU::State cpuState;
     CPU::InstructionDecoder cpuInstructionDecoder;
+    CPU::IdleLoopDetector cpuIdleLoop;
 
     Video::Registers videoRegisters;
     Video::Processor& videoProcessor;
 
+    DmaInstruction dmaInstruction;
+    HdmaInstruction hdmaInstruction;
+
     AudioSystem audioSystem;
 
     Debugger debugger;
@@ -118,13 +239,37 @@ private:
     Debugger::Context<CPU::State> cpuContext;
 
     SaveRamSaver saveRamSaver;
-    std::thread saveRamSaverThread;
+
+    RewindBuffer rewindBuffer;
+    std::vector<uint8_t> rewindState;
+
+    std::vector<Byte> wram;
+
+    std::filesystem::path recordingPath;
+    std::unique_ptr<InputMovie> playbackMovie;
+    bool playingMovie = false;
+    std::unique_ptr<InputSource> input;
+    RecordingInputSource* recorder = nullptr;
 
     bool running = true;
 
+    // The frame to stop before, if not running until stopped
+    std::optional<int> frameLimit;
+    FrameListener frameListener;
+
+    bool outputHashing = false;
+    OutputHashes outputHashes;
+    std::ofstream hashLog;
+
     using Frequency = std::ratio<88, 1890000000>;
     using CycleCount = std::chrono::duration<uint64_t, Frequency>;
     CycleCount masterCycle;
+    CycleCount nextCpu;
+    CycleCount nextSpc;
+    CycleCount nextAudioTick;
+
+    bool nmiRequested = false;
+    bool irqRequested = false;
 
     std::array<Byte, 4> cpuToSpcBuffers;
     std::array<Byte, 4> spcToCpuBuffers;
@@ -0,0 +1,221 @@
+#include "FrameTelemetry.h"
+
+#include <algorithm>
+#include <iomanip>
+
+#include "Common/Exception.h"
+
+namespace {
+
+double toMilliseconds(FrameRecord::Duration duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// The value below which the given share of the durations fall, from a copy it may reorder
+FrameRecord::Duration getPercentile(std::vector<FrameRecord::Duration>& durations, double share)
+{
+    if (durations.empty())
+    {
+        return FrameRecord::Duration(0);
+    }
+    const size_t index = std::min(durations.size() - 1, size_t(share * durations.size()));
+    std::nth_element(durations.begin(), durations.begin() + index, durations.end());
+    return durations[index];
+}
+
+}
+
+FrameTelemetry::FrameTelemetry(Output& output)
+    : output(output, "telemetry")
+{
+    window.reserve(windowSize);
+}
+
+FrameTelemetry::~FrameTelemetry()
+{
+    stop();
+}
+
+void FrameTelemetry::setSink(const std::filesystem::path& path)
+{
+    sink.open(path);
+    if (!sink)
+    {
+        throw RuntimeError("Could not open telemetry sink ", path.string());
+    }
+    jsonSink = path.extension() == ".jsonl";
+    if (!jsonSink)
+    {
+        sink << "frame,wall_ns,cpu_ns,ppu_ns,dsp_ns,wait_ns,dma_bytes,audio_fill,cpu_steps,spc_steps,interrupts,master_cycles,iterations,lost_cycles\n";
+    }
+}
+
+void FrameTelemetry::push(const FrameRecord& record)
+{
+    const size_t currentTail = tail.load(std::memory_order_relaxed);
+    if (currentTail - head.load(std::memory_order_acquire) == ringSize)
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    ring[currentTail % ringSize] = record;
+    tail.store(currentTail + 1, std::memory_order_release);
+}
+
+FrameTelemetry::Summary FrameTelemetry::getSummary() const
+{
+    std::lock_guard<std::mutex> lock(windowMutex);
+    return summarize();
+}
+
+void FrameTelemetry::start()
+{
+    stopRequested = false;
+    thread = std::thread(&FrameTelemetry::run, this);
+}
+
+void FrameTelemetry::stop()
+{
+    if (!thread.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(runMutex);
+        stopRequested = true;
+    }
+    runCondition.notify_one();
+    thread.join();
+}
+
+void FrameTelemetry::run()
+{
+    std::chrono::steady_clock::time_point lastSummaryTime = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(runMutex);
+    while (true)
+    {
+        const bool stopping = runCondition.wait_for(lock, collectInterval, [this]() { return stopRequested; });
+        collect();
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now - lastSummaryTime >= summaryInterval || stopping)
+        {
+            const Summary summary = getSummary();
+            if (summary.frames)
+            {
+                LOG_DEBUG(output, std::fixed, std::setprecision(1),
+                    "Frames: ", summary.frames, ", FPS: ", summary.framesPerSecond,
+                    ", frame time p50/p99/max: ", toMilliseconds(summary.frameTimeP50), "/", toMilliseconds(summary.frameTimeP99), "/", toMilliseconds(summary.frameTimeMax), " ms",
+                    ", p50 CPU/PPU/DSP: ", toMilliseconds(summary.cpuTimeP50), "/", toMilliseconds(summary.ppuTimeP50), "/", toMilliseconds(summary.dspTimeP50), " ms",
+                    ", dropped: ", summary.droppedFrames);
+            }
+            lastSummaryTime = now;
+        }
+        if (stopping)
+        {
+            break;
+        }
+    }
+    sink.flush();
+}
+
+void FrameTelemetry::collect()
+{
+    std::lock_guard<std::mutex> lock(windowMutex);
+    const size_t currentTail = tail.load(std::memory_order_acquire);
+    for (size_t currentHead = head.load(std::memory_order_relaxed); currentHead != currentTail; ++currentHead)
+    {
+        const FrameRecord& record = ring[currentHead % ringSize];
+        if (sink.is_open())
+        {
+            write(record);
+        }
+        if (window.size() < windowSize)
+        {
+            window.push_back(record);
+        }
+        else
+        {
+            window[windowPosition] = record;
+        }
+        windowPosition = (windowPosition + 1) % windowSize;
+        head.store(currentHead + 1, std::memory_order_release);
+    }
+    droppedFrames += dropped.exchange(0, std::memory_order_relaxed);
+}
+
+void FrameTelemetry::write(const FrameRecord& record)
+{
+    if (jsonSink)
+    {
+        sink << "{\"frame\":" << record.frame
+            << ",\"wall_ns\":" << record.wallTime.count()
+            << ",\"cpu_ns\":" << record.cpuTime.count()
+            << ",\"ppu_ns\":" << record.ppuTime.count()
+            << ",\"dsp_ns\":" << record.dspTime.count()
+            << ",\"wait_ns\":" << record.waitTime.count()
+            << ",\"dma_bytes\":" << record.dmaBytes
+            << ",\"audio_fill\":" << record.audioFill
+            << ",\"cpu_steps\":" << record.cpuSteps
+            << ",\"spc_steps\":" << record.spcSteps
+            << ",\"interrupts\":" << record.interrupts
+            << ",\"master_cycles\":" << record.masterCycles
+            << ",\"iterations\":" << record.iterations
+            << ",\"lost_cycles\":" << record.lostCycles
+            << "}\n";
+    }
+    else
+    {
+        sink << record.frame
+            << ',' << record.wallTime.count()
+            << ',' << record.cpuTime.count()
+            << ',' << record.ppuTime.count()
+            << ',' << record.dspTime.count()
+            << ',' << record.waitTime.count()
+            << ',' << record.dmaBytes
+            << ',' << record.audioFill
+            << ',' << record.cpuSteps
+            << ',' << record.spcSteps
+            << ',' << record.interrupts
+            << ',' << record.masterCycles
+            << ',' << record.iterations
+            << ',' << record.lostCycles
+            << '\n';
+    }
+}
+
+FrameTelemetry::Summary FrameTelemetry::summarize() const
+{
+    Summary summary;
+    summary.frames = window.size();
+    summary.droppedFrames = droppedFrames;
+    if (window.empty())
+    {
+        return summary;
+    }
+
+    std::vector<FrameRecord::Duration> durations(window.size());
+    FrameRecord::Duration totalTime(0);
+    for (size_t i = 0; i < window.size(); ++i)
+    {
+        durations[i] = window[i].wallTime;
+        totalTime += window[i].wallTime;
+        summary.frameTimeMax = std::max(summary.frameTimeMax, window[i].wallTime);
+    }
+    summary.framesPerSecond = totalTime.count() > 0 ? window.size() / std::chrono::duration<double>(totalTime).count() : 0.0;
+    summary.frameTimeP50 = getPercentile(durations, 0.5);
+    summary.frameTimeP99 = getPercentile(durations, 0.99);
+
+    const auto getMedian = [this, &durations](FrameRecord::Duration FrameRecord::* field)
+        {
+            for (size_t i = 0; i < window.size(); ++i)
+            {
+                durations[i] = window[i].*field;
+            }
+            return getPercentile(durations, 0.5);
+        };
+    summary.cpuTimeP50 = getMedian(&FrameRecord::cpuTime);
+    summary.ppuTimeP50 = getMedian(&FrameRecord::ppuTime);
+    summary.dspTimeP50 = getMedian(&FrameRecord::dspTime);
+    return summary;
+}
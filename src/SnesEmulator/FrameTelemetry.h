@@ -0,0 +1,152 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Common/Output.h"
+
+// What one emulated frame cost the host, taken at the end of its last visible scanline
+struct FrameRecord
+{
+    typedef std::chrono::nanoseconds Duration;
+
+    uint64_t frame = 0;
+
+    // Since the end of the previous frame, and what the emulator thread spent it on: drawing
+    // scanlines, mixing DSP samples when the DSP runs in step with the CPU, waiting for the
+    // audio clock, and the rest, which is mostly executing CPU and SPC instructions
+    Duration wallTime = Duration(0);
+    Duration cpuTime = Duration(0);
+    Duration ppuTime = Duration(0);
+    Duration dspTime = Duration(0);
+    Duration waitTime = Duration(0);
+
+    uint32_t dmaBytes = 0;
+
+    // DSP samples not yet taken by the host audio stream
+    uint32_t audioFill = 0;
+
+    // Scheduler events: CPU instructions or idle loop skips, the same for the SPC when it runs
+    // on the emulator thread, and interrupts started
+    uint32_t cpuSteps = 0;
+    uint32_t spcSteps = 0;
+    uint32_t interrupts = 0;
+
+    // Master cycles emulated, and iterations of the emulator loop it took to emulate them
+    uint64_t masterCycles = 0;
+    uint64_t iterations = 0;
+
+    // How far the emulation has been set back against the audio clock, in master cycles
+    int64_t lostCycles = 0;
+};
+
+// Collects a record per frame from the emulator thread and hands them to a thread of its own,
+// which writes them to an optional sink and keeps a summary of the last few seconds. Averages
+// hide the odd slow frame, so the summary has percentiles of the frame times:
+//
+//     Frames: 600, FPS: 60.0, frame time p50/p99/max: 16.6/17.9/31.2 ms, ...
+//
+// The sink is CSV with a header line, or JSON lines if the file name ends in .jsonl. Pushing a
+// record never waits: when the ring is full, the record is counted as dropped instead.
+class FrameTelemetry
+{
+public:
+    struct Summary
+    {
+        uint64_t frames = 0;
+        uint64_t droppedFrames = 0;
+        double framesPerSecond = 0.0;
+
+        FrameRecord::Duration frameTimeP50 = FrameRecord::Duration(0);
+        FrameRecord::Duration frameTimeP99 = FrameRecord::Duration(0);
+        FrameRecord::Duration frameTimeMax = FrameRecord::Duration(0);
+
+        FrameRecord::Duration cpuTimeP50 = FrameRecord::Duration(0);
+        FrameRecord::Duration ppuTimeP50 = FrameRecord::Duration(0);
+        FrameRecord::Duration dspTimeP50 = FrameRecord::Duration(0);
+    };
+
+    // Keeps the collecting thread running for as long as it lives
+    class Session
+    {
+    public:
+        Session(FrameTelemetry& telemetry)
+            : telemetry(telemetry)
+        {
+            telemetry.start();
+        }
+
+        ~Session()
+        {
+            telemetry.stop();
+        }
+
+        Session(const Session&) = delete;
+        Session& operator=(const Session&) = delete;
+
+    private:
+        FrameTelemetry& telemetry;
+    };
+
+    FrameTelemetry(Output& output);
+    ~FrameTelemetry();
+
+    FrameTelemetry(const FrameTelemetry&) = delete;
+    FrameTelemetry& operator=(const FrameTelemetry&) = delete;
+
+    // Opens the sink, before the first session
+    void setSink(const std::filesystem::path& path);
+
+    // From the emulator thread only
+    void push(const FrameRecord& record);
+
+    // The frames of the summary window, up to date with the records collected so far
+    Summary getSummary() const;
+
+private:
+    static constexpr size_t ringSize = 256;
+
+    // The summary covers this many of the latest frames, about ten seconds
+    static constexpr size_t windowSize = 600;
+
+    static constexpr std::chrono::milliseconds collectInterval = std::chrono::milliseconds(100);
+    static constexpr std::chrono::seconds summaryInterval = std::chrono::seconds(10);
+
+    void start();
+    void stop();
+
+    void run();
+    void collect();
+    void write(const FrameRecord& record);
+    Summary summarize() const;
+
+    Output output;
+
+    // Written by the emulator thread, read by the collecting thread
+    std::array<FrameRecord, ringSize> ring;
+    std::atomic<size_t> head = 0;
+    std::atomic<size_t> tail = 0;
+    std::atomic<uint64_t> dropped = 0;
+
+    std::thread thread;
+    std::mutex runMutex;
+    std::condition_variable runCondition;
+    bool stopRequested = false;
+
+    // Only touched by the collecting thread, or under the window mutex
+    mutable std::mutex windowMutex;
+    std::vector<FrameRecord> window;
+    size_t windowPosition = 0;
+    uint64_t droppedFrames = 0;
+
+    std::ofstream sink;
+    bool jsonSink = false;
+};
@@ -0,0 +1,439 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Common/Instruction.h"
+
+#include "WDC65816/CpuState.h"
+#include "SPC700/SpcState.h"
+
+// What the guest profiler needs to know about the instruction set of a processor: a name for
+// the reports, the unit of the cycles it is given, and which opcodes enter and leave
+// subroutines
+template<typename State>
+struct GuestProfilerTraits;
+
+enum class GuestOpcodeKind : uint8_t
+{
+    Other,
+    Call,
+    Return,
+};
+
+template<>
+struct GuestProfilerTraits<CPU::State>
+{
+    static constexpr const char* name = "cpu";
+    static constexpr const char* cycleUnit = "master cycles";
+
+    static GuestOpcodeKind getOpcodeKind(Byte opcode)
+    {
+        switch (opcode)
+        {
+        case 0x00: // BRK
+        case 0x02: // COP
+        case 0x20: // JSR addr
+        case 0x22: // JSL long
+        case 0xfc: // JSR (addr,X)
+            return GuestOpcodeKind::Call;
+        case 0x40: // RTI
+        case 0x60: // RTS
+        case 0x6b: // RTL
+            return GuestOpcodeKind::Return;
+        default:
+            return GuestOpcodeKind::Other;
+        }
+    }
+};
+
+template<>
+struct GuestProfilerTraits<SPC::State>
+{
+    static constexpr const char* name = "spc";
+    static constexpr const char* cycleUnit = "SPC cycles";
+
+    static GuestOpcodeKind getOpcodeKind(Byte opcode)
+    {
+        switch (opcode)
+        {
+        case 0x0f: // BRK
+        case 0x3f: // CALL !a
+        case 0x4f: // PCALL u
+            return GuestOpcodeKind::Call;
+        case 0x6f: // RET
+        case 0x7f: // RETI
+            return GuestOpcodeKind::Return;
+        default:
+            // TCALL n
+            return (opcode & 0x0f) == 0x01 ? GuestOpcodeKind::Call : GuestOpcodeKind::Other;
+        }
+    }
+};
+
+// Counts the instructions executed and the cycles they took per program address, per opcode and
+// per subroutine, to find the game code that emulation spends its time on. Nothing is counted
+// until started, and then only what the emulator reports between beginInstruction and
+// endInstruction, plus the cycles of skipped idle loops.
+//
+// Subroutines are followed through their call and return opcodes. A call pushes a frame with
+// the stack pointer from before the call, and a return pops every frame entered at that stack
+// pointer or deeper, so that code which drops return addresses or returns through more than
+// one level does not leave the call stack behind. The calls seen form a tree, which is written
+// as folded stacks, one line per call path, for flame graph tools:
+//
+//     cpu;008000;00813a;0081f0 <cycles>
+//
+// The root frame holds the code outside of any known subroutine.
+template<typename State>
+class GuestProfiler
+{
+public:
+    typedef typename State::AddressType AddressType;
+    typedef GuestProfilerTraits<State> Traits;
+
+    struct Counter
+    {
+        uint64_t instructions = 0;
+        uint64_t cycles = 0;
+    };
+
+    GuestProfiler()
+    {
+        clear();
+    }
+
+    GuestProfiler(const GuestProfiler&) = delete;
+    GuestProfiler& operator=(const GuestProfiler&) = delete;
+
+    bool isRunning() const
+    {
+        return running;
+    }
+
+    // Starts from scratch, the counts of an earlier run are cleared
+    void start()
+    {
+        clear();
+        running = true;
+    }
+
+    void stop()
+    {
+        running = false;
+    }
+
+    void clear()
+    {
+        for (std::unique_ptr<BankCounters>& bank : banks)
+        {
+            bank.reset();
+        }
+        opcodes = {};
+        nodes.assign(1, Node());
+        frames.clear();
+        total = Counter();
+        pending = nullptr;
+    }
+
+    // Before the instruction at the program address is executed
+    void beginInstruction(const State& state, const Instruction<State>* instruction)
+    {
+        pendingAddress = state.getProgramAddress();
+        pendingOpcode = state.inspectProgramByte();
+        pendingStackPointer = state.getStackPointer();
+        pending = instruction;
+    }
+
+    // After it has been executed, with the cycles it took
+    void endInstruction(const State& state, uint64_t cycles)
+    {
+        if (!pending)
+        {
+            return;
+        }
+
+        OpcodeCounter& opcode = opcodes[pendingOpcode];
+        opcode.instruction = pending;
+        pending = nullptr;
+
+        add(getCounter(pendingAddress), 1, cycles);
+        add(opcode.counter, 1, cycles);
+        add(nodes[getCurrentNode()].self, 1, cycles);
+        add(total, 1, cycles);
+
+        switch (Traits::getOpcodeKind(pendingOpcode))
+        {
+        case GuestOpcodeKind::Call:
+            enterSubroutine(state.getProgramAddress(), pendingStackPointer);
+            break;
+        case GuestOpcodeKind::Return:
+            leaveSubroutines(state.getStackPointer());
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Cycles spent in an idle loop without executing it, counted at the program address
+    void countIdleCycles(const State& state, uint64_t cycles)
+    {
+        add(getCounter(state.getProgramAddress()), 0, cycles);
+        add(nodes[getCurrentNode()].self, 0, cycles);
+        add(total, 0, cycles);
+    }
+
+    // After an interrupt has been started, with the stack pointer from before it
+    void enterInterrupt(const State& state, Word stackPointer)
+    {
+        enterSubroutine(state.getProgramAddress(), stackPointer);
+    }
+
+    // The addresses, opcodes and subroutines that took the most cycles, the count of each
+    void writeReport(std::ostream& stream, size_t count) const
+    {
+        stream << std::dec << std::setfill(' ');
+        stream << Traits::name << ": " << total.instructions << " instructions, " << total.cycles << " " << Traits::cycleUnit << '\n';
+
+        std::vector<std::pair<uint32_t, Counter>> addresses;
+        for (uint32_t bank = 0; bank < bankCount; ++bank)
+        {
+            if (banks[bank])
+            {
+                for (uint32_t offset = 0; offset < bankSize; ++offset)
+                {
+                    const Counter& counter = (*banks[bank])[offset];
+                    if (counter.cycles)
+                    {
+                        addresses.emplace_back(bank << 16 | offset, counter);
+                    }
+                }
+            }
+        }
+        sortByCycles(addresses, count);
+        stream << "Hottest addresses:" << '\n';
+        for (const auto& [address, counter] : addresses)
+        {
+            writeLine(stream, formatAddress(address), counter);
+        }
+
+        std::vector<std::pair<uint32_t, Counter>> opcodeCounts;
+        for (uint32_t opcode = 0; opcode < opcodes.size(); ++opcode)
+        {
+            if (opcodes[opcode].counter.cycles)
+            {
+                opcodeCounts.emplace_back(opcode, opcodes[opcode].counter);
+            }
+        }
+        sortByCycles(opcodeCounts, count);
+        stream << "Hottest opcodes:" << '\n';
+        for (const auto& [opcode, counter] : opcodeCounts)
+        {
+            writeLine(stream, opcodes[opcode].instruction->opcodeToString(), counter);
+        }
+
+        // Including everything called from them, recursion counted once
+        std::vector<std::pair<uint32_t, Counter>> subroutines = getSubroutineTotals();
+        sortByCycles(subroutines, count);
+        stream << "Hottest subroutines, including callees:" << '\n';
+        for (const auto& [entry, counter] : subroutines)
+        {
+            writeLine(stream, formatAddress(entry), counter);
+        }
+    }
+
+    void writeFoldedStacks(std::ostream& stream) const
+    {
+        std::vector<std::string> paths(nodes.size());
+        paths[0] = Traits::name;
+        // Parents always come before their children
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            const Node& node = nodes[i];
+            if (i > 0)
+            {
+                paths[i] = paths[node.parent] + ";" + formatAddress(node.entry);
+            }
+            if (node.self.cycles)
+            {
+                stream << paths[i] << ' ' << std::dec << node.self.cycles << '\n';
+            }
+        }
+    }
+
+private:
+    static constexpr uint32_t bankSize = 0x10000;
+    static constexpr uint32_t bankCount = (AddressType::spaceSize + bankSize - 1) / bankSize;
+
+    // Deeper calls are counted in the deepest frame, and calls beyond the node limit in their
+    // caller, so that runaway call chains cannot take all memory
+    static constexpr size_t maxDepth = 64;
+    static constexpr size_t maxNodes = 1 << 18;
+
+    static constexpr uint32_t noNode = ~uint32_t(0);
+
+    typedef std::array<Counter, bankSize> BankCounters;
+
+    struct OpcodeCounter
+    {
+        Counter counter;
+        const Instruction<State>* instruction = nullptr;
+    };
+
+    // A subroutine as reached through one call path
+    struct Node
+    {
+        uint32_t entry = 0;
+        uint32_t parent = noNode;
+        uint32_t firstChild = noNode;
+        uint32_t nextSibling = noNode;
+        Counter self;
+    };
+
+    struct Frame
+    {
+        uint32_t node;
+        Word stackPointer;
+    };
+
+    static void add(Counter& counter, uint64_t instructions, uint64_t cycles)
+    {
+        counter.instructions += instructions;
+        counter.cycles += cycles;
+    }
+
+    Counter& getCounter(AddressType address)
+    {
+        const uint32_t value = uint32_t(address);
+        std::unique_ptr<BankCounters>& bank = banks[value >> 16];
+        if (!bank)
+        {
+            bank = std::make_unique<BankCounters>();
+        }
+        return (*bank)[value & (bankSize - 1)];
+    }
+
+    uint32_t getCurrentNode() const
+    {
+        return frames.empty() ? 0 : frames.back().node;
+    }
+
+    void enterSubroutine(AddressType entry, Word stackPointer)
+    {
+        if (frames.size() == maxDepth)
+        {
+            return;
+        }
+        const uint32_t parent = getCurrentNode();
+        uint32_t child = nodes[parent].firstChild;
+        while (child != noNode && nodes[child].entry != uint32_t(entry))
+        {
+            child = nodes[child].nextSibling;
+        }
+        if (child == noNode)
+        {
+            if (nodes.size() == maxNodes)
+            {
+                return;
+            }
+            child = uint32_t(nodes.size());
+            Node& node = nodes.emplace_back();
+            node.entry = uint32_t(entry);
+            node.parent = parent;
+            node.nextSibling = nodes[parent].firstChild;
+            nodes[parent].firstChild = child;
+        }
+        frames.push_back({ child, stackPointer });
+    }
+
+    void leaveSubroutines(Word stackPointer)
+    {
+        while (!frames.empty() && frames.back().stackPointer <= stackPointer)
+        {
+            frames.pop_back();
+        }
+    }
+
+    std::vector<std::pair<uint32_t, Counter>> getSubroutineTotals() const
+    {
+        // Every node adds its own counts to the subroutines on its path, each once
+        std::vector<std::pair<uint32_t, Counter>> totals;
+        std::vector<uint32_t> entries;
+        for (size_t i = 1; i < nodes.size(); ++i)
+        {
+            const Counter& self = nodes[i].self;
+            if (!self.cycles)
+            {
+                continue;
+            }
+            entries.clear();
+            for (uint32_t node = uint32_t(i); node != 0; node = nodes[node].parent)
+            {
+                entries.push_back(nodes[node].entry);
+            }
+            std::sort(entries.begin(), entries.end());
+            entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+            for (uint32_t entry : entries)
+            {
+                auto it = std::find_if(totals.begin(), totals.end(), [entry](const auto& total) { return total.first == entry; });
+                if (it == totals.end())
+                {
+                    it = totals.insert(totals.end(), { entry, Counter() });
+                }
+                add(it->second, self.instructions, self.cycles);
+            }
+        }
+        return totals;
+    }
+
+    static void sortByCycles(std::vector<std::pair<uint32_t, Counter>>& counts, size_t count)
+    {
+        count = std::min(count, counts.size());
+        std::partial_sort(counts.begin(), counts.begin() + count, counts.end(),
+            [](const auto& a, const auto& b)
+            {
+                return a.second.cycles > b.second.cycles;
+            });
+        counts.resize(count);
+    }
+
+    static std::string formatAddress(uint32_t address)
+    {
+        std::ostringstream ss;
+        ss << AddressType(address);
+        return ss.str();
+    }
+
+    void writeLine(std::ostream& stream, const std::string& label, const Counter& counter) const
+    {
+        const double share = total.cycles ? 100.0 * counter.cycles / total.cycles : 0.0;
+        stream << "  " << std::left << std::setw(20) << label << std::right
+            << std::setw(14) << counter.cycles
+            << std::setw(8) << std::fixed << std::setprecision(2) << share << "%"
+            << std::setw(14) << counter.instructions << " instructions" << '\n';
+        stream << std::defaultfloat;
+    }
+
+    bool running = false;
+
+    // Allocated as they are reached
+    std::array<std::unique_ptr<BankCounters>, bankCount> banks;
+    std::array<OpcodeCounter, Byte::spaceSize> opcodes;
+
+    // The root at index 0
+    std::vector<Node> nodes;
+    std::vector<Frame> frames;
+
+    Counter total;
+
+    AddressType pendingAddress;
+    Byte pendingOpcode;
+    Word pendingStackPointer;
+    const Instruction<State>* pending = nullptr;
+};
@@ -98,16 +98,19 @@ public:
                             if (transferMode == 0) {
                                 memory.writeByte(getNextByte(channel, indirectAddressingMode), registerAddress);
                                 cycles += 1;
+                                transferredBytes += 1;
                             }
                             else if (transferMode == 1) {
                                 memory.writeByte(getNextByte(channel, indirectAddressingMode), registerAddress);
                                 memory.writeByte(getNextByte(channel, indirectAddressingMode), registerAddress + 1);
                                 cycles += 2;
+                                transferredBytes += 2;
                             }
                             else if (transferMode == 2) {
                                 memory.writeByte(getNextByte(channel, indirectAddressingMode), registerAddress);
                                 memory.writeByte(getNextByte(channel, indirectAddressingMode), registerAddress);
                                 cycles += 2;
+                                transferredBytes += 2;
                             }
                             else if (transferMode == 3) {
                                 memory.writeByte(getNextByte(channel, indirectAddressingMode), registerAddress);
@@ -115,6 +118,7 @@ public:
                                 memory.writeByte(getNextByte(channel, indirectAddressingMode), registerAddress + 1);
                                 memory.writeByte(getNextByte(channel, indirectAddressingMode), registerAddress + 1);
                                 cycles += 4;
+                                transferredBytes += 4;
                             }
                             else {
                                 throw NotYetImplementedException("HDMA transfer mode not implemented, control: ", channel.control, ", transfer mode: ", transferMode);
@@ -182,9 +186,21 @@ public:
     {
     }
 
+    // The channels are saved with the registers, the blocked instruction is set anew before each execution
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        archive(active);
+        archive(initializationRequested);
+        archive(iteration);
+    }
+
 public:
     Instruction<CPU::State>* blockedInstruction = nullptr;
 
+    // Since power-on, for the frame telemetry. Not part of the state.
+    uint64_t transferredBytes = 0;
+
 private:
     CPU::State::MemoryType& memory;
     Video::Registers& registers;
@@ -0,0 +1,141 @@
+#include "InputSource.h"
+
+#include <fstream>
+
+#include "Common/Exception.h"
+
+#include "VideoRenderer.h"
+
+uint16_t LiveInputSource::read(int)
+{
+    uint16_t state = 0;
+    const bool buttons[] = {
+        renderer.buttonR, renderer.buttonL, renderer.buttonX, renderer.buttonA,
+        renderer.buttonRight, renderer.buttonLeft, renderer.buttonDown, renderer.buttonUp,
+        renderer.buttonStart, renderer.buttonSelect, renderer.buttonY, renderer.buttonB
+    };
+    for (int i = 0; i < 12; ++i)
+    {
+        if (buttons[i])
+        {
+            state |= 1 << (i + 4);
+        }
+    }
+    return state;
+}
+
+void InputMovie::load(const std::filesystem::path& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw RuntimeError("Could not open movie ", path.string());
+    }
+    uint32_t fileMagic = 0;
+    uint32_t fileVersion = 0;
+    file.read(reinterpret_cast<char*>(&fileMagic), sizeof(fileMagic));
+    file.read(reinterpret_cast<char*>(&fileVersion), sizeof(fileVersion));
+    if (!file || fileMagic != magic)
+    {
+        throw RuntimeError(path.string(), " is not a movie");
+    }
+    if (fileVersion != version)
+    {
+        throw RuntimeError(path.string(), " is a movie of version ", fileVersion, ", expected ", version);
+    }
+    uint32_t saveRamSize = 0;
+    file.read(reinterpret_cast<char*>(&romHash), sizeof(romHash));
+    file.read(reinterpret_cast<char*>(&saveRamSize), sizeof(saveRamSize));
+    saveRam.resize(file ? saveRamSize : 0);
+    file.read(reinterpret_cast<char*>(saveRam.data()), saveRam.size());
+    uint32_t frameCount = 0;
+    file.read(reinterpret_cast<char*>(&frameCount), sizeof(frameCount));
+    frames.resize(file ? frameCount : 0);
+    file.read(reinterpret_cast<char*>(frames.data()), frames.size() * sizeof(uint16_t));
+    if (!file)
+    {
+        throw RuntimeError("Movie ", path.string(), " is truncated");
+    }
+}
+
+void InputMovie::save(const std::filesystem::path& path) const
+{
+    std::ofstream file(path, std::ios::binary);
+    const uint32_t saveRamSize = uint32_t(saveRam.size());
+    const uint32_t frameCount = uint32_t(frames.size());
+    file.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+    file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    file.write(reinterpret_cast<const char*>(&romHash), sizeof(romHash));
+    file.write(reinterpret_cast<const char*>(&saveRamSize), sizeof(saveRamSize));
+    file.write(reinterpret_cast<const char*>(saveRam.data()), saveRam.size());
+    file.write(reinterpret_cast<const char*>(&frameCount), sizeof(frameCount));
+    file.write(reinterpret_cast<const char*>(frames.data()), frames.size() * sizeof(uint16_t));
+    if (!file)
+    {
+        throw RuntimeError("Failed to write movie ", path.string());
+    }
+}
+
+RecordingInputSource::RecordingInputSource(Output& output, std::unique_ptr<InputSource> source, const std::filesystem::path& path, uint64_t romHash, const std::vector<Byte>& saveRam)
+    : output(output, "movie")
+    , source(std::move(source))
+    , path(path)
+{
+    movie.romHash = romHash;
+    movie.saveRam = saveRam;
+    this->output.info("Recording movie to ", path.string());
+}
+
+RecordingInputSource::~RecordingInputSource()
+{
+    stop();
+}
+
+uint16_t RecordingInputSource::read(int frame)
+{
+    const uint16_t state = source->read(frame);
+    if (recording)
+    {
+        movie.frames.resize(frame);
+        movie.frames.push_back(state);
+    }
+    return state;
+}
+
+void RecordingInputSource::stop()
+{
+    if (!recording)
+    {
+        return;
+    }
+    recording = false;
+    try
+    {
+        movie.save(path);
+        output.info("Recorded ", movie.frames.size(), " frames to ", path.string());
+    }
+    catch (const std::exception& e)
+    {
+        output.error(e.what());
+    }
+}
+
+PlaybackInputSource::PlaybackInputSource(Output& output, std::unique_ptr<InputMovie> movie)
+    : output(output, "movie")
+    , movie(std::move(movie))
+{
+}
+
+uint16_t PlaybackInputSource::read(int frame)
+{
+    if (frame < int(movie->frames.size()))
+    {
+        return movie->frames[frame];
+    }
+    if (!ended)
+    {
+        output.info("Movie ended after ", movie->frames.size(), " frames");
+        ended = true;
+    }
+    return 0;
+}
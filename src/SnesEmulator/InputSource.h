@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+#include "Common/Types.h"
+#include "Common/Output.h"
+
+namespace Video {
+class Renderer;
+}
+
+// Where the state of controller 1 comes from. It is read once per frame, by the auto joypad
+// read, in the bit layout of $4218/$4219: B Y Select Start Up Down Left Right A X L R, from
+// bit 15 down to bit 4.
+class InputSource
+{
+public:
+    virtual ~InputSource() = default;
+
+    virtual uint16_t read(int frame) = 0;
+};
+
+// The keyboard and gamepads of the renderer window
+class LiveInputSource : public InputSource
+{
+public:
+    LiveInputSource(const Video::Renderer& renderer)
+        : renderer(renderer)
+    {
+    }
+
+    uint16_t read(int frame) override;
+
+private:
+    const Video::Renderer& renderer;
+};
+
+// The controller state of every frame since power-on. A movie only replays the same way on
+// the ROM image it was recorded with, starting from the same save RAM, so both are part of it.
+//
+// The file is binary, in host byte order: the magic "SNMV", the version, the ROM hash, the
+// byte size and contents of the save RAM, the frame count and a 16-bit state per frame.
+struct InputMovie
+{
+    static constexpr uint32_t magic = 0x564d4e53; // "SNMV"
+    static constexpr uint32_t version = 1;
+
+    uint64_t romHash = 0;
+    std::vector<Byte> saveRam;
+    std::vector<uint16_t> frames;
+
+    void load(const std::filesystem::path& path);
+    void save(const std::filesystem::path& path) const;
+};
+
+// Passes another source through and writes down what it read. Going back to an earlier frame,
+// by rewinding, cuts the movie there, so it always describes the frames as they were played.
+// The file is written when recording stops.
+class RecordingInputSource : public InputSource
+{
+public:
+    RecordingInputSource(Output& output, std::unique_ptr<InputSource> source, const std::filesystem::path& path, uint64_t romHash, const std::vector<Byte>& saveRam);
+    ~RecordingInputSource();
+
+    RecordingInputSource(const RecordingInputSource&) = delete;
+    RecordingInputSource& operator=(const RecordingInputSource&) = delete;
+
+    uint16_t read(int frame) override;
+
+    // Writes the movie and keeps passing the source through without recording
+    void stop();
+
+private:
+    Output output;
+
+    std::unique_ptr<InputSource> source;
+    const std::filesystem::path path;
+    InputMovie movie;
+    bool recording = true;
+};
+
+// Replays a movie, and releases all buttons after its last frame
+class PlaybackInputSource : public InputSource
+{
+public:
+    PlaybackInputSource(Output& output, std::unique_ptr<InputMovie> movie);
+
+    uint16_t read(int frame) override;
+
+    const InputMovie& getMovie() const
+    {
+        return *movie;
+    }
+
+private:
+    Output output;
+
+    std::unique_ptr<InputMovie> movie;
+    bool ended = false;
+};
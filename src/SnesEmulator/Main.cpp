@@ -1,3 +1,4 @@
+#include <cstdint>
 #include <iostream>
 #include <bitset>
 #include <thread>
@@ -7,17 +8,47 @@
 #include "Emulator.h"
 #include "VideoRenderer.h"
 
-int main(int, char**)
+// SnesEmulator [--rewind-budget <MiB>]
+int main(int argc, char** argv)
 {
     Output::System outputSystem("logconfig.txt");
     Output output(outputSystem, "main");
 
+    size_t rewindMemoryBudget = Emulator::defaultRewindMemoryBudget;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string argument = argv[i];
+        // Left at zero by an unknown argument or a bad number, both of which get the usage line
+        unsigned long rewindMegabytes = 0;
+        if (argument == "--rewind-budget" && i + 1 < argc)
+        {
+            try
+            {
+                rewindMegabytes = std::stoul(argv[++i]);
+            }
+            catch (const std::exception& e)
+            {
+                output.error("Bad rewind budget ", argv[i], ": ", e.what());
+            }
+        }
+        if (rewindMegabytes == 0 || rewindMegabytes > (SIZE_MAX >> 20))
+        {
+            output.error("Usage: SnesEmulator [--rewind-budget <MiB>]");
+            return 2;
+        }
+        rewindMemoryBudget = size_t(rewindMegabytes) << 20;
+    }
+
     while (true)
     {
         try
         {
             Rom rom(output);
 
+            // 'r' to record an input movie, 'p' to play it back
+            char movieCommand = 0;
+            std::filesystem::path moviePath;
+
             {
                 std::string pickedTitle;
                 {
@@ -60,6 +91,9 @@ int main(int, char**)
                             {
                                 output.printLine(lock, "Keyboard controls:");
                                 output.printLine(lock, "Toggle fullscreen: Space");
+                                output.printLine(lock, "Save state: F5");
+                                output.printLine(lock, "Load state: F9");
+                                output.printLine(lock, "Rewind: Backspace (hold)");
                                 output.printLine(lock, "Up: W");
                                 output.printLine(lock, "Left: A");
                                 output.printLine(lock, "Down: S");
@@ -73,9 +107,17 @@ int main(int, char**)
                                 output.printLine(lock, "Start: ,");
                                 output.printLine(lock, "Select: .");
                                 output.printLine(lock, "Or connect a controller!");
+                                output.printLine(lock);
+                                output.printLine(lock, "Prefix the game index with r to record an input movie from power-on,");
+                                output.printLine(lock, "or with p to play the recorded movie back (e.g. r3, p3).");
                             }
                             else
                             {
+                                if (command[0] == 'r' || command[0] == 'p')
+                                {
+                                    movieCommand = command[0];
+                                    command = command.substr(1);
+                                }
                                 int inputValue = stoi(command);
                                 --inputValue;
                                 if (inputValue >= 0 && inputValue < titles.size())
@@ -91,9 +133,18 @@ int main(int, char**)
                     }
                 }
                 rom.loadFromFile(System::getRomLibraryPath() / pickedTitle);
+                moviePath = System::getRomLibraryPath() / std::filesystem::path(pickedTitle).replace_extension(".movie");
             }
 
-            Emulator emulator(output, rom);
+            Emulator emulator(output, rom, false, rewindMemoryBudget);
+            if (movieCommand == 'r')
+            {
+                emulator.recordMovie(moviePath);
+            }
+            else if (movieCommand == 'p')
+            {
+                emulator.playMovie(moviePath);
+            }
             emulator.initialize();
             emulator.run();
         }
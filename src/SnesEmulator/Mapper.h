@@ -0,0 +1,232 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+
+#include "Common/Exception.h"
+#include "Common/Types.h"
+
+// Where ROM and save RAM appear in one bank of the CPU address space. ROM is described in
+// 32 KiB halves, save RAM as a window that may be smaller. Whatever is not described here,
+// like WRAM and the registers, is mapped by the emulator itself.
+struct BankDescriptor
+{
+    static constexpr uint32_t halfSize = 0x8000;
+    static constexpr int64_t none = -1;
+
+    // Offset into the ROM image of the $0000-$7FFF and $8000-$FFFF halves, or none
+    std::array<int64_t, 2> romOffset = { none, none };
+
+    // Save RAM is visible at [saveRamStart, saveRamEnd) of the bank, starting at saveRamOffset
+    uint32_t saveRamStart = 0;
+    uint32_t saveRamEnd = 0;
+    uint32_t saveRamOffset = 0;
+
+    // Accesses to the bank are fast when $420D selects FastROM
+    bool fastRom = false;
+
+    bool hasSaveRam() const
+    {
+        return saveRamStart < saveRamEnd;
+    }
+};
+
+// Decodes the cartridge address lines. A mapper describes each bank once, the resulting table
+// is what the memory page map is built from, so no decoding is left for the accesses.
+//
+// Coprocessor cartridges (SA-1, SuperFX) would add mappers of their own that also map their
+// registers and RAM.
+class Mapper
+{
+public:
+    typedef std::array<BankDescriptor, 0x100> BankTable;
+
+    virtual ~Mapper() = default;
+
+    virtual const char* getName() const = 0;
+
+    // Address of the cartridge header in an image using this mapping
+    virtual uint32_t getHeaderAddress() const = 0;
+
+    // The low nibble of the header map mode byte
+    virtual int getMapMode() const = 0;
+
+    BankTable createBankTable(uint32_t romSize, uint32_t saveRamSize) const
+    {
+        BankTable table;
+        for (uint32_t bank = 0; bank < table.size(); ++bank)
+        {
+            BankDescriptor& descriptor = table[bank];
+            describeBank(bank, descriptor);
+            for (int64_t& offset : descriptor.romOffset)
+            {
+                if (offset != BankDescriptor::none)
+                {
+                    offset = mirror(uint32_t(offset), romSize);
+                }
+            }
+            if (saveRamSize == 0)
+            {
+                descriptor.saveRamStart = descriptor.saveRamEnd = 0;
+            }
+            descriptor.fastRom = bank >= 0x80;
+        }
+        return table;
+    }
+
+    // Maps an offset past the end of the image the way the address lines wrap: a 3 MiB image
+    // appears as 2 MiB followed by the last 1 MiB twice
+    static uint32_t mirror(uint32_t offset, uint32_t size)
+    {
+        if (size == 0)
+        {
+            return 0;
+        }
+        uint32_t base = 0;
+        uint32_t mask = 1 << 23;
+        while (offset >= size)
+        {
+            while (!(offset & mask))
+            {
+                mask >>= 1;
+            }
+            offset -= mask;
+            if (size > mask)
+            {
+                size -= mask;
+                base += mask;
+            }
+            mask >>= 1;
+        }
+        return base + offset;
+    }
+
+protected:
+    virtual void describeBank(uint32_t bank, BankDescriptor& descriptor) const = 0;
+
+    static bool isSystemBank(uint32_t bank)
+    {
+        return (bank & 0x40) == 0;
+    }
+
+    static bool isWorkRamBank(uint32_t bank)
+    {
+        return bank == 0x7e || bank == 0x7f;
+    }
+};
+
+// Mode 20: 32 KiB of ROM in the upper half of every bank, save RAM in the lower half of banks $70-$7D
+class LoRomMapper : public Mapper
+{
+public:
+    const char* getName() const override
+    {
+        return "LoROM";
+    }
+
+    uint32_t getHeaderAddress() const override
+    {
+        return 0x7fc0;
+    }
+
+    int getMapMode() const override
+    {
+        return 0x0;
+    }
+
+protected:
+    void describeBank(uint32_t bank, BankDescriptor& descriptor) const override
+    {
+        if (isWorkRamBank(bank))
+        {
+            return;
+        }
+        const uint32_t offset = (bank & 0x7f) * BankDescriptor::halfSize;
+        descriptor.romOffset[1] = offset;
+        const uint32_t lowBank = bank & 0x7f;
+        if (lowBank >= 0x70)
+        {
+            descriptor.saveRamStart = 0x0000;
+            descriptor.saveRamEnd = 0x8000;
+            descriptor.saveRamOffset = (lowBank - 0x70) * BankDescriptor::halfSize;
+        }
+        else if (!isSystemBank(bank))
+        {
+            descriptor.romOffset[0] = offset;
+        }
+    }
+};
+
+// Mode 21: 64 KiB of ROM in banks $40-$7D, the upper halves mirrored in the system banks,
+// 8 KiB windows of save RAM at $6000-$7FFF of banks $20-$3F
+class HiRomMapper : public Mapper
+{
+public:
+    const char* getName() const override
+    {
+        return "HiROM";
+    }
+
+    uint32_t getHeaderAddress() const override
+    {
+        return 0xffc0;
+    }
+
+    int getMapMode() const override
+    {
+        return 0x1;
+    }
+
+protected:
+    void describeBank(uint32_t bank, BankDescriptor& descriptor) const override
+    {
+        if (isWorkRamBank(bank))
+        {
+            return;
+        }
+        const uint32_t offset = (bank & 0x3f) * 0x10000 + getBaseOffset(bank);
+        descriptor.romOffset[1] = offset + BankDescriptor::halfSize;
+        if (!isSystemBank(bank))
+        {
+            descriptor.romOffset[0] = offset;
+        }
+        else if ((bank & 0x7f) >= 0x20)
+        {
+            descriptor.saveRamStart = 0x6000;
+            descriptor.saveRamEnd = 0x8000;
+            descriptor.saveRamOffset = (bank & 0x1f) * 0x2000;
+        }
+    }
+
+    virtual uint32_t getBaseOffset(uint32_t) const
+    {
+        return 0;
+    }
+};
+
+// Mode 25: HiROM for images over 4 MiB, the first 4 MiB in banks $C0-$FF and the rest in $40-$7D
+class ExHiRomMapper : public HiRomMapper
+{
+public:
+    const char* getName() const override
+    {
+        return "ExHiROM";
+    }
+
+    uint32_t getHeaderAddress() const override
+    {
+        return 0x40ffc0;
+    }
+
+    int getMapMode() const override
+    {
+        return 0x5;
+    }
+
+protected:
+    uint32_t getBaseOffset(uint32_t bank) const override
+    {
+        return bank & 0x80 ? 0 : 0x400000;
+    }
+};
@@ -0,0 +1,269 @@
+#include "RewindBuffer.h"
+
+#include <cstring>
+
+#include "Common/SaveState.h"
+
+#define PROFILING_ENABLED false
+
+#include "Profiler.h"
+
+CREATE_PROFILER();
+
+namespace {
+
+// Shorter runs of unchanged bytes cost more as separate tokens than as part of the literal
+constexpr size_t minimumRun = 4;
+
+uint64_t load(const uint8_t* data)
+{
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+void writeCount(std::vector<uint8_t>& delta, size_t count)
+{
+    while (count >= 0x80)
+    {
+        delta.push_back(uint8_t(count | 0x80));
+        count >>= 7;
+    }
+    delta.push_back(uint8_t(count));
+}
+
+size_t readCount(const std::vector<uint8_t>& delta, size_t& position)
+{
+    size_t count = 0;
+    for (int shift = 0; ; shift += 7)
+    {
+        if (position == delta.size() || shift >= 64)
+        {
+            throw SaveState::FormatError("Truncated rewind delta");
+        }
+        const uint8_t byte = delta[position++];
+        count |= size_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return count;
+        }
+    }
+}
+
+}
+
+RewindBuffer::RewindBuffer(size_t memoryBudget)
+    : memoryBudget(memoryBudget)
+{
+}
+
+RewindBuffer::~RewindBuffer()
+{
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        run = false;
+    }
+    condition.notify_all();
+    if (worker.joinable())
+    {
+        worker.join();
+    }
+}
+
+void RewindBuffer::submit()
+{
+    if (!worker.joinable())
+    {
+        worker = std::thread(&RewindBuffer::runWorker, this);
+    }
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        captureBuffer.swap(pendingBuffer);
+        pending = true;
+    }
+    condition.notify_all();
+}
+
+bool RewindBuffer::pop(std::vector<uint8_t>& state)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this]() { return !processing; });
+
+    if (pending)
+    {
+        // Newer than anything encoded
+        state.swap(pendingBuffer);
+        pending = false;
+        return true;
+    }
+    if (latest.empty())
+    {
+        return false;
+    }
+
+    state = latest;
+    if (deltas.empty())
+    {
+        latest.clear();
+    }
+    else
+    {
+        PROFILE_SCOPE("Decode rewind delta");
+        decode(deltas.back(), latest);
+        deltaBytes -= deltas.back().size();
+        deltas.pop_back();
+    }
+    return true;
+}
+
+void RewindBuffer::clear()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this]() { return !processing; });
+    pending = false;
+    latest.clear();
+    deltas.clear();
+    deltaBytes = 0;
+}
+
+size_t RewindBuffer::getStateCount() const
+{
+    std::scoped_lock<std::mutex> lock(mutex);
+    return latest.empty() ? 0 : deltas.size() + 1;
+}
+
+size_t RewindBuffer::getMemoryUsage() const
+{
+    std::scoped_lock<std::mutex> lock(mutex);
+    return latest.size() + deltaBytes;
+}
+
+void RewindBuffer::runWorker()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        condition.wait(lock, [this]() { return pending || !run; });
+        if (!run)
+        {
+            return;
+        }
+        workBuffer.swap(pendingBuffer);
+        pending = false;
+        processing = true;
+
+        // latest is only touched while not processing, so it can be read without the lock
+        lock.unlock();
+        const bool chained = !latest.empty() && latest.size() == workBuffer.size();
+        if (chained)
+        {
+            PROFILE_SCOPE("Encode rewind delta");
+            encode(latest, workBuffer, deltaBuffer);
+        }
+        lock.lock();
+
+        if (!chained)
+        {
+            // The first state, or one that does not line up with the previous
+            deltas.clear();
+            deltaBytes = 0;
+        }
+        else
+        {
+            deltas.emplace_back(deltaBuffer.begin(), deltaBuffer.end());
+            deltaBytes += deltaBuffer.size();
+        }
+        latest.swap(workBuffer);
+        evict();
+
+        processing = false;
+        condition.notify_all();
+    }
+}
+
+void RewindBuffer::evict()
+{
+    while (!deltas.empty() && latest.size() + deltaBytes > memoryBudget)
+    {
+        deltaBytes -= deltas.front().size();
+        deltas.pop_front();
+    }
+}
+
+void RewindBuffer::encode(const std::vector<uint8_t>& from, const std::vector<uint8_t>& to, std::vector<uint8_t>& delta)
+{
+    delta.clear();
+    const uint8_t* const a = from.data();
+    const uint8_t* const b = to.data();
+    const size_t size = to.size();
+
+    size_t position = 0;
+    while (position < size)
+    {
+        // Unchanged bytes, a word at a time
+        const size_t runStart = position;
+        while (position + sizeof(uint64_t) <= size && load(a + position) == load(b + position))
+        {
+            position += sizeof(uint64_t);
+        }
+        while (position < size && a[position] == b[position])
+        {
+            ++position;
+        }
+        if (position == size)
+        {
+            break;
+        }
+
+        // Changed bytes, including unchanged runs too short to be worth a token of their own
+        const size_t literalStart = position;
+        while (position < size)
+        {
+            if (a[position] != b[position])
+            {
+                ++position;
+                continue;
+            }
+            size_t equal = 1;
+            while (equal < minimumRun && position + equal < size && a[position + equal] == b[position + equal])
+            {
+                ++equal;
+            }
+            if (equal == minimumRun || position + equal == size)
+            {
+                break;
+            }
+            position += equal;
+        }
+
+        writeCount(delta, literalStart - runStart);
+        writeCount(delta, position - literalStart);
+        const size_t offset = delta.size();
+        delta.resize(offset + position - literalStart);
+        for (size_t i = literalStart; i < position; ++i)
+        {
+            delta[offset + i - literalStart] = a[i] ^ b[i];
+        }
+    }
+}
+
+void RewindBuffer::decode(const std::vector<uint8_t>& delta, std::vector<uint8_t>& state)
+{
+    size_t deltaPosition = 0;
+    size_t position = 0;
+    while (deltaPosition < delta.size())
+    {
+        position += readCount(delta, deltaPosition);
+        const size_t count = readCount(delta, deltaPosition);
+        if (position + count > state.size() || deltaPosition + count > delta.size())
+        {
+            throw SaveState::FormatError("Rewind delta does not fit the state");
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            state[position + i] ^= delta[deltaPosition + i];
+        }
+        position += count;
+        deltaPosition += count;
+    }
+}
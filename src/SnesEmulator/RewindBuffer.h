@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Keeps the recent past of the machine as a chain of save states. Only the newest state is
+// kept in full, every older one is stored as the XOR of two neighbouring states, run-length
+// encoded. Between frames most of the machine is unchanged, so the XOR is almost all zeros
+// and a delta usually takes a few kilobytes.
+//
+// The emulation thread only writes a snapshot into the capture buffer and swaps it over to
+// the worker thread, which does the encoding. The worker is started by the first snapshot, so a
+// buffer that never gets one costs no thread. When the memory budget is exceeded the oldest
+// deltas are dropped.
+class RewindBuffer
+{
+public:
+    RewindBuffer(size_t memoryBudget);
+    ~RewindBuffer();
+
+    RewindBuffer(const RewindBuffer&) = delete;
+    RewindBuffer& operator=(const RewindBuffer&) = delete;
+
+    // The buffer to write the next snapshot into, owned by the emulation thread until submit()
+    std::vector<uint8_t>& getCaptureBuffer()
+    {
+        return captureBuffer;
+    }
+
+    // Hands the capture buffer over to the worker without waiting for it, starting the worker the
+    // first time. If the worker has not picked up the previous snapshot yet, that one is replaced.
+    void submit();
+
+    // Takes the most recent snapshot out of the buffer. Returns false if there is none.
+    bool pop(std::vector<uint8_t>& state);
+
+    void clear();
+
+    size_t getStateCount() const;
+    size_t getMemoryUsage() const;
+
+    // The delta format is a sequence of (unchanged byte count, changed byte count, XOR of the
+    // changed bytes), the counts as 7-bit varints. Decoding XORs the delta into the state in place,
+    // which turns either of the two encoded states into the other.
+    static void encode(const std::vector<uint8_t>& from, const std::vector<uint8_t>& to, std::vector<uint8_t>& delta);
+    static void decode(const std::vector<uint8_t>& delta, std::vector<uint8_t>& state);
+
+private:
+    void runWorker();
+    void evict();
+
+    const size_t memoryBudget;
+
+    std::vector<uint8_t> captureBuffer;
+    std::vector<uint8_t> pendingBuffer;
+    std::vector<uint8_t> workBuffer;
+    std::vector<uint8_t> deltaBuffer;
+    bool pending = false;
+    bool processing = false;
+
+    // The newest state, and the deltas leading back from it, oldest first
+    std::vector<uint8_t> latest;
+    std::deque<std::vector<uint8_t>> deltas;
+    size_t deltaBytes = 0;
+
+    bool run = true;
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    std::thread worker;
+};
@@ -6,10 +6,15 @@
 #include <vector>
 #include <bitset>
 #include <algorithm>
+#include <span>
 
 #include "Common/Types.h"
+#include "Common/Hash.h"
+#include "Common/MappedFile.h"
 #include "WDC65816/CpuState.h"
 
+#include "Mapper.h"
+
 class Rom
 {
 public:
@@ -27,51 +32,70 @@ public:
     {
         output.debug("Reading ", path);
 
-        std::vector<char> rom;
-
-        std::ifstream ifs(path, std::ios::binary | std::ios::ate);
-        if (!ifs) {
-            throw std::runtime_error("Could not read " + path.string());
-        }
-        std::ifstream::pos_type pos = ifs.tellg();
+        file.open(path);
 
-        output.debug("Reading ", pos, " bytes");
+        output.debug("Mapped ", file.size(), " bytes");
 
-        rom.resize((size_t)pos);
+        data = std::span<const Byte>(static_cast<const Byte*>(file.data()), file.size());
 
-        ifs.seekg(0, std::ios::beg);
-        ifs.read(rom.data(), pos);
+        // Copiers prepended a 512 byte header of their own
+        if (data.size() % 0x8000 == copierHeaderSize) {
+            output.debug("Skipping copier header");
+            data = data.subspan(copierHeaderSize);
+        }
 
-        data.resize(rom.size());
-        std::transform(rom.begin(), rom.end(), data.begin(), [](char c) { return Byte(c); });
+        // Regions are mapped in whole pages, an odd-sized image gets a padded copy
+        if (data.size() % pageSize != 0) {
+            paddedData.assign(data.begin(), data.end());
+            paddedData.resize(data.size() + pageSize - data.size() % pageSize);
+            data = std::span<const Byte>(paddedData.data(), paddedData.size());
+        }
 
-        if (!tryReadHeader(0x8000) && !tryReadHeader(0)) {
+        const std::array<std::shared_ptr<Mapper>, 3> mappers = {
+            std::make_shared<LoRomMapper>(),
+            std::make_shared<HiRomMapper>(),
+            std::make_shared<ExHiRomMapper>()
+        };
+        const uint16_t checksum = computeChecksum();
+        int bestScore = -1;
+        for (const std::shared_ptr<Mapper>& candidate : mappers) {
+            const int score = scoreHeader(*candidate, checksum);
+            output.debug(candidate->getName(), " header score: ", score);
+            if (score > bestScore) {
+                bestScore = score;
+                mapper = candidate;
+            }
+        }
+        if (bestScore < 0) {
             throw std::runtime_error("Could not read header");
         }
+
+        readHeader(mapper->getHeaderAddress());
+
+        if ((cartridgeType & 0xf0) == 0x10 || (cartridgeType & 0xf0) == 0x30 || (mapMode & 0x0f) == 0x3) {
+            throw NotYetImplementedException("Coprocessor cartridges are not supported, cartridge type ", cartridgeType, ", map mode ", mapMode);
+        }
     }
 
+    // Maps the image straight into the banks the mapper puts it in, without copying it
     void storeToMemory(CPU::State& state) const
     {
-        bool romLoaded = false;
-
-        int romIndex = 0;
-        for (int bank = 0; bank < Byte::spaceSize; ++bank) {
-            for (int address = 0x8000; address < Word::spaceSize; ++address) {
-                Long longAddress = Long(Word(address), Byte(bank));
-                state.createMemoryLocation<ReadOnlyMemory>(longAddress, data[romIndex++]);
-                if (romIndex >= (int)data.size()) {
-                    output.debug("ROM ends at ", longAddress);
-                    romLoaded = true;
-                    break;
-                }
-            }
-            if (romLoaded) {
-                break;
-            }
+        if (data.empty()) {
+            throw std::runtime_error("ROM not loaded");
         }
 
-        if (!romLoaded) {
-            throw std::runtime_error("ROM not fully loaded");
+        CPU::State::MemoryType& memory = state.getMemory();
+        std::shared_ptr<MemoryRegion> region = std::make_shared<MemoryRegion>(data.data(), uint32_t(data.size()));
+
+        const Mapper::BankTable table = getBankTable();
+        for (uint32_t bank = 0; bank < table.size(); ++bank) {
+            for (uint32_t half = 0; half < 2; ++half) {
+                const int64_t offset = table[bank].romOffset[half];
+                if (offset != BankDescriptor::none) {
+                    const uint32_t size = std::min<uint32_t>(BankDescriptor::halfSize, uint32_t(data.size() - offset));
+                    memory.mapRegion(Long(Word(half * BankDescriptor::halfSize), Byte(bank)), region, uint32_t(offset), size);
+                }
+            }
         }
 
         state.loadInterruptVectors();
@@ -99,34 +123,102 @@ public:
         output.debug();
     }
 
-    bool isLowRom() const
+    Mapper::BankTable getBankTable() const
+    {
+        return mapper->createBankTable(uint32_t(data.size()), saveRamSize);
+    }
+
+    const Mapper& getMapper() const
+    {
+        return *mapper;
+    }
+
+    // Identifies the image regardless of file name and copier header
+    uint64_t computeHash() const
     {
-        return mapMode == 0x20 || mapMode == 0x30;
+        return Hash::fnv1a(data.data(), data.size());
     }
 
 private:
-    bool tryReadHeader(Word offset)
+    // Rates how plausible a header at the place the mapper expects it is, or -1 if there is none
+    int scoreHeader(const Mapper& candidate, uint16_t checksum) const
     {
-        output.debug("Trying to read ROM header assuming address offset ", offset);
+        const uint32_t header = candidate.getHeaderAddress();
+        if (data.size() < header + 0x40) {
+            return -1;
+        }
+        int score = 0;
+        const uint16_t storedComplement = readWord(header + 0x1c);
+        const uint16_t storedChecksum = readWord(header + 0x1e);
+        if (uint16_t(storedChecksum + storedComplement) == 0xffff) {
+            score += 4;
+            if (storedChecksum == checksum) {
+                score += 8;
+            }
+        }
+        if ((readByte(header + 0x15) & 0x0f) == candidate.getMapMode() && (readByte(header + 0x15) & 0xe0) == 0x20) {
+            score += 2;
+        }
+        if (readWord(header + 0x3c) >= 0x8000) {
+            score += 2;
+        }
+        if (readByte(header + 0x17) >= 0x07 && readByte(header + 0x17) <= 0x0d) {
+            score += 1;
+        }
+        if (readByte(header + 0x18) <= 0x08) {
+            score += 1;
+        }
+        bool printableTitle = true;
+        for (uint32_t i = 0; i < titleSize; ++i) {
+            printableTitle &= readByte(header + i) >= 0x20 && readByte(header + i) < 0x7f;
+        }
+        if (printableTitle) {
+            score += 1;
+        }
+        return score;
+    }
 
-        if ((int)data.size() < 0x10000 - offset) {
-            output.debug("Rom too small");
-            return false;
+    // The sum of all bytes, with the image repeated up to a power of two size as the mapping does
+    uint16_t computeChecksum() const
+    {
+        uint32_t size = 1;
+        while (size < data.size()) {
+            size <<= 1;
         }
+        uint16_t sum = 0;
+        for (uint32_t offset = 0; offset < size; ++offset) {
+            sum += uint8_t(data[Mapper::mirror(offset, uint32_t(data.size()))]);
+        }
+        return sum;
+    }
 
-        output.debug("Maker code: ", data[0xFFD6 - offset]);
+    uint8_t readByte(uint32_t address) const
+    {
+        return uint8_t(data[address]);
+    }
 
-        for (int i = 0; i < 21; ++i) {
-            gameTitle.push_back(data[0xFFC0 + size_t(i) - size_t(offset)]);
+    uint16_t readWord(uint32_t address) const
+    {
+        return uint16_t(readByte(address) | readByte(address + 1) << 8);
+    }
+
+    void readHeader(uint32_t header)
+    {
+        output.debug("Reading ", mapper->getName(), " header at ", Long(header));
+
+        output.debug("Maker code: ", data[header + 0x16]);
+
+        for (uint32_t i = 0; i < titleSize; ++i) {
+            gameTitle.push_back(data[header + i]);
         }
 
-        mapMode = data[0xFFD5 - offset];
+        mapMode = data[header + 0x15];
 
-        cartridgeType = data[0xFFD6 - offset];
+        cartridgeType = data[header + 0x16];
 
-        romSize = 0x400 << data[0xFFD7 - offset];
+        romSize = 0x400 << data[header + 0x17];
 
-        saveRamSize = 0x400 << data[0xFFD8 - offset];
+        saveRamSize = data[header + 0x18] ? 0x400 << data[header + 0x18] : 0;
 
         output.debug("Game Title=", gameTitle);
         output.debug("Map Mode=", mapMode);
@@ -134,12 +226,17 @@ private:
         output.debug("ROM Size=", romSize);
         output.debug("SaveRAM Size=", saveRamSize);
         output.debug();
-
-        return true;
     }
 
 private:
-    std::vector<Byte> data;
+    static constexpr uint32_t pageSize = CPU::State::MemoryType::pageSize;
+    static constexpr size_t copierHeaderSize = 0x200;
+    static constexpr uint32_t titleSize = 21;
+
+    MappedFile file;
+    std::vector<Byte> paddedData;
+    std::span<const Byte> data;
+    std::shared_ptr<Mapper> mapper;
     Output output;
 
 public:
@@ -0,0 +1,202 @@
+#include "SaveRamSaver.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include "Common/Exception.h"
+
+SaveRamSaver::SaveRamSaver(Output& output, const Rom& rom)
+    : output(output, "saveram")
+    , rom(rom)
+    , saveRam(rom.saveRamSize)
+    , blockSize(std::max<size_t>((rom.saveRamSize + blockCount - 1) / blockCount, 1))
+    , sharedRam(rom.saveRamSize)
+    , image(rom.saveRamSize)
+{
+}
+
+SaveRamSaver::~SaveRamSaver()
+{
+    stop();
+}
+
+void SaveRamSaver::load(Byte fill)
+{
+    clear(fill);
+    if (saveRam.empty())
+    {
+        return;
+    }
+    const bool converting = !loadBinary(getPath()) && loadText(getTextPath());
+    image = saveRam;
+    if (converting)
+    {
+        output.info("Converting ", getTextPath().string(), " to ", getPath().string());
+        writeFile();
+    }
+}
+
+void SaveRamSaver::clear(Byte fill)
+{
+    std::fill(saveRam.begin(), saveRam.end(), fill);
+    image = saveRam;
+}
+
+void SaveRamSaver::assign(const std::vector<Byte>& contents)
+{
+    if (contents.size() != saveRam.size())
+    {
+        throw RuntimeError("Save RAM of ", contents.size(), " bytes given, expected ", saveRam.size());
+    }
+    saveRam = contents;
+    image = saveRam;
+}
+
+void SaveRamSaver::start()
+{
+    if (saveRam.empty())
+    {
+        return;
+    }
+    running = true;
+    thread = std::thread(&SaveRamSaver::run, this);
+}
+
+void SaveRamSaver::stop()
+{
+    if (!thread.joinable())
+    {
+        return;
+    }
+    update();
+    {
+        std::scoped_lock<std::mutex> lock(mutex);
+        running = false;
+    }
+    condition.notify_one();
+    thread.join();
+}
+
+void SaveRamSaver::update()
+{
+    if (!dirtyBlocks)
+    {
+        return;
+    }
+    std::scoped_lock<std::mutex> lock(mutex);
+    for (int block = 0; block < blockCount; ++block)
+    {
+        if (!(dirtyBlocks & uint64_t(1) << block))
+        {
+            continue;
+        }
+        const size_t start = block * blockSize;
+        if (start >= saveRam.size())
+        {
+            break;
+        }
+        const size_t size = std::min(blockSize, saveRam.size() - start);
+        std::copy_n(saveRam.begin() + start, size, sharedRam.begin() + start);
+    }
+    sharedBlocks |= dirtyBlocks;
+    dirtyBlocks = 0;
+}
+
+void SaveRamSaver::run()
+{
+    bool stopping = false;
+    while (!stopping)
+    {
+        bool changed = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            // Anything handed over before stopping is flushed as well
+            stopping = condition.wait_for(lock, writeInterval, [this]() { return !running; });
+            changed = collect();
+        }
+        // Without holding up the emulator thread
+        if (changed)
+        {
+            writeFile();
+        }
+    }
+}
+
+bool SaveRamSaver::collect()
+{
+    const uint64_t blocks = sharedBlocks;
+    sharedBlocks = 0;
+    bool changed = false;
+    for (int block = 0; block < blockCount; ++block)
+    {
+        if (!(blocks & uint64_t(1) << block))
+        {
+            continue;
+        }
+        const size_t start = block * blockSize;
+        if (start >= sharedRam.size())
+        {
+            break;
+        }
+        const size_t size = std::min(blockSize, sharedRam.size() - start);
+        if (!std::equal(sharedRam.begin() + start, sharedRam.begin() + start + size, image.begin() + start))
+        {
+            std::copy_n(sharedRam.begin() + start, size, image.begin() + start);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+void SaveRamSaver::writeFile()
+{
+    const std::filesystem::path path = getPath();
+    std::filesystem::path temporaryPath = path;
+    temporaryPath += ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(image.data()), image.size());
+        if (!file)
+        {
+            output.error("Failed to write ", temporaryPath.string());
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error)
+    {
+        output.error("Failed to replace ", path.string(), ": ", error.message());
+    }
+}
+
+bool SaveRamSaver::loadBinary(const std::filesystem::path& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    file.read(reinterpret_cast<char*>(saveRam.data()), saveRam.size());
+    if (file.gcount() != std::streamsize(saveRam.size()))
+    {
+        output.error(path.string(), " has ", file.gcount(), " bytes, expected ", saveRam.size());
+    }
+    return true;
+}
+
+bool SaveRamSaver::loadText(const std::filesystem::path& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        return false;
+    }
+    file >> std::hex;
+    int inputValue;
+    for (size_t address = 0; address < saveRam.size() && file >> inputValue; ++address)
+    {
+        saveRam[address] = Byte(inputValue);
+    }
+    return true;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Common/Types.h"
+#include "Common/Output.h"
+#include "Common/System.h"
+
+#include "Rom.h"
+
+// Owns the cartridge save RAM and keeps its file up to date. Writes from the CPU only update
+// the RAM and set a bit in a dirty bitmap. Once a frame, the emulator thread copies the dirty
+// blocks to a buffer shared with a worker thread, which never reads the RAM the game keeps
+// writing. The worker looks at the shared blocks at a fixed interval, so a game writing save
+// RAM every frame costs one file write per interval, and the file is replaced atomically by
+// writing a temporary file and renaming it.
+//
+// The file is a raw binary image, <title>.srm. A <title>.save in the old text format of
+// space-separated hexadecimal values is read if there is no binary image yet.
+class SaveRamSaver
+{
+public:
+    static constexpr std::chrono::milliseconds writeInterval = std::chrono::milliseconds(1000);
+    static constexpr int blockCount = 64;
+
+    SaveRamSaver(Output& output, const Rom& rom);
+    ~SaveRamSaver();
+
+    SaveRamSaver(const SaveRamSaver&) = delete;
+    SaveRamSaver& operator=(const SaveRamSaver&) = delete;
+
+    // Reads the file, or leaves the RAM filled with the given value if there is none
+    void load(Byte fill);
+
+    // Fills the RAM without looking at the file, which is then only written if start is called
+    void clear(Byte fill);
+
+    // Replaces the RAM without looking at the file, e.g. with the power-on state of a movie
+    void assign(const std::vector<Byte>& contents);
+
+    void start();
+
+    // Hands the writes since the last update over to the worker, flushing them to the file
+    void stop();
+
+    // From the emulator thread, once a frame: hands the dirty blocks over to the worker
+    void update();
+
+    Byte read(Long address) const
+    {
+        return saveRam[address];
+    }
+
+    void write(Long address, Byte value)
+    {
+        if (saveRam[address] != value)
+        {
+            saveRam[address] = value;
+            dirtyBlocks |= uint64_t(1) << (address / blockSize);
+        }
+    }
+
+    // After the whole RAM was replaced, e.g. by loading a state
+    void markAllDirty()
+    {
+        dirtyBlocks = ~uint64_t(0);
+    }
+
+    Byte* data()
+    {
+        return saveRam.data();
+    }
+
+    size_t size() const
+    {
+        return saveRam.size();
+    }
+
+private:
+    void run();
+
+    // Copies the blocks handed over to the image, returns true if that changed it
+    bool collect();
+    void writeFile();
+
+    bool loadBinary(const std::filesystem::path& path);
+    bool loadText(const std::filesystem::path& path);
+
+    std::filesystem::path getPath() const
+    {
+        return System::getRomLibraryPath() / (rom.gameTitle + ".srm");
+    }
+
+    std::filesystem::path getTextPath() const
+    {
+        return System::getRomLibraryPath() / (rom.gameTitle + ".save");
+    }
+
+    Output output;
+
+    const Rom& rom;
+
+    // Only touched by the emulator thread
+    std::vector<Byte> saveRam;
+    const size_t blockSize;
+    uint64_t dirtyBlocks = 0;
+
+    // Copies of the blocks updated since the worker last looked, under the mutex
+    std::vector<Byte> sharedRam;
+    uint64_t sharedBlocks = 0;
+
+    // What was last written to the file, only touched by the worker
+    std::vector<Byte> image;
+
+    bool running = false;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::thread thread;
+};
@@ -19,6 +19,18 @@ struct Table
     Table(const Table&) = delete;
     Table& operator=(const Table&) = delete;
 
+    // Tables are only copied on purpose, into another of the same size, like for a snapshot
+    void copyFrom(const Table& other)
+    {
+        if (other.size != size) {
+            throw AccessException("Processor::Table::copyFrom: Size mismatch, ", other.size, " != ", size);
+        }
+        currentAddress = other.currentAddress;
+        lowTable = other.lowTable;
+        highTable = other.highTable;
+        currentHighTableSelect = other.currentHighTableSelect;
+    }
+
     void setAddress(Word value)
     {
         currentAddress = value;
@@ -81,6 +93,15 @@ struct Table
         currentHighTableSelect = !currentHighTableSelect;
     }
 
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        archive(currentAddress);
+        archive.bytes(lowTable.data(), lowTable.size());
+        archive.bytes(highTable.data(), highTable.size());
+        archive(currentHighTableSelect);
+    }
+
     const Word size = 0;
     Word currentAddress = 0;
     std::vector<Byte> lowTable;
@@ -102,6 +123,14 @@ struct ReadTwiceRegister
 			return value.getHighByte();
         }
     }
+
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        archive(value);
+        archive(highByteSelect);
+    }
+
     Word value;
     bool highByteSelect = false;
 };
@@ -117,6 +146,14 @@ struct WriteTwiceRegister
         }
         highByteSelect = !highByteSelect;
     }
+
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        archive(value);
+        archive(highByteSelect);
+    }
+
     Word value;
     bool highByteSelect = false;
 };
@@ -153,6 +190,18 @@ struct Object
 
 struct Background
 {
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        archive(tilemapAddress);
+        archive(horizontalMirroring);
+        archive(verticalMirroring);
+        archive(characterAddress);
+        archive(horizontalScroll);
+        archive(verticalScroll);
+        archive(bitsPerPixel);
+    }
+
     Word tilemapAddress;
     bool horizontalMirroring = false;
     bool verticalMirroring = false;
@@ -212,6 +261,14 @@ struct ColorComponents
         return blue << 10 | green << 5 | red;
     }
 
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        archive(red);
+        archive(green);
+        archive(blue);
+    }
+
     Byte red;
     Byte green;
     Byte blue;
@@ -1,45 +1,211 @@
 #pragma once
 
-#include "VideoProcessor.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 
-//#define DEBUGOAM
-//#define DEBUGBG
-//#define DEBUGSPRITES
-//#define DEBUGMODE7
+#include "VideoProcessor.h"
 
 namespace Video {
 
-class OamViewer
+// The video state the viewers draw from, copied from the processor at the end of a frame, so
+// that a viewer never sees a frame half-way through and never touches the processor itself
+struct ViewerSnapshot
+{
+    ViewerSnapshot(const Processor& video)
+        : vram(video.vram.size)
+        , cgram(video.cgram.size)
+        , oam(video.oam.size)
+    {
+    }
+
+    void capture(const Processor& video)
+    {
+        vram.copyFrom(video.vram);
+        cgram.copyFrom(video.cgram);
+        oam.copyFrom(video.oam);
+        objectPriority = video.objectPriority;
+        backgroundMode = video.backgroundMode;
+        objectSizeIndex = video.objectSizeIndex;
+        nameSelect = video.nameSelect;
+        nameBaseSelect = video.nameBaseSelect;
+        backgrounds = video.backgrounds;
+    }
+
+    Object readObject(int index) const
+    {
+        return Processor::readObject(oam, index);
+    }
+
+    int getObjectSize(bool sizeSelect) const
+    {
+        return Processor::getObjectSize(objectSizeIndex, sizeSelect);
+    }
+
+    Table vram;
+    Table cgram;
+    Table oam;
+
+    bool objectPriority = false;
+    Byte backgroundMode;
+    Byte objectSizeIndex;
+    Word nameSelect;
+    Word nameBaseSelect;
+    std::vector<Background> backgrounds;
+};
+
+// A debug window drawing some part of the video state on a thread of its own. Viewers are only
+// created when opened from the debugger. While one is open, the emulator thread offers it a
+// snapshot at the end of every frame, which is only taken every snapshotInterval, and only if
+// the viewer is not busy picking up the previous one.
+class Viewer
 {
 public:
-    static const int firstObjectIndex = 0;
-    static const int spriteSize = 16;
+    static constexpr std::chrono::milliseconds snapshotInterval = std::chrono::milliseconds(100);
 
-#ifdef DEBUGOAM
-    OamViewer(Processor& video, int windowXPosition, int windowYPosition)
-        : video(video)
-        , renderer(windowXPosition, windowYPosition, 0x80, 0x100, 2.f, true, video.output)
+    // oam, bg1-bg4, obj1-obj4 or mode7, or null if there is no viewer by that name
+    static std::unique_ptr<Viewer> create(Processor& video, const std::string& name);
+
+    Viewer(Processor& video, const std::string& title, int windowXPosition, int windowYPosition, int width, int height, float scale)
+        : output(video.output, "viewer")
+        , renderer(windowXPosition, windowYPosition, width, height, scale, true, video.output)
+        , video(video)
+        , title(title)
+        , pendingSnapshot(std::make_unique<ViewerSnapshot>(video))
+        , drawnSnapshot(std::make_unique<ViewerSnapshot>(video))
     {
-        thread = std::thread(std::ref(*this));
     }
 
-    ~OamViewer()
+    // Derived viewers close in their own destructors, while draw can still be called
+    virtual ~Viewer() = default;
+
+    Viewer(const Viewer&) = delete;
+    Viewer& operator=(const Viewer&) = delete;
+
+    void open()
+    {
+        running = true;
+        thread = std::thread(&Viewer::run, this);
+    }
+
+    void close()
     {
         running = false;
-        thread.join();
+        snapshotCondition.notify_one();
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    // True once the user has closed the window, or the window failed to open
+    bool isWindowClosed() const
+    {
+        return windowClosed;
     }
 
-    void operator()()
+    // Emulator thread, at the end of a frame
+    void offerSnapshot(bool force)
     {
-        renderer.title = "OAM viewer";
-        renderer.initialize();
-        while (running && renderer.isRunning())
+        const std::chrono::steady_clock::time_point currentTime = std::chrono::steady_clock::now();
+        if (!force && currentTime - lastSnapshotTime < snapshotInterval)
         {
-            renderer.update();
+            return;
         }
+        std::unique_lock<std::mutex> lock(snapshotMutex, std::try_to_lock);
+        if (!lock.owns_lock())
+        {
+            return;
+        }
+        pendingSnapshot->capture(video);
+        snapshotPending = true;
+        lastSnapshotTime = currentTime;
+        lock.unlock();
+        snapshotCondition.notify_one();
+    }
+
+protected:
+    virtual void draw(const ViewerSnapshot& snapshot) = 0;
+
+    Output output;
+    Renderer renderer;
+
+private:
+    void run()
+    {
+        try
+        {
+            renderer.title = title;
+            renderer.initialize();
+            while (running && renderer.isRunning())
+            {
+                bool snapshotTaken = false;
+                {
+                    std::unique_lock<std::mutex> lock(snapshotMutex);
+                    snapshotCondition.wait_for(lock, Renderer::inputPollInterval, [this]() { return snapshotPending || !running; });
+                    if (snapshotPending)
+                    {
+                        std::swap(pendingSnapshot, drawnSnapshot);
+                        snapshotPending = false;
+                        snapshotTaken = true;
+                    }
+                }
+                if (snapshotTaken)
+                {
+                    draw(*drawnSnapshot);
+                    renderer.swapPixelBuffers();
+                }
+                renderer.update();
+            }
+        }
+        catch (const std::exception& e)
+        {
+            output.error(title, ": ", e.what());
+        }
+        renderer.terminate();
+        windowClosed = true;
+    }
+
+    Processor& video;
+    const std::string title;
+
+    std::thread thread;
+    std::atomic<bool> running = false;
+    std::atomic<bool> windowClosed = false;
+
+    // The emulator thread captures into the pending snapshot, the viewer thread draws the other
+    std::mutex snapshotMutex;
+    std::condition_variable snapshotCondition;
+    std::unique_ptr<ViewerSnapshot> pendingSnapshot;
+    std::unique_ptr<ViewerSnapshot> drawnSnapshot;
+    bool snapshotPending = false;
+
+    // Only touched by the emulator thread
+    std::chrono::steady_clock::time_point lastSnapshotTime;
+};
+
+class OamViewer : public Viewer
+{
+public:
+    static const int firstObjectIndex = 0;
+    static const int spriteSize = 16;
+
+    OamViewer(Processor& video, int windowXPosition, int windowYPosition)
+        : Viewer(video, "OAM viewer", windowXPosition, windowYPosition, 0x80, 0x100, 2.f)
+    {
     }
 
-    void update()
+    ~OamViewer()
+    {
+        close();
+    }
+
+private:
+    void draw(const ViewerSnapshot& snapshot) override
     {
         renderer.clearDisplay(0x7c1f);
 
@@ -47,29 +213,29 @@ public:
         int columnOffset = 0;
         for (int i = firstObjectIndex; i < 128 && rowOffset < renderer.height && columnOffset < renderer.width; ++i)
         {
-            Video::Object object = video.readObject(i);
+            Video::Object object = snapshot.readObject(i);
 
-            int objectSize = video.getObjectSize(object.sizeSelect);
+            int objectSize = snapshot.getObjectSize(object.sizeSelect);
             int objectTileSize = objectSize / 8;
             for (int tileRow = 0; tileRow < objectTileSize; ++tileRow)
             {
                 for (int tileColumn = 0; tileColumn < objectTileSize; ++tileColumn)
                 {
                     int tileIndex = object.tileIndex + tileRow * 0x10 + tileColumn;
-                    Word tileAddress = video.nameBaseSelect + uint16_t(tileIndex << 4);
+                    Word tileAddress = snapshot.nameBaseSelect + uint16_t(tileIndex << 4);
                     if (object.nameTable)
                     {
-                        tileAddress += video.nameSelect;
+                        tileAddress += snapshot.nameSelect;
                     }
                     for (int row = 0; row < 8; ++row, ++tileAddress)
                     {
                         int bpp = 4;
                         const int displayRow = rowOffset + tileRow * 8 + row;
                         const int displayColumnOffset = tileColumn * 8;
-                        Byte firstLowByte(video.vram.lowTable[tileAddress]);
-                        Byte firstHighByte(video.vram.highTable[tileAddress]);
-                        Byte secondLowByte(video.vram.lowTable[tileAddress + 8]);
-                        Byte secondHighByte(video.vram.highTable[tileAddress + 8]);
+                        Byte firstLowByte(snapshot.vram.lowTable[tileAddress]);
+                        Byte firstHighByte(snapshot.vram.highTable[tileAddress]);
+                        Byte secondLowByte(snapshot.vram.lowTable[tileAddress + 8]);
+                        Byte secondHighByte(snapshot.vram.highTable[tileAddress + 8]);
                         for (int column = 0; column < 8; ++column)
                         {
                             Byte paletteIndex;
@@ -83,7 +249,7 @@ public:
                             if (paletteIndex > 0)
                             {
                                 Word colorAddress = uint16_t(0x80 + (1 << bpp) * object.palette + paletteIndex);
-                                Word color = video.cgram.getWord(colorAddress);
+                                Word color = snapshot.cgram.getWord(colorAddress);
                                 if (object.horizontalFlip)
                                 {
                                     renderer.setPixel(displayRow, columnOffset + objectSize - 1 - displayColumnOffset - column, color);
@@ -104,54 +270,27 @@ public:
                 rowOffset += spriteSize;
             }
         }
-        renderer.swapPixelBuffers();
-    }
-
-    std::thread thread;
-    Renderer renderer;
-    Processor& video;
-    bool running = true;
-#else
-    OamViewer(Processor&, int, int)
-    {
-    }
-    void update()
-    {
     }
-#endif
 };
 
-class BackgroundViewer
+class BackgroundViewer : public Viewer
 {
 public:
-#ifdef DEBUGBG
     BackgroundViewer(Processor& video, Layer backgroundLayer, int windowXPosition, int windowYPosition)
-        : video(video)
+        : Viewer(video, std::string("Background ") + char('1' + int(backgroundLayer)) + " viewer", windowXPosition, windowYPosition, Video::rendererWidth * 2, Video::rendererWidth * 2, 1.f)
         , backgroundLayer(backgroundLayer)
-        , renderer(windowXPosition, windowYPosition, Video::rendererWidth * 2, Video::rendererWidth * 2, 1.f, true, video.output)
     {
-        thread = std::thread(std::ref(*this));
     }
 
     ~BackgroundViewer()
     {
-        running = false;
-        thread.join();
+        close();
     }
 
-    void operator()()
+private:
+    void draw(const ViewerSnapshot& snapshot) override
     {
-        renderer.title = std::string("Background ") + char('1' + int(backgroundLayer)) + " viewer";
-        renderer.initialize();
-        while (running && renderer.isRunning())
-        {
-            renderer.update();
-        }
-    }
-
-    void update()
-    {
-        if (backgroundLayer == Layer::Background1 && video.backgroundMode == 7)
+        if (backgroundLayer == Layer::Background1 && snapshot.backgroundMode == 7)
         {
             renderer.clearDisplay(0x3ff);
             return;
@@ -161,7 +300,7 @@ public:
             renderer.clearDisplay(0);
         }
 
-        Video::Background& background = video.backgrounds[size_t(backgroundLayer)];
+        const Video::Background& background = snapshot.backgrounds[size_t(backgroundLayer)];
 
         const int tileSize = 8;
         for (int screenRow = 0; screenRow < background.verticalMirroring + 1; ++screenRow)
@@ -188,7 +327,7 @@ public:
                         {
                             tileDataAddress += 0x400;
                         }
-                        Word tileData = video.vram.getWord(tileDataAddress);
+                        Word tileData = snapshot.vram.getWord(tileDataAddress);
                         int tilePriority = tileData.getBits(13, 1);
                         Word tileNumber = tileData.getBits(0, 10);
                         int palette = tileData.getBits(10, 3);
@@ -198,10 +337,10 @@ public:
                         int paletteAddress = (1 << background.bitsPerPixel) * palette;
                         for (int row = 0; row < 8; ++row)
                         {
-                            Byte firstLowByte(video.vram.lowTable[tileAddress + row]);
-                            Byte firstHighByte(video.vram.highTable[tileAddress + row]);
-                            Byte secondLowByte(video.vram.lowTable[tileAddress + row + 8]);
-                            Byte secondHighByte(video.vram.highTable[tileAddress + row + 8]);
+                            Byte firstLowByte(snapshot.vram.lowTable[tileAddress + row]);
+                            Byte firstHighByte(snapshot.vram.highTable[tileAddress + row]);
+                            Byte secondLowByte(snapshot.vram.lowTable[tileAddress + row + 8]);
+                            Byte secondHighByte(snapshot.vram.highTable[tileAddress + row + 8]);
                             int displayRow = tileRow * tileSize + screenRow * Video::rendererWidth + (verticalFlip ? tileSize - 1 - row : row);
                             for (int column = 0; column < 8; ++column)
                             {
@@ -218,7 +357,7 @@ public:
                                 if (paletteIndex > 0)
                                 {
                                     Word colorAddress = uint16_t(paletteAddress + paletteIndex);
-                                    color = video.cgram.getWord(colorAddress);
+                                    color = snapshot.cgram.getWord(colorAddress);
                                 }
                                 if (tilePriority)
                                 {
@@ -231,67 +370,41 @@ public:
                 }
             }
         }
-        renderer.swapPixelBuffers();
     }
 
-    std::thread thread;
-    Renderer renderer;
-    Processor& video;
-    bool running = true;
     Layer backgroundLayer;
-#else
-    BackgroundViewer(Processor&, Layer, int, int)
-    {
-    }
-    void update()
-    {
-    }
-#endif
 };
 
-class SpriteLayerViewer
+class SpriteLayerViewer : public Viewer
 {
 public:
-#ifdef DEBUGSPRITES
     SpriteLayerViewer(Processor& video, int priority, int windowXPosition, int windowYPosition)
-        : video(video)
+        : Viewer(video, std::string("Sprites prio ") + char('1' + priority) + " viewer", windowXPosition, windowYPosition, Video::rendererWidth, Video::rendererHeight, 1.f)
         , priority(priority)
-        , renderer(windowXPosition, windowYPosition, Video::rendererWidth, Video::rendererHeight, 1.f, true, video.output)
     {
-        thread = std::thread(std::ref(*this));
     }
 
     ~SpriteLayerViewer()
     {
-        running = false;
-        thread.join();
-    }
-
-    void operator()()
-    {
-        renderer.title = std::string("Sprites prio ") + char('1' + priority) + " viewer";
-        renderer.initialize();
-        while (running && renderer.isRunning())
-        {
-            renderer.update();
-        }
+        close();
     }
 
-    void update()
+private:
+    void draw(const ViewerSnapshot& snapshot) override
     {
         renderer.clearDisplay(0x7c1f);
         int firstObjectIndex = 0;
-        if (video.objectPriority) {
-            firstObjectIndex = video.oam.currentAddress * 2;
+        if (snapshot.objectPriority) {
+            firstObjectIndex = snapshot.oam.currentAddress * 2;
         }
         for (int i = 127; i >= 0; --i) {
-            Video::Object object = video.readObject((i + firstObjectIndex) & 127);
+            Video::Object object = snapshot.readObject((i + firstObjectIndex) & 127);
             if (object.priority != priority) {
                 continue;
             }
             int bitsPerPixel = 4;
             int paletteAddress = 0x80 + (1 << bitsPerPixel) * object.palette;
-            int objectSize = video.getObjectSize(object.sizeSelect);
+            int objectSize = snapshot.getObjectSize(object.sizeSelect);
             int objectY = object.y;
             int distanceFromTop = Video::rendererWidth - objectY;
             if (distanceFromTop >= 0 && distanceFromTop < objectSize) {
@@ -306,19 +419,19 @@ public:
                 for (int tileColumn = 0; tileColumn < objectTileSize; ++tileColumn) {
                     int tileIndex = object.tileIndex + tileRow * 0x10 + tileColumn;
                     for (int row = 0; row < 8; ++row) {
-                        Word tileAddress = video.nameBaseSelect + uint16_t(tileIndex << 4);
+                        Word tileAddress = snapshot.nameBaseSelect + uint16_t(tileIndex << 4);
                         if (object.nameTable) {
-                            tileAddress += video.nameSelect;
+                            tileAddress += snapshot.nameSelect;
                         }
                         tileAddress += row;
 
                         for (int column = 0; column < 8; ++column) {
                             Byte paletteIndex;
-                            paletteIndex.setBit(0, video.vram.lowTable[tileAddress].getBit(7 - column));
-                            paletteIndex.setBit(1, video.vram.highTable[tileAddress].getBit(7 - column));
+                            paletteIndex.setBit(0, snapshot.vram.lowTable[tileAddress].getBit(7 - column));
+                            paletteIndex.setBit(1, snapshot.vram.highTable[tileAddress].getBit(7 - column));
                             if (bitsPerPixel >= 4) {
-                                paletteIndex.setBit(2, video.vram.lowTable[tileAddress + 8].getBit(7 - column));
-                                paletteIndex.setBit(3, video.vram.highTable[tileAddress + 8].getBit(7 - column));
+                                paletteIndex.setBit(2, snapshot.vram.lowTable[tileAddress + 8].getBit(7 - column));
+                                paletteIndex.setBit(3, snapshot.vram.highTable[tileAddress + 8].getBit(7 - column));
                             }
                             int displayRow = 0;
                             if (object.verticalFlip) {
@@ -340,7 +453,7 @@ public:
                             }
                             if (paletteIndex > 0) {
                                 Word colorAddress = uint16_t(paletteAddress + paletteIndex);
-                                int color = video.cgram.getWord(colorAddress);
+                                int color = snapshot.cgram.getWord(colorAddress);
                                 renderer.setPixel(displayRow, displayColumn, Renderer::Pixel(color));
                             }
                         }
@@ -348,52 +461,26 @@ public:
                 }
             }
         }
-        renderer.swapPixelBuffers();
     }
 
-    std::thread thread;
-    Renderer renderer;
-    Processor& video;
-    bool running = true;
     int priority = 0;
-#else
-    SpriteLayerViewer(Processor&, int, int, int)
-    {
-    }
-    void update()
-    {
-    }
-#endif
 };
 
-class Mode7Viewer
+class Mode7Viewer : public Viewer
 {
 public:
-#ifdef DEBUGMODE7
     Mode7Viewer(Processor& video, int windowXPosition, int windowYPosition)
-        : video(video)
-        , renderer(windowXPosition, windowYPosition, 1024, 1024, 1.f, true, video.output)
+        : Viewer(video, "Mode 7 viewer", windowXPosition, windowYPosition, 1024, 1024, 1.f)
     {
-        thread = std::thread(std::ref(*this));
     }
 
     ~Mode7Viewer()
     {
-        running = false;
-        thread.join();
+        close();
     }
 
-    void operator()()
-    {
-        renderer.title = "Mode 7 viewer";
-        renderer.initialize();
-        while (running && renderer.isRunning())
-        {
-            renderer.update();
-        }
-    }
-
-    void update()
+private:
+    void draw(const ViewerSnapshot& snapshot) override
     {
         renderer.clearDisplay(0);
         int tileDataAddress = 0;
@@ -402,35 +489,66 @@ public:
         {
             for (int tileColumn = 0; tileColumn < 128; ++tileColumn)
             {
-                Byte tileData = video.vram.lowTable[tileDataAddress];
+                Byte tileData = snapshot.vram.lowTable[tileDataAddress];
                 for (int row = 0; row < 8; ++row)
                 {
                     for (int column = 0; column < 8; ++column)
                     {
                         int pixelDataAddress = tileData * 8 * 8 + row * 8 + column;
-                        Byte pixelData = video.vram.highTable[pixelDataAddress];
-                        Word pixel = video.cgram.getWord(Word(pixelData));
+                        Byte pixelData = snapshot.vram.highTable[pixelDataAddress];
+                        Word pixel = snapshot.cgram.getWord(Word(pixelData));
                         renderer.setPixel(tileRow * 8 + row, tileColumn * 8 + column, pixel);
                     }
                 }
                 ++tileDataAddress;
             }
         }
-        renderer.swapPixelBuffers();
     }
+};
 
-    std::thread thread;
-    Renderer renderer;
-    Processor& video;
-    bool running = true;
-#else
-    Mode7Viewer(Processor&, int, int)
+inline std::unique_ptr<Viewer> Viewer::create(Processor& video, const std::string& name)
+{
+    if (name == "oam")
     {
+        return std::make_unique<OamViewer>(video, 1080, 760);
     }
-    void update()
+    if (name == "bg1")
     {
+        return std::make_unique<BackgroundViewer>(video, Layer::Background1, 0, 10);
     }
-#endif
-};
+    if (name == "bg2")
+    {
+        return std::make_unique<BackgroundViewer>(video, Layer::Background2, Video::rendererWidth * 2 + 20, 10);
+    }
+    if (name == "bg3")
+    {
+        return std::make_unique<BackgroundViewer>(video, Layer::Background3, 0, Video::rendererWidth * 2 + 20);
+    }
+    if (name == "bg4")
+    {
+        return std::make_unique<BackgroundViewer>(video, Layer::Background4, Video::rendererWidth * 2, Video::rendererWidth * 2 + 20);
+    }
+    if (name == "obj1")
+    {
+        return std::make_unique<SpriteLayerViewer>(video, 0, Video::rendererWidth * 2 + 20, Video::rendererWidth * 2 + 40);
+    }
+    if (name == "obj2")
+    {
+        return std::make_unique<SpriteLayerViewer>(video, 1, Video::rendererWidth * 2 + 20 + Video::rendererWidth + 20, Video::rendererWidth * 2 + 40);
+    }
+    if (name == "obj3")
+    {
+        return std::make_unique<SpriteLayerViewer>(video, 2, Video::rendererWidth * 2 + 20, Video::rendererWidth * 2 + 40 + Video::rendererWidth);
+    }
+    if (name == "obj4")
+    {
+        return std::make_unique<SpriteLayerViewer>(video, 3, Video::rendererWidth * 2 + 20 + Video::rendererWidth + 20, Video::rendererWidth * 2 + 40 + Video::rendererWidth);
+    }
+    if (name == "mode7")
+    {
+        return std::make_unique<Mode7Viewer>(video, 0, 40);
+    }
+    return nullptr;
+}
 
 }
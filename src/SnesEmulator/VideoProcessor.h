@@ -5,15 +5,21 @@
 
 #include "Common/Types.h"
 #include "Common/Util.h"
+#include "Common/SaveState.h"
+#include "Common/Profiler.h"
 
 #include "VideoData.h"
 #include "VideoRenderer.h"
 
 #pragma warning( disable : 26110 ) // Caller failing to hold lock <lock> before calling function <func>
 
+#define PROFILE_VIDEO_STAGES false
+
 namespace Video
 {
 
+CREATE_PROFILER();
+
 class Processor
 {
 public:
@@ -40,6 +46,9 @@ public:
                         fullscreen = !fullscreen;
                         video.renderer.setWindowProperties(fullscreen);
                     }
+                    // Presents once per frame from the emulator, at most once per vertical
+                    // blank as set by the swap interval
+                    video.renderer.waitForFrame();
                     video.renderer.update();
                 }
             }
@@ -56,7 +65,8 @@ public:
         bool fullscreen = false;
     };
 
-    Processor(Output& output, const std::string& gameTitle)
+    // A headless processor draws into the pixel buffers as usual but opens no window
+    Processor(Output& output, const std::string& gameTitle, bool headless)
         : output(output, "video")
         , vram(0x8000)
         , cgram(0x100)
@@ -64,14 +74,20 @@ public:
         , renderer(1000, 40, rendererWidth, rendererHeight, 3.f, true, output)
         , rendererRunner(*this, output, gameTitle)
         , backgrounds(4)
-        , rendererThread(std::ref(rendererRunner))
     {
+        if (!headless)
+        {
+            rendererThread = std::thread(std::ref(rendererRunner));
+        }
     }
 
     ~Processor()
     {
         rendererRunner.run = false;
-        rendererThread.join();
+        if (rendererThread.joinable())
+        {
+            rendererThread.join();
+        }
     }
 
     Processor(const Processor&) = delete;
@@ -83,6 +99,11 @@ public:
     }
 
     int getObjectSize(bool sizeSelect) const
+    {
+        return getObjectSize(objectSizeIndex, sizeSelect);
+    }
+
+    static int getObjectSize(Byte objectSizeIndex, bool sizeSelect)
     {
         switch (objectSizeIndex)
         {
@@ -161,6 +182,8 @@ public:
 
     void drawMode(const std::vector<ModeEntry>& modeEntries, int displayRow, bool isMode7 = false)
     {
+        PROFILE_IF(PROFILE_VIDEO_STAGES, "Draw scanline");
+
         Word backdropColor = cgram.getWord(0);
         Word fixedColor = clearColor;
 
@@ -194,6 +217,7 @@ public:
         colorWindowSettings.window2Inverted = windowMaskSettings.getBit(22);
         colorWindowSettings.windowOperator = Byte(windowMaskLogic.getBits(10, 2));
 
+        const std::span<Renderer::Pixel> rowPixels = renderer.getRow(displayRow - 1);
         for (int displayColumn = 0; displayColumn < rendererWidth; ++displayColumn)
         {
             Byte addendPixelIndex;
@@ -216,7 +240,7 @@ public:
             {
                 mainScreenPixel = factorColors(mainScreenPixel, brightnessFactor);
             }
-            renderer.setPixel(displayRow - 1, displayColumn, mainScreenPixel);
+            rowPixels[displayColumn] = mainScreenPixel;
         }
     }
 
@@ -263,6 +287,8 @@ public:
 
     void drawMode7Background(ScanlineBuffer& buffer, int displayRow)
     {
+        PROFILE_IF(PROFILE_VIDEO_STAGES, "Draw mode 7 background");
+
         /*int A = mode7MatrixA;
         int B = mode7MatrixB;
         int C = mode7MatrixC;
@@ -335,6 +361,8 @@ public:
 
     void drawBackground(ScanlineBuffer& buffer, Background& background, int displayRow, int priority, bool windowEnabled, WindowSettings& windowSettings, std::bitset<rendererWidth>& bufferMask)
     {
+        PROFILE_IF(PROFILE_VIDEO_STAGES, "Draw background");
+
         const int tileSize = 8;
         int backgroundHeight = tileSize * 32 * (background.verticalMirroring + 1);
         int backgroundWidth = tileSize * 32 * (background.horizontalMirroring + 1);
@@ -388,6 +416,11 @@ public:
     }
 
     Object readObject(int index) const
+    {
+        return readObject(oam, index);
+    }
+
+    static Object readObject(const Table& oam, int index)
     {
         Word lowAddress(index * 2);
         Word highAddress(index / 8);
@@ -410,6 +443,8 @@ public:
 
     void drawObject(ScanlineBuffer& buffer, const Object& object, int displayRow, bool windowEnabled, WindowSettings& windowSettings, std::bitset<rendererWidth>& bufferMask)
     {
+        PROFILE_IF(PROFILE_VIDEO_STAGES, "Draw object");
+
         int objectSize = getObjectSize(object.sizeSelect);
         int objectY = object.y;
         int distanceFromTop = rendererWidth - objectY;
@@ -682,6 +717,51 @@ public:
         return c;
     }
 
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        archive.section(SaveState::makeTag("VRAM"), [&]() { archive(vram); });
+        archive.section(SaveState::makeTag("CGRA"), [&]() { archive(cgram); });
+        archive.section(SaveState::makeTag("OAM "), [&]() { archive(oam); });
+        archive(objectPriority);
+        archive(screenDisplay);
+        archive(clearColor);
+        archive(backgroundMode);
+        archive(mode1Extension);
+        archive(characterSize);
+        archive(mainScreenDesignation);
+        archive(subscreenDesignation);
+        archive(mainScreenWindowMaskDesignation);
+        archive(subscreenWindowMaskDesignation);
+        archive(currentColorMathDesignation);
+        archive(clipColorToBlackMode);
+        archive(clipColorMathMode);
+        archive(addSubscreen);
+        archive(directColorMode);
+        archive(objectSizeIndex);
+        archive(nameSelect);
+        archive(nameBaseSelect);
+        archive(backgrounds);
+        archive(window1Left);
+        archive(window1Right);
+        archive(window2Left);
+        archive(window2Right);
+        archive(windowMaskSettings);
+        archive(windowMaskLogic);
+        archive(mode7PlayingFieldSize);
+        archive(mode7HorizontalScroll);
+        archive(mode7VerticalScroll);
+        archive(mode7MatrixA);
+        archive(mode7MatrixB);
+        archive(mode7MatrixC);
+        archive(mode7MatrixD);
+        archive(mode7CenterX);
+        archive(mode7CenterY);
+        archive(mode7HorizontalMirroring);
+        archive(mode7VerticalMirroring);
+        archive(mode7EmptySpaceFill);
+    }
+
     Output output;
 
     Table vram;
@@ -47,14 +47,28 @@ public:
         Byte lineCounter;
         bool dmaActive = false;
         bool hdmaDoTransfer = false;
+
+        template<typename Archive>
+        void serialize(Archive& archive)
+        {
+            archive(control);
+            archive(destinationRegister);
+            archive(sourceAddress);
+            archive(dataSize);
+            archive(indirectAddressBankByte);
+            archive(tableAddress);
+            archive(lineCounter);
+            archive(dmaActive);
+            archive(hdmaDoTransfer);
+        }
     };
 
-    Registers(Output& output, CPU::State& state, const std::string& gameTitle)
+    Registers(Output& output, CPU::State& state, const std::string& gameTitle, bool headless)
         : RegisterManager(output, "video", state.getMemory())
         , output(output, "video")
         , state(state)
         , memory(state.getMemory())
-        , processor(output, gameTitle)
+        , processor(output, gameTitle, headless)
     {
     }
 
@@ -1203,7 +1217,11 @@ public:
         makeWriteRegister(0x4209, "V Timer", false, vTimer);
         makeWriteRegister(0x420b, "DMA Enable", false, dmaEnabled);
         makeWriteRegister(0x420c, "HDMA Enable", false, hdmaEnabled);
-        makeWriteRegister(0x420d, "ROM Access Speed", true);
+        makeWriteRegister(0x420d, "ROM Access Speed", true,
+            [this](Byte value)
+            {
+                memory.setFastAccess(value.getBit(0));
+            });
 
         makeReadRegister(0x4210, "NMI Flag and 5A22 Version", false,
             [this](Byte& value)
@@ -1321,22 +1339,15 @@ public:
         return value;
     }
 
-    void readControllers()
+    // The controller state as given by an InputSource
+    void readControllers(uint16_t state)
     {
         if (autoJoypadReadEnabled)
         {
-            controllerPort1Data1.setBit(4, processor.renderer.buttonR);
-            controllerPort1Data1.setBit(5, processor.renderer.buttonL);
-            controllerPort1Data1.setBit(6, processor.renderer.buttonX);
-            controllerPort1Data1.setBit(7, processor.renderer.buttonA);
-            controllerPort1Data1.setBit(8, processor.renderer.buttonRight);
-            controllerPort1Data1.setBit(9, processor.renderer.buttonLeft);
-            controllerPort1Data1.setBit(10, processor.renderer.buttonDown);
-            controllerPort1Data1.setBit(11, processor.renderer.buttonUp);
-            controllerPort1Data1.setBit(12, processor.renderer.buttonStart);
-            controllerPort1Data1.setBit(13, processor.renderer.buttonSelect);
-            controllerPort1Data1.setBit(14, processor.renderer.buttonY);
-            controllerPort1Data1.setBit(15, processor.renderer.buttonB);
+            for (int bit = 4; bit < 16; ++bit)
+            {
+                controllerPort1Data1.setBit(bit, (state >> bit) & 1);
+            }
         }
     }
 
@@ -1407,6 +1418,44 @@ public:
         processor.vram.currentAddress = 0;
     }
 
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        archive(vCounter);
+        archive(hCounter);
+        archive(frame);
+        archive(interlaceField);
+        archive(vBlank);
+        archive(hBlank);
+        archive(oamStartAddress);
+        archive(vramBuffer);
+        archive(wramAddress);
+        archive(controllerPort1Data1);
+        archive(videoPortControl);
+        archive(incrementVramOnHighByte);
+        archive(mode7Buffer);
+        archive(mode7Multiplicand);
+        archive(multiplicationResult);
+        archive(multiplicandA);
+        archive(dividend);
+        archive(quotient);
+        archive(product);
+        archive(nmiEnabled);
+        archive(irqMode);
+        archive(autoJoypadReadEnabled);
+        archive(hTimer);
+        archive(vTimer);
+        archive(programmableIOPort);
+        archive(externalLatch);
+        archive(horizontalScanlineLocation);
+        archive(verticalScanlineLocation);
+        archive(ppuStatusFlagAndVersion);
+        archive(dmaEnabled);
+        archive(hdmaEnabled);
+        archive(dmaChannels);
+        archive(processor);
+    }
+
     Output output;
 
     CPU::State& state;
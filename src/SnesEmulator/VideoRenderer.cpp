@@ -1,6 +1,8 @@
 #include "VideoRenderer.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 
 #include <iostream>
 #include <fstream>
@@ -29,14 +31,11 @@ Renderer::Renderer(int windowXPosition, int windowYPosition, int width, int heig
     , windowYPosition(windowYPosition)
     , width(width)
     , height(height)
+    , pixelBuffers(std::vector<Pixel>(pixelBufferSize))
     , scale(scale)
     , syncUpdate(syncUpdate)
     , title("SNES Emulator")
 {
-    for (std::vector<Pixel>& pixelBuffer : pixelBuffers)
-    {
-        pixelBuffer.resize(pixelBufferSize);
-    }
 }
 
 Renderer::~Renderer()
@@ -57,9 +56,19 @@ void Renderer::focusWindow(bool value)
 
 void Renderer::swapPixelBuffers()
 {
-    drawBufferIndex = writeBufferIndex;
-    writeBufferIndex = (writeBufferIndex + 1) % pixelBuffers.size();
-    textureNeedsUpdate = true;
+    pixelBuffers.publish();
+    {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        frameSwapped = true;
+    }
+    frameCondition.notify_one();
+}
+
+void Renderer::waitForFrame()
+{
+    std::unique_lock<std::mutex> lock(frameMutex);
+    frameCondition.wait_for(lock, inputPollInterval, [this]() { return frameSwapped; });
+    frameSwapped = false;
 }
 
 // private
@@ -87,9 +96,14 @@ void Renderer::initialize(bool fullscreen)
 
 void Renderer::setupGlfw(bool fullscreen)
 {
-    if (!glfwInit())
     {
-        throw std::runtime_error("Failed to initialize GLFW");
+        std::lock_guard<std::mutex> lock(glfwUsersMutex);
+        if (!glfwInit())
+        {
+            throw std::runtime_error("Failed to initialize GLFW");
+        }
+        ++glfwUsers;
+        glfwInitialized = true;
     }
 
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -113,7 +127,7 @@ void Renderer::setupGlfw(bool fullscreen)
     window = glfwCreateWindow(mode->width, mode->height, title.c_str(), monitor, nullptr);
     if (!window)
     {
-        glfwTerminate();
+        terminate();
         throw std::runtime_error("Failed to create GLFW window.");
     }
     glfwMakeContextCurrent(window);
@@ -338,10 +352,27 @@ void Renderer::createTextures()
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, nullptr);
 
     glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenBuffers(GLsizei(pixelUnpackBuffers.size()), pixelUnpackBuffers.data());
+    for (unsigned int buffer : pixelUnpackBuffers)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, pixelBufferSize * sizeof(Pixel), nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 }
 
 // interface
 
+std::span<Renderer::Pixel> Renderer::getRow(int row)
+{
+    if (row < 0 || row >= height)
+    {
+        throw std::logic_error("Renderer: Row out of bounds in pixel buffer");
+    }
+    return std::span<Pixel>(pixelBuffers.getWriteBuffer()).subspan(size_t(height - 1 - row) * width, width);
+}
+
 void Renderer::setPixel(int row, int column, Pixel pixel)
 {
     row = height - 1 - row;
@@ -350,7 +381,7 @@ void Renderer::setPixel(int row, int column, Pixel pixel)
     {
         throw std::logic_error("Renderer: Index out of bounds in pixel buffer");
     }
-    pixelBuffers[writeBufferIndex][index] = pixel;
+    pixelBuffers.getWriteBuffer()[index] = pixel;
 }
 
 void Renderer::setGrayscalePixel(int row, int column, uint8_t white)
@@ -362,21 +393,14 @@ void Renderer::setGrayscalePixel(int row, int column, uint8_t white)
 
 void Renderer::clearDisplay(uint16_t clearColor)
 {
-    for (int row = 0; row < height; ++row)
-    {
-        for (int column = 0; column < width; ++column)
-        {
-            setPixel(row, column, clearColor);
-        }
-    }
+    std::vector<Pixel>& pixels = pixelBuffers.getWriteBuffer();
+    std::fill(pixels.begin(), pixels.end(), clearColor);
 }
 
 void Renderer::clearScanline(int vCounter, uint16_t clearColor)
 {
-    for (int column = 0; column < width; ++column)
-    {
-        setPixel(vCounter, column, clearColor);
-    }
+    const std::span<Pixel> row = getRow(vCounter);
+    std::fill(row.begin(), row.end(), clearColor);
 }
 
 bool Renderer::isRunning() const
@@ -393,15 +417,36 @@ bool Renderer::isPressed(int key) const
 
 void Renderer::uploadTexture()
 {
-    if (textureNeedsUpdate)
+    if (pixelBuffers.update())
     {
+        // The frame is copied to a pixel buffer object and the texture is filled from there, which
+        // the driver can do whenever the GPU gets to it, instead of the upload waiting for the
+        // GPU. Reallocating the buffer first lets a transfer still reading from it finish on the
+        // old storage.
+        const std::vector<Pixel>& pixels = pixelBuffers.getReadBuffer();
+        const size_t size = pixels.size() * sizeof(Pixel);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelUnpackBuffers[nextPixelUnpackBuffer]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        void* mappedPixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        const void* source = pixels.data();
+        if (mappedPixels)
+        {
+            std::memcpy(mappedPixels, pixels.data(), size);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            // Now an offset into the bound buffer
+            source = nullptr;
+        }
+        else
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
         glBindTexture(GL_TEXTURE_2D, texture);
         {
-            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, pixelBuffers[drawBufferIndex].data());
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, source);
         }
         glBindTexture(GL_TEXTURE_2D, 0);
-
-        textureNeedsUpdate = false;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        nextPixelUnpackBuffer = (nextPixelUnpackBuffer + 1) % pixelUnpackBuffers.size();
     }
 }
 
@@ -422,17 +467,14 @@ void Renderer::update()
 
     //if (!syncUpdate)
     {
-        static double previousTime = glfwGetTime();
-        static int frameCount = 0;
-
         double currentTime = glfwGetTime();
-        frameCount++;
-        if (currentTime - previousTime >= 1.0)
+        frameRateCount++;
+        if (currentTime - previousFrameRateTime >= 1.0)
         {
-            output.debug(frameCount);
+            LOG_DEBUG(output, frameRateCount);
 
-            frameCount = 0;
-            previousTime = currentTime;
+            frameRateCount = 0;
+            previousFrameRateTime = currentTime;
         }
     }
 
@@ -456,6 +498,16 @@ void Renderer::handleInput()
             pauseRequested = true;
             pressKeyTimeout = currentTime + 1.0;
         }
+        if (isPressed(GLFW_KEY_F5))
+        {
+            saveStateRequested = true;
+            pressKeyTimeout = currentTime + 1.0;
+        }
+        if (isPressed(GLFW_KEY_F9))
+        {
+            loadStateRequested = true;
+            pressKeyTimeout = currentTime + 1.0;
+        }
         bool screenSettingsChanged = false;
         if (isPressed(GLFW_KEY_SPACE))
         {
@@ -515,6 +567,8 @@ void Renderer::handleInput()
         }
     }
 
+    rewindRequested = isPressed(GLFW_KEY_BACKSPACE);
+
     buttonStart = isPressed(GLFW_KEY_COMMA);
     buttonSelect = isPressed(GLFW_KEY_PERIOD);
     buttonA = isPressed(GLFW_KEY_L);
@@ -594,18 +648,27 @@ void Renderer::terminate()
     if (screenQuadVertexArray)
     {
         glDeleteVertexArrays(1, &screenQuadVertexArray);
+        screenQuadVertexArray = 0;
     }
     if (screenQuadVertexBuffer)
     {
         glDeleteBuffers(1, &screenQuadVertexBuffer);
+        screenQuadVertexBuffer = 0;
     }
     if (screenQuadIndexBuffer)
     {
         glDeleteBuffers(1, &screenQuadIndexBuffer);
+        screenQuadIndexBuffer = 0;
     }
     if (texture)
     {
         glDeleteTextures(1, &texture);
+        texture = 0;
+    }
+    if (pixelUnpackBuffers[0])
+    {
+        glDeleteBuffers(GLsizei(pixelUnpackBuffers.size()), pixelUnpackBuffers.data());
+        pixelUnpackBuffers.fill(0);
     }
 
     simpleShader.destroy();
@@ -617,7 +680,15 @@ void Renderer::terminate()
         window = nullptr;
     }
 
-    glfwTerminate();
+    if (glfwInitialized)
+    {
+        std::lock_guard<std::mutex> lock(glfwUsersMutex);
+        glfwInitialized = false;
+        if (--glfwUsers == 0)
+        {
+            glfwTerminate();
+        }
+    }
 }
 
 }
@@ -4,9 +4,13 @@
 #include <vector>
 #include <array>
 #include <string>
+#include <span>
+#include <chrono>
 #include <mutex>
+#include <condition_variable>
 
 #include "Common/Output.h"
+#include "Common/TripleBuffer.h"
 
 #include "Shader.h"
 
@@ -14,6 +18,8 @@ struct GLFWmonitor;
 struct GLFWwindow;
 struct GLFWvidmode;
 
+class LiveInputSource;
+
 namespace Video {
 
 class Renderer
@@ -21,6 +27,9 @@ class Renderer
 public:
     typedef uint16_t Pixel;
 
+    // How long a render thread waits for a frame before polling for input anyway
+    static constexpr std::chrono::milliseconds inputPollInterval = std::chrono::milliseconds(20);
+
     Renderer(int windowXPosition, int windowYPosition, int width, int height, float scale, bool syncUpdate, Output& output);
 
     Renderer(const Renderer&) = delete;
@@ -30,9 +39,16 @@ public:
 
     double getTime() const;
     void focusWindow(bool value);
+    // Hands the frame drawn since the last swap to the window, without waiting for it
     void swapPixelBuffers();
+
+    // Blocks the render thread until a frame is swapped in, or until it is time to poll input
+    void waitForFrame();
     unsigned int getTexture() const { return texture; }
 
+    // The frame completed by the last swap, bottom row first
+    const std::vector<Pixel>& getCompletedFrame() const { return pixelBuffers.getPublished(); }
+
 private:
     // setup
     void initialize(bool fullscreen = false);
@@ -54,6 +70,8 @@ private:
     void createTextures();
 
     // interface
+    // A whole row of the frame being drawn, for writing a scanline without a call per pixel
+    std::span<Pixel> getRow(int row);
     void setPixel(int row, int column, Pixel pixel);
     void setGrayscalePixel(int row, int column, uint8_t white);
     void clearDisplay(uint16_t clearColor);
@@ -74,6 +92,9 @@ public:
 public:
     bool toggleFullscreenRequested = false;
     bool pauseRequested = false;
+    bool saveStateRequested = false;
+    bool loadStateRequested = false;
+    bool rewindRequested = false;
 
     const int width;
     const int height;
@@ -96,12 +117,13 @@ private:
     int windowYPosition;
 
     const size_t pixelBufferSize = size_t(height) * size_t(width);
-    std::array<std::vector<Pixel>, 3> pixelBuffers;
 
-    int drawBufferIndex = 0;
-    int writeBufferIndex = 1;
+    // Drawn into by the emulator thread, uploaded by the thread running update
+    TripleBuffer<std::vector<Pixel>> pixelBuffers;
 
-    std::mutex pixelBufferMutex;
+    std::mutex frameMutex;
+    std::condition_variable frameCondition;
+    bool frameSwapped = false;
 
     Output output;
 
@@ -121,6 +143,10 @@ private:
     unsigned int screenQuadIndexBuffer = 0;
     unsigned int texture = 0;
 
+    // Frames are uploaded through these in turn, see uploadTexture
+    std::array<unsigned int, 2> pixelUnpackBuffers = { 0, 0 };
+    size_t nextPixelUnpackBuffer = 0;
+
     SimpleShader simpleShader;
     ScanlineShader scanlineShader;
     std::array<Shader*, 2> shaders = { &simpleShader, &scanlineShader };
@@ -128,14 +154,24 @@ private:
 
     double pressKeyTimeout = 0.f;
     bool focusWindowRequested = false;
-    bool textureNeedsUpdate = false;
+
+    double previousFrameRateTime = 0.0;
+    int frameRateCount = 0;
+
+    // GLFW is shared by every window of the process, so it is only terminated along with the
+    // last renderer that initialized it, and a viewer can close without taking the game window
+    bool glfwInitialized = false;
+    static inline std::mutex glfwUsersMutex;
+    static inline int glfwUsers = 0;
 
     friend class Processor;
     friend class Registers;
+    friend class Viewer;
     friend class OamViewer;
     friend class BackgroundViewer;
     friend class SpriteLayerViewer;
     friend class Mode7Viewer;
+    friend class ::LiveInputSource;
 
     friend void framebufferSizeCallback(GLFWwindow*, int width, int height);
 };
@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Hash.h"
+#include "Output.h"
+
+#include "SPC700/SpcState.h"
+#include "SPC700/SpcInstructionDecoder.h"
+#include "SPC700/SpcIdleLoopDetector.h"
+
+// Checks the SPC700 core by running random programs from random RAM and register states, each
+// instruction both through the handler table and through the Instruction wrappers, which have
+// to agree on registers, PSW and cycle counts after every instruction and on the RAM at the end
+// of every program.
+//
+// The trace of the default run also has to hash to what the core before the handler table and
+// the lazy N/Z flags produced. A change that is meant to alter the behavior of the core changes
+// the hash; write a trace with --trace from the builds before and after it and diff them to see
+// that only the intended instructions differ, then update the reference hash.
+//
+// Then a sound driver that polls a CPU port and a timer is run twice, with random port writes
+// from the CPU side, once executing every instruction and once passing over its idle loops the
+// way the emulator does, up to the next port write or timer tick at once. Its own port writes
+// and its final state have to be the same.
+//
+// SpcCheck [--programs <count>] [--trace <file>]
+
+namespace {
+
+constexpr int defaultProgramCount = 3000;
+constexpr int stepCount = 300;
+constexpr uint64_t referenceHash = 0x6f65f85ae72c7993;
+
+struct Machine
+{
+    Machine(Output& output)
+        : state(output)
+    {
+        SPC::AudioRam& memory = state.getMemory();
+        // Plain bytes in place of the timers and ports, so that every program is deterministic
+        for (int address = 0xf0; address < 0x100; ++address)
+        {
+            memory.createLocation<ReadWriteMemory>(Word(address), Byte(0));
+        }
+        memory.finalize();
+    }
+
+    // The same random state for both machines from the same seed
+    void randomize(std::mt19937& random)
+    {
+        SPC::AudioRam& memory = state.getMemory();
+        for (int address = 0; address < 0x10000; ++address)
+        {
+            memory.writeByte(Byte(uint8_t(random())), Word(address));
+        }
+        memory.setBootRomEnabled(random() & 1);
+        state.writeRegister<SPC::State::Register::A>(Byte(uint8_t(random())));
+        state.writeRegister<SPC::State::Register::X>(Byte(uint8_t(random())));
+        state.writeRegister<SPC::State::Register::Y>(Byte(uint8_t(random())));
+        state.writeRegister<SPC::State::Register::SP>(Byte(uint8_t(random())));
+        state.setFlags(Byte(uint8_t(random())));
+        state.setProgramCounter(Word(uint16_t(random())));
+    }
+
+    // One line of the trace, or EXC if the instruction threw, in which case the program
+    // continues at the next byte
+    template<typename Execute>
+    std::string step(Execute execute)
+    {
+        // DIV by zero
+        if (state.inspectProgramByte() == 0x9e && state.readRegister<SPC::State::Register::X>() == 0)
+        {
+            state.writeRegister<SPC::State::Register::X>(Byte(1));
+        }
+        const Word programCounter = state.getProgramCounter();
+        std::ostringstream line;
+        try
+        {
+            const int cycles = execute(state);
+            line << cycles << ' ' << state.getProgramCounter() << ' ' << state.readRegister<SPC::State::Register::A>() << ' '
+                << state.readRegister<SPC::State::Register::X>() << ' ' << state.readRegister<SPC::State::Register::Y>() << ' '
+                << state.readRegister<SPC::State::Register::SP>() << ' ' << state.readRegister<SPC::State::Register::PSW>() << '\n';
+        }
+        catch (const std::exception&)
+        {
+            line.str("EXC\n");
+            state.setProgramCounter(Word(programCounter + 1));
+        }
+        return line.str();
+    }
+
+    // The RAM outside the timers and ports
+    std::string hashMemory()
+    {
+        SPC::AudioRam& memory = state.getMemory();
+        std::vector<uint8_t> bytes;
+        bytes.reserve(0x10000);
+        for (int address = 0; address < 0x10000; ++address)
+        {
+            if (address < 0xf0 || address >= 0x100)
+            {
+                bytes.push_back(uint8_t(memory.inspect(Word(address))));
+            }
+        }
+        return "H " + std::to_string(Hash::fnv1a(bytes.data(), bytes.size())) + '\n';
+    }
+
+    SPC::State state;
+};
+
+// Waits for the CPU to change port 0 and echoes the value to port 1, then waits for a tick of
+// timer 0 and counts it in RAM
+constexpr uint8_t pollingDriver[] = {
+    0x8f, 0x10, 0xfa, // MOV $FA, #$10
+    0x8f, 0x01, 0xf1, // MOV $F1, #$01
+    0xe4, 0xf4,       // port: MOV A, $F4
+    0x64, 0x00,       //       CMP A, $00
+    0xf0, 0xfa,       //       BEQ port
+    0xc4, 0x00,       //       MOV $00, A
+    0xc4, 0xf5,       //       MOV $F5, A
+    0xeb, 0xfd,       // timer: MOV Y, $FD
+    0xf0, 0xfc,       //        BEQ timer
+    0xab, 0x01,       //        INC $01
+    0x2f, 0xee,       //        BRA port
+};
+constexpr uint16_t pollingDriverStart = 0x200;
+constexpr uint64_t pollingCycles = 50000000;
+// In SPC cycles, the stage 1 clock of timer 0 is 8 kHz
+constexpr int timerDivider = 128;
+
+// The CPU ports and timer 0 at SPC cycle resolution, and the driver on top of them. Returns
+// the port writes of the driver and its final state, one per line.
+std::string runPollingDriver(Output& output, bool skipIdle, uint64_t& executed)
+{
+    SPC::State state(output);
+    SPC::AudioRam& memory = state.getMemory();
+    std::ostringstream log;
+
+    uint64_t cycle = 0;
+    std::array<Byte, 4> ports = {};
+    bool timerEnabled = false;
+    int timerTarget = 0x100;
+    int timerTick = 0;
+    int timerCounter = 0;
+    memory.createLocation<WriteRegister>(Word(0xf1), [&](Byte, Byte value) { timerEnabled = value & 1; });
+    memory.createLocation<WriteRegister>(Word(0xfa), [&](Byte, Byte value) { timerTarget = value == 0 ? 0x100 : int(value); });
+    for (int i = 0; i < 4; ++i)
+    {
+        memory.createLocation<ReadWriteRegister>(Word(0xf4 + i),
+            [&ports, i](Byte& value) { value = ports[i]; },
+            [&log, &cycle, i](Byte, Byte value) { log << "W " << i << ' ' << cycle << ' ' << value << '\n'; });
+    }
+    // Reading the counter clears it
+    memory.createLocation<ReadRegister>(Word(0xfd), [&timerCounter](Byte& value) { value = Byte(uint8_t(timerCounter)); timerCounter = 0; }, true);
+    memory.finalize();
+    for (int i = 0; i < int(sizeof(pollingDriver)); ++i)
+    {
+        memory.writeByte(Byte(pollingDriver[i]), Word(pollingDriverStart + i));
+    }
+    memory.writeByte(Byte(0), Word(0x00));
+    memory.writeByte(Byte(0), Word(0x01));
+    state.setProgramCounter(Word(pollingDriverStart));
+
+    // The CPU ports and timer outputs, as in the emulator
+    SPC::IdleLoopDetector idleLoop(state, 0xe0f0,
+        [&](Word address)
+        {
+            return address == 0xfd ? Byte(uint8_t(timerCounter)) : ports[address - 0xf4];
+        });
+    SPC::InstructionDecoder decoder;
+
+    std::mt19937 random(99);
+    uint64_t nextPortWrite = 5000;
+    uint64_t nextStep = 0;
+    executed = 0;
+    for (; cycle < pollingCycles; ++cycle)
+    {
+        // The CPU and the timer come before the SPC steps of the same cycle
+        if (cycle == nextPortWrite)
+        {
+            ports[0] = Byte(uint8_t(random()));
+            nextPortWrite += 1 + random() % 20000;
+        }
+        if (cycle % timerDivider == 0 && timerEnabled && ++timerTick >= timerTarget)
+        {
+            timerTick = 0;
+            timerCounter = (timerCounter + 1) & 0xf;
+        }
+        if (cycle != nextStep)
+        {
+            continue;
+        }
+        int cycles = skipIdle ? idleLoop.skip() : 0;
+        if (cycles)
+        {
+            // Bounded like in the emulator even when the loop polls neither
+            uint64_t quietCycles = 1000;
+            if (idleLoop.polls([](Word address) { return address >= 0xf4 && address <= 0xf7; }))
+            {
+                quietCycles = std::min(quietCycles, nextPortWrite - cycle);
+            }
+            if (idleLoop.polls([](Word address) { return address == 0xfd; }) && timerEnabled)
+            {
+                const uint64_t nextCounterCycle = (cycle / timerDivider + timerTarget - timerTick) * timerDivider;
+                quietCycles = std::min(quietCycles, nextCounterCycle - cycle);
+            }
+            cycles += idleLoop.skipWithin(int(quietCycles) - cycles);
+        }
+        else
+        {
+            cycles = decoder.execute(state);
+            idleLoop.update(cycles);
+            ++executed;
+        }
+        nextStep += cycles;
+    }
+    idleLoop.wake();
+
+    log << "S " << state.getProgramCounter() << ' ' << state.readRegister<SPC::State::Register::A>() << ' '
+        << state.readRegister<SPC::State::Register::X>() << ' ' << state.readRegister<SPC::State::Register::Y>() << ' '
+        << state.readRegister<SPC::State::Register::SP>() << ' ' << state.readRegister<SPC::State::Register::PSW>() << ' '
+        << memory.getBus() << ' ' << memory.inspect(Word(0x00)) << ' ' << memory.inspect(Word(0x01)) << '\n';
+    return log.str();
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Output::System outputSystem("logconfig.txt");
+    Output output(outputSystem, "main");
+
+    int programCount = defaultProgramCount;
+    std::ofstream trace;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string argument = argv[i];
+        if (argument == "--programs" && i + 1 < argc)
+        {
+            programCount = std::stoi(argv[++i]);
+        }
+        else if (argument == "--trace" && i + 1 < argc)
+        {
+            trace.open(argv[++i]);
+        }
+        else
+        {
+            output.error("Usage: SpcCheck [--programs <count>] [--trace <file>]");
+            return 2;
+        }
+    }
+
+    try
+    {
+        // Both machines share the decoder, like the emulator does for both paths
+        SPC::InstructionDecoder decoder;
+        std::unique_ptr<Machine> table = std::make_unique<Machine>(output);
+        std::unique_ptr<Machine> wrapper = std::make_unique<Machine>(output);
+        // FNV-1a over the trace text
+        uint64_t hash = Hash::fnvOffsetBasis;
+
+        std::mt19937 tableRandom(1234);
+        std::mt19937 wrapperRandom(1234);
+        for (int program = 0; program < programCount; ++program)
+        {
+            table->randomize(tableRandom);
+            wrapper->randomize(wrapperRandom);
+            for (int step = 0; step < stepCount; ++step)
+            {
+                const std::string tableLine = table->step([&decoder](SPC::State& state) { return decoder.execute(state); });
+                const std::string wrapperLine = wrapper->step([&decoder](SPC::State& state) { return decoder.getNextInstruction(state)->execute(state); });
+                if (tableLine != wrapperLine)
+                {
+                    output.error("Program ", program, ", step ", step, ": the handler table gave ", tableLine, "and the wrappers ", wrapperLine);
+                    return 1;
+                }
+                hash = Hash::fnv1a(tableLine.data(), tableLine.size(), hash);
+                trace << tableLine;
+            }
+            const std::string tableMemory = table->hashMemory();
+            if (tableMemory != wrapper->hashMemory())
+            {
+                output.error("Program ", program, ": the RAM differs between the handler table and the wrappers");
+                return 1;
+            }
+            hash = Hash::fnv1a(tableMemory.data(), tableMemory.size(), hash);
+            trace << tableMemory;
+        }
+
+        output.info("Ran ", programCount, " programs of ", stepCount, " instructions, trace hash ", std::hex, hash, std::dec);
+        if (programCount == defaultProgramCount && hash != referenceHash)
+        {
+            output.error("The trace differs from the reference, which hashes to ", std::hex, referenceHash, std::dec);
+            return 1;
+        }
+
+        uint64_t plainExecuted = 0;
+        uint64_t idleExecuted = 0;
+        const std::string plainLog = runPollingDriver(output, false, plainExecuted);
+        const std::string idleLog = runPollingDriver(output, true, idleExecuted);
+        if (plainLog != idleLog)
+        {
+            const std::string::const_iterator difference = std::mismatch(plainLog.begin(), plainLog.end(), idleLog.begin(), idleLog.end()).first;
+            output.error("Polling driver: passing over the idle loops differs from executing them after ", std::count(plainLog.cbegin(), difference, '\n'), " lines");
+            return 1;
+        }
+        output.info("Ran the polling driver for ", pollingCycles, " cycles, ", std::count(plainLog.begin(), plainLog.end(), '\n') - 1, " port writes, ", idleExecuted, " of ", plainExecuted, " instructions executed when passing over the idle loops");
+        return 0;
+    }
+    catch (const std::exception& e)
+    {
+        output.error("Check failure: ", e.what());
+        return 2;
+    }
+}
@@ -0,0 +1,332 @@
+#pragma once
+
+#include <array>
+#include <functional>
+
+#include "Types.h"
+#include "Memory.h"
+
+#include "CpuState.h"
+
+namespace CPU {
+
+// Recognises the spin loops games wait for interrupts in, e.g.
+//
+//   loop: LDA $4210
+//         BPL loop
+//
+// or a WRAM flag the NMI handler sets. A loop is idle when one iteration returns to the exact
+// register state it started from without writing memory, and everything it read is either plain
+// memory or a pollable register. Memory can then only change through an interrupt or DMA, which
+// the scheduler wakes the detector for, and the pollable registers are compared before every
+// skipped instruction. As soon as one differs, the real state of that point in the loop is
+// restored, down to the value left on the data bus, so the result is the same as executing. A scheduler that knows when the inputs can
+// next change can pass over all the instructions up to then at once instead.
+class IdleLoopDetector
+{
+public:
+    // Tells whether a register can be read without side effects, and reads it
+    typedef std::function<bool(Long)> PollablePredicate;
+    typedef std::function<Byte(Long)> InputReader;
+
+    static constexpr int maxLoopLength = 8;
+
+    IdleLoopDetector(State& state, PollablePredicate isPollable, InputReader readInput)
+        : state(state)
+        , memory(state.getMemory())
+        , isPollable(isPollable)
+        , readInput(readInput)
+    {
+        next = capture();
+    }
+
+    IdleLoopDetector(const IdleLoopDetector&) = delete;
+    IdleLoopDetector& operator=(const IdleLoopDetector&) = delete;
+
+    // Call after every instruction that was actually executed
+    void update(int cycles)
+    {
+        Step executed = next;
+        executed.cycles = cycles;
+        next = capture();
+
+        if (!recording)
+        {
+            if (cycles > 0 && next.programAddress <= executed.programAddress)
+            {
+                // Backward jump: the target is a candidate loop head
+                startRecording();
+            }
+            return;
+        }
+
+        if (cycles == 0 || stepCount == maxLoopLength || executed.emulationMode != next.emulationMode)
+        {
+            stopRecording();
+            return;
+        }
+
+        steps[stepCount++] = executed;
+
+        if (next.programAddress == steps[0].programAddress)
+        {
+            if (next == steps[0] && memory.getWriteCount() == writeCount && collectInputs())
+            {
+                stopRecording();
+                idle = true;
+                // The loop was entered from elsewhere, the bus is the one its last instruction leaves
+                steps[0].bus = next.bus;
+                stepIndex = 0;
+                loopCycles = 0;
+                for (int i = 0; i < stepCount; ++i)
+                {
+                    loopCycles += steps[i].cycles;
+                }
+            }
+            else
+            {
+                startRecording();
+            }
+        }
+    }
+
+    // While idle and undisturbed, passes over the next instruction of the loop and returns its
+    // cycle count. Otherwise wakes up and returns 0, and the instruction must be executed.
+    int skip()
+    {
+        if (!idle)
+        {
+            return 0;
+        }
+        if (state.getProgramAddress() != steps[0].programAddress)
+        {
+            // The state was changed from outside, e.g. reset by the debugger
+            idle = false;
+            wake();
+            return 0;
+        }
+        for (int i = 0; i < inputCount; ++i)
+        {
+            if (readInput(inputs[i].address) != inputs[i].value)
+            {
+                wake();
+                return 0;
+            }
+        }
+        const int cycles = steps[stepIndex].cycles;
+        stepIndex = (stepIndex + 1) % stepCount;
+        return cycles;
+    }
+
+    // While idle, passes over the instructions of the loop that start less than the given number
+    // of cycles from now without checking the inputs, for when the caller knows that they cannot
+    // change before then. Returns the cycles passed over, which end at the first instruction
+    // that starts at or after that point.
+    int skipWithin(int cycles)
+    {
+        if (!idle || cycles <= 0)
+        {
+            return 0;
+        }
+        int skipped = cycles / loopCycles * loopCycles;
+        while (skipped < cycles)
+        {
+            skipped += steps[stepIndex].cycles;
+            stepIndex = (stepIndex + 1) % stepCount;
+        }
+        return skipped;
+    }
+
+    // Whether the idle loop polls a register the predicate accepts
+    template<typename Predicate>
+    bool polls(Predicate predicate) const
+    {
+        for (int i = 0; i < inputCount; ++i)
+        {
+            if (predicate(inputs[i].address))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Leaves the idle loop, writing back the state of the instruction it was at. Must be called
+    // before anything else inspects or modifies the CPU state, and before interrupts and DMA.
+    void wake()
+    {
+        if (idle)
+        {
+            restore(steps[stepIndex]);
+            idle = false;
+        }
+        stopRecording();
+        next = capture();
+    }
+
+    bool isIdle() const
+    {
+        return idle;
+    }
+
+private:
+    struct Step
+    {
+        Long programAddress;
+        Word accumulator;
+        Word x;
+        Word y;
+        Word stackPointer;
+        Word directPage;
+        Byte dataBank;
+        Byte flags;
+        bool emulationMode = true;
+        // Not part of the comparison, the loop reads the same while idle
+        Byte bus;
+        int cycles = 0;
+
+        bool operator==(const Step& other) const
+        {
+            return programAddress == other.programAddress
+                && accumulator == other.accumulator
+                && x == other.x
+                && y == other.y
+                && stackPointer == other.stackPointer
+                && directPage == other.directPage
+                && dataBank == other.dataBank
+                && flags == other.flags
+                && emulationMode == other.emulationMode;
+        }
+    };
+
+    struct Input
+    {
+        Long address;
+        Byte value;
+    };
+
+    class MemoryVisitor : public LocationVisitor
+    {
+    public:
+        void visit(const InvalidLocation&) override { isMemory = false; }
+        void visit(const ReadOnlyMemory&) override { isMemory = true; }
+        void visit(const ReadWriteMemory&) override { isMemory = true; }
+        void visit(const ReadRegister&) override { isMemory = false; }
+        void visit(const WriteRegister&) override { isMemory = false; }
+        void visit(const ReadWriteRegister&) override { isMemory = false; }
+        void visit(const ArrayLocation&) override { isMemory = true; }
+
+        bool isMemory = false;
+    };
+
+    Step capture() const
+    {
+        Step step;
+        step.programAddress = state.getProgramAddress();
+        step.accumulator = state.getAccumulatorC();
+        step.x = state.getIndexRegister<State::IndexRegister::X>();
+        step.y = state.getIndexRegister<State::IndexRegister::Y>();
+        step.stackPointer = state.getStackPointer();
+        step.directPage = state.getDirectPageRegister();
+        step.dataBank = state.getDataBank();
+        step.flags = state.getFlags();
+        step.emulationMode = !state.isNativeMode();
+        step.bus = memory.getBus();
+        return step;
+    }
+
+    void restore(const Step& step)
+    {
+        // The register setters update N and Z, so the flags are written last as well
+        state.setFlags(step.flags);
+        state.setProgramAddress(step.programAddress);
+        state.setAccumulatorC(step.accumulator);
+        state.setIndexRegister<State::IndexRegister::X>(step.x);
+        state.setIndexRegister<State::IndexRegister::Y>(step.y);
+        state.setStackPointer(step.stackPointer);
+        state.setDirectPageRegister(step.directPage);
+        state.setDataBank(step.dataBank);
+        state.setFlags(step.flags);
+        memory.setBus(step.bus);
+    }
+
+    void startRecording()
+    {
+        recording = true;
+        stepCount = 0;
+        writeCount = memory.getWriteCount();
+        readLog.clear();
+        memory.setReadLog(&readLog);
+    }
+
+    void stopRecording()
+    {
+        recording = false;
+        memory.setReadLog(nullptr);
+    }
+
+    // Sorts the reads of the recorded iteration into plain memory and pollable inputs, and
+    // fails if anything else was read or an input changed during the iteration
+    bool collectInputs()
+    {
+        if (readLog.overflow)
+        {
+            return false;
+        }
+        inputCount = 0;
+        for (int i = 0; i < readLog.count; ++i)
+        {
+            const ReadLog<Long>::Entry& entry = readLog.entries[i];
+            MemoryVisitor visitor;
+            memory.accept(entry.address, visitor);
+            if (visitor.isMemory)
+            {
+                continue;
+            }
+            if (!isPollable(entry.address))
+            {
+                return false;
+            }
+            bool known = false;
+            for (int j = 0; j < inputCount; ++j)
+            {
+                if (inputs[j].address == entry.address)
+                {
+                    if (inputs[j].value != entry.value)
+                    {
+                        return false;
+                    }
+                    known = true;
+                }
+            }
+            if (!known)
+            {
+                inputs[inputCount++] = { entry.address, entry.value };
+            }
+        }
+        return true;
+    }
+
+    State& state;
+    State::MemoryType& memory;
+
+    const PollablePredicate isPollable;
+    const InputReader readInput;
+
+    Step next;
+
+    bool recording = false;
+    bool idle = false;
+
+    std::array<Step, maxLoopLength> steps;
+    int stepCount = 0;
+    int stepIndex = 0;
+    int loopCycles = 0;
+    uint64_t writeCount = 0;
+    ReadLog<Long> readLog;
+
+    std::array<Input, ReadLog<Long>::capacity> inputs;
+    int inputCount = 0;
+};
+
+}
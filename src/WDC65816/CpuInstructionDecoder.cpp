@@ -36,16 +36,19 @@ struct OpcodeWrapper : Instruction<State>
 };
 
 template<std::size_t... Indices>
-constexpr std::array<Instruction<State>*, Byte::spaceSize> makeInstructionSequence(std::index_sequence<Indices...>)
+std::array<std::unique_ptr<Instruction<State>>, Byte::spaceSize> makeInstructionSequence(std::index_sequence<Indices...>)
 {
-    return { new OpcodeWrapper<Indices>()... };
+    return { std::make_unique<OpcodeWrapper<Indices>>()... };
 }
 
-static constexpr std::array<Instruction<State>*, Byte::spaceSize> makeInstructions()
+static std::array<std::unique_ptr<Instruction<State>>, Byte::spaceSize> makeInstructions()
 {
     return makeInstructionSequence(std::make_index_sequence<Byte::spaceSize>{ });
 }
 
-std::array<Instruction<State>*, Byte::spaceSize> InstructionDecoder::instructions = makeInstructions();
+InstructionDecoder::InstructionDecoder()
+    : instructions(makeInstructions())
+{
+}
 
 }
\ No newline at end of file
@@ -12,7 +12,8 @@ namespace CPU {
 class InstructionDecoder
 {
 public:
-    SHARED InstructionDecoder() {}
+    // Creates instruction objects of its own, so that no two emulators share any
+    SHARED InstructionDecoder();
 
     InstructionDecoder(const InstructionDecoder&) = delete;
     InstructionDecoder& operator=(const InstructionDecoder&) = delete;
@@ -24,11 +25,11 @@ public:
 
     Instruction<State>* getInstruction(Byte opcode) const
     {
-        return instructions[opcode];
+        return instructions[opcode].get();
     }
 
 private:
-    static std::array<Instruction<State>*, Byte::spaceSize> instructions;
+    std::array<std::unique_ptr<Instruction<State>>, Byte::spaceSize> instructions;
 };
 
 }
\ No newline at end of file
@@ -13,10 +13,11 @@ namespace CPU {
 
 EXCEPTION(NotYetImplementedException, ::NotYetImplementedException)
 
-CREATE_PROFILER();
-
 }
 
+// The opcodes are specializations outside of the namespace
+CREATE_PROFILER();
+
 // ADC Add With Carry [Flags affected: n,v,z,c]
 // ADC (dp,X)
 // Direct Page Indexed Indirect, X (2-Byte)
@@ -4973,7 +4974,6 @@ struct Opcode<CPU::State, 0xCB>
     {
         PROFILE_IF(PROFILE_OPCODES, "CB: WAI");
 
-        throw NotYetImplementedException("CPU::Opcode<CPU::State, 0xCB>");
         return 3 + Instruction::Type::applyOperand<Instruction>(state);
     }
 
@@ -1665,7 +1665,7 @@ public:
     {
         PROFILE_IF(PROFILE_OPERATORS, "WAI");
 
-        throw NotYetImplementedException("CPU::Operator::WAI");
+        state.setWaitingForInterrupt(true);
         return 0;
     }
 
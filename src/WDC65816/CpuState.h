@@ -98,6 +98,13 @@ private:
             return Word(accumulatorA, accumulatorB);
         }
 
+        template<typename Archive>
+        void serialize(Archive& archive)
+        {
+            archive(accumulatorA);
+            archive(accumulatorB);
+        }
+
     private:
         Byte accumulatorA;
         Byte accumulatorB;
@@ -639,6 +646,17 @@ public:
         return irqActive;
     }
 
+    // Set by WAI, the scheduler stops executing instructions until an interrupt is requested
+    void setWaitingForInterrupt(bool value)
+    {
+        waitingForInterrupt = value;
+    }
+
+    bool isWaitingForInterrupt() const
+    {
+        return waitingForInterrupt;
+    }
+
     InterruptVectors& getInterruptVectors(bool native)
     {
         if (native) {
@@ -651,9 +669,7 @@ public:
 
     void reset()
     {
-        for (uint32_t i = 0; i < memory.size(); ++i) {
-            memory.reset(i);
-        }
+        memory.resetApplicationCounts();
 
         dataBank = 0;
         directPage = 0;
@@ -665,6 +681,7 @@ public:
 
         nmiActive = false;
         irqActive = false;
+        waitingForInterrupt = false;
 
         // DMA Enable
         memory.writeByte(0, 0x420b);
@@ -674,6 +691,24 @@ public:
         forceRegisters();
     }
 
+    template<typename Archive>
+    void serialize(Archive& archive)
+    {
+        archive(dataBank);
+        archive(directPage);
+        archive(stackPointer);
+        archive(programBank);
+        archive(programCounter);
+        archive(flags);
+        archive(emulationMode);
+        archive(accumulator);
+        archive(indexRegisters);
+        archive(nmiActive);
+        archive(irqActive);
+        archive(waitingForInterrupt);
+        archive(memory);
+    }
+
 public:
     Output output;
 
@@ -697,6 +732,7 @@ private:
 
     bool nmiActive = false;
     bool irqActive = false;
+    bool waitingForInterrupt = false;
 };
 
 }
\ No newline at end of file